@@ -14,6 +14,15 @@ CREATE LIBRARY FilePortionSourceLib as :libfile;
 \set libparser '\''`pwd`'/build/DelimFilePortionParser.so\''
 CREATE LIBRARY DelimFilePortionParserLib as :libparser;
 
+\set gzip_libfile '\''`pwd`'/build/GZipPortionSource.so\''
+CREATE LIBRARY GZipPortionSourceLib as :gzip_libfile;
+
+\set zstd_libfile '\''`pwd`'/build/ZstdPortionSource.so\''
+CREATE LIBRARY ZstdPortionSourceLib as :zstd_libfile;
+
+\set http_libfile '\''`pwd`'/build/HttpPortionSource.so\''
+CREATE LIBRARY HttpPortionSourceLib as :http_libfile;
+
 \set native_libfile '\''`pwd`'/build/NativeIntegerParser.so\'';
 CREATE LIBRARY NativeIntegerParserLib AS :native_libfile;
 
@@ -21,6 +30,15 @@ CREATE LIBRARY NativeIntegerParserLib AS :native_libfile;
 CREATE SOURCE FilePortionSource AS 
 LANGUAGE 'C++' NAME 'FilePortionSourceFactory' LIBRARY FilePortionSourceLib; 
 
+CREATE SOURCE GZipPortionSource AS
+LANGUAGE 'C++' NAME 'GZipPortionSourceFactory' LIBRARY GZipPortionSourceLib;
+
+CREATE SOURCE ZstdPortionSource AS
+LANGUAGE 'C++' NAME 'ZstdPortionSourceFactory' LIBRARY ZstdPortionSourceLib;
+
+CREATE SOURCE HttpPortionSource AS
+LANGUAGE 'C++' NAME 'HttpPortionSourceFactory' LIBRARY HttpPortionSourceLib;
+
 CREATE PARSER DelimFilePortionParser AS 
 LANGUAGE 'C++' NAME 'DelimFilePortionParserFactory' LIBRARY DelimFilePortionParserLib; 
 
@@ -47,6 +65,59 @@ truncate table t;
 copy t with source FilePortionSource(file=:data, offsets='0,1234,5678,91011,121314') parser DelimFilePortionParser(delimiter = '|', record_terminator = '~');
 truncate table t;
 
+-- each portion read with several reads in flight at once
+copy t with source FilePortionSource(file=:data, read_mode='async', queue_depth=8, block_size=65536, local_min_portion_size=16384) parser DelimFilePortionParser(delimiter = '|', record_terminator = '~');
+select count(*) from t;
+truncate table t;
+
+-- portions cut at record terminators; the first load finds the cuts and keeps them in
+-- /tmp/apls_delim.dat.rbidx, later loads just read them back
+copy t with source FilePortionSource(file=:data, record_terminator='~', local_min_portion_size=16384) parser DelimFilePortionParser(delimiter = '|', record_terminator = '~');
+select count(*) from t;
+truncate table t;
+
+-- whole files to each node, as evenly by size as possible; only files bigger than a node's share are split
+copy t with source FilePortionSource(file=:data, assign_by_size=true) parser DelimFilePortionParser(delimiter = '|', record_terminator = '~');
+select count(*) from t;
+truncate table t;
+
+-- sources take 64KB ranges from a queue as they go, rather than being given fixed portions
+copy t with source FilePortionSource(file=:data, record_terminator='~', dynamic_portions=true, range_size=65536, local_min_portion_size=16384) parser DelimFilePortionParser(delimiter = '|', record_terminator = '~');
+select count(*) from t;
+truncate table t;
+
+-- list /tmp (and stat the files) from a manifest in /tmp/apls_manifests, while /tmp hasn't changed
+\! mkdir -p /tmp/apls_manifests
+copy t with source FilePortionSource(file='/tmp/apls_delim*.dat', manifest_dir='/tmp/apls_manifests') parser DelimFilePortionParser(delimiter = '|', record_terminator = '~');
+select count(*) from t;
+truncate table t;
+
+
+-- apportioned load of a gzip file; the first load builds /tmp/apls_delim.dat.gz.gzidx,
+-- an index of places decompression can start from, and later loads reuse it
+\! gzip -c /tmp/apls_delim.dat > /tmp/apls_delim.dat.gz
+copy t with source GZipPortionSource(file='/tmp/apls_delim.dat.gz', index_span_mb=1, local_min_portion_size=16384) parser DelimFilePortionParser(delimiter = '|', record_terminator = '~');
+select count(*) from t;
+truncate table t;
+
+-- apportioned load of a zstd file in the seekable format: independent frames
+-- followed by a seek table (see contrib/seekable_format in the zstd sources),
+-- split at frame boundaries.  Here the frames are made with split(1) and zstd,
+-- and the seek table is appended by hand.
+\! split -b 65536 /tmp/apls_delim.dat /tmp/apls_zst_part_
+\! python -c "import glob,struct,subprocess; ps=sorted(glob.glob('/tmp/apls_zst_part_*')); fs=[(subprocess.check_output(['zstd','-q','-c',p]),len(open(p,'rb').read())) for p in ps]; t=b''.join([struct.pack('<II',len(z),n) for z,n in fs]); open('/tmp/apls_delim.dat.zst','wb').write(b''.join([z for z,n in fs])+struct.pack('<II',0x184D2A5E,len(t)+9)+t+struct.pack('<IBI',len(fs),0,0x8F92EAB1))"
+copy t with source ZstdPortionSource(file='/tmp/apls_delim.dat.zst', local_min_portion_size=16384) parser DelimFilePortionParser(delimiter = '|', record_terminator = '~');
+select count(*) from t;
+truncate table t;
+
+-- apportioned load of one URL, each portion fetched with its own HTTP range request;
+-- served here by a small python server that answers "Range: bytes=<start>-<end>"
+\! /bin/echo -e "import os, sys\ntry:\n    from http.server import SimpleHTTPRequestHandler, HTTPServer\n    from socketserver import ThreadingMixIn\nexcept ImportError:\n    from SimpleHTTPServer import SimpleHTTPRequestHandler\n    from BaseHTTPServer import HTTPServer\n    from SocketServer import ThreadingMixIn\nclass RangeHandler(SimpleHTTPRequestHandler):\n    def send_head(self):\n        r = self.headers.get('Range')\n        if not r or not r.startswith('bytes='): return SimpleHTTPRequestHandler.send_head(self)\n        f = open(self.translate_path(self.path), 'rb'); size = os.fstat(f.fileno()).st_size\n        a, b = r[6:].split('-'); start = int(a); end = min(int(b or size - 1), size - 1)\n        self.send_response(206); self.send_header('Content-Range', 'bytes %d-%d/%d' % (start, end, size))\n        self.send_header('Content-Length', str(end - start + 1)); self.end_headers()\n        f.seek(start); self.wfile.write(f.read(end - start + 1)); f.close()\nclass Server(ThreadingMixIn, HTTPServer): pass\nos.chdir('/tmp'); Server(('', int(sys.argv[1])), RangeHandler).serve_forever()" > /tmp/apls_range_server.py
+\! python /tmp/apls_range_server.py 8719 > /dev/null 2>&1 & echo $! > /tmp/apls_range_server.pid; sleep 1
+copy t with source HttpPortionSource(url='http://localhost:8719/apls_delim.dat', local_min_portion_size=16384) parser DelimFilePortionParser(delimiter = '|', record_terminator = '~');
+select count(*) from t;
+truncate table t;
+\! kill `cat /tmp/apls_range_server.pid`
 
 
 -- NativeIntegerParser: uses apportioned load both with and without a chunker
@@ -61,9 +132,14 @@ copy tt from '/tmp/nativeints.dat' parser NativeIntParser();
 -- Step 4: Cleanup
 drop table tt;
 drop table t;
-\! rm /tmp/apls_delim*.dat
+\! rm /tmp/apls_delim*.dat /tmp/apls_delim.dat.rbidx /tmp/apls_delim.dat.gz* /tmp/apls_delim.dat.zst /tmp/apls_zst_part_*
+\! rm -r /tmp/apls_manifests
+\! rm /tmp/apls_range_server.py /tmp/apls_range_server.pid
 
 --Cleanup Libraries
 DROP LIBRARY FilePortionSourceLib CASCADE;
+DROP LIBRARY GZipPortionSourceLib CASCADE;
+DROP LIBRARY ZstdPortionSourceLib CASCADE;
+DROP LIBRARY HttpPortionSourceLib CASCADE;
 DROP LIBRARY DelimFilePortionParserLib CASCADE;
 DROP LIBRARY NativeIntegerParserLib CASCADE;
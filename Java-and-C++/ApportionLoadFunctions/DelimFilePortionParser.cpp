@@ -329,7 +329,7 @@ public:
 
         // If we didn't reject the row, emit it
         if (!rejected) {
-            writer->next();
+            emitRow();
             recordsAcceptedInBatch++;
         }
     }
@@ -449,6 +449,8 @@ public:
         parameterTypes.addVarchar(1, "delimiter");
         parameterTypes.addVarchar(1, "record_terminator");
         parameterTypes.addVarchar(256, "format");
+        LoadCounters::addParameterType(parameterTypes);
+        CoroutineTracer::addParameterType(parameterTypes);
     }
 };
 
@@ -2,9 +2,13 @@
 
 #include "Vertica.h"
 #include "LoadArgParsers.h"
+#include "RecordBoundaries.h"
+#include "RangeQueue.h"
+#include "PortionPlanner.h"
+#include "FileAssignment.h"
+#include "FileEnumerator.h"
 #include "../examples/SourceFunctions/filelib.cpp"
 #include <stdio.h>
-#include <glob.h>
 #include <iostream>
 #include <string>
 #include <algorithm>
@@ -26,20 +30,25 @@ private:
     Portion portion;
 
 public:
-    FilePortionSource(const std::string &filename, Portion p) : FileSource(filename), portion(p) {}
+    FilePortionSource(const std::string &filename, Portion p, const std::string &readMode = "stdio",
+                      size_t blockSize = FileReader::DEFAULT_BLOCK_SIZE,
+                      size_t queueDepth = FileReader::DEFAULT_QUEUE_DEPTH)
+        : FileSource(filename, readMode, blockSize, queueDepth), portion(p) {}
 
     // This function is required for apportion load to get source's portion information
     Portion getPortion() {
         return portion;
     }
 
-    void setup(ServerInterface &srvInterface) {
-        FileSource::setup(srvInterface);
-        // seek portion to its file offset
-        int r = fseek(handle, portion.offset, SEEK_SET);
-        if (r) {
-            vt_report_error(0, "disk seek failed for file %s at offset %lld", filename.c_str(), portion.offset);
-        }
+    // Start reading at the portion's offset
+    off_t getStartOffset() {
+        return portion.offset;
+    }
+
+    // The parser reads a little past the end of the portion to finish
+    // its last record, but no further
+    off_t getEndHint() {
+        return portion.size < 0 ? -1 : portion.offset + portion.size;
     }
 
     virtual vint getSize() {
@@ -47,6 +56,90 @@ public:
     }
 };
 
+/**
+ * FileRangeSource
+ *
+ * Reads ranges of files from a RangeQueue shared with the node's other
+ * sources, one after another, until the queue is empty.  The ranges
+ * are made up of whole records, so the parser gets an ordinary stream
+ * of records rather than a portion of a file.
+ *
+ * The source keeps one reader for all its ranges, so the async engine
+ * is only started once; but each range still reopens the file and
+ * starts its read-ahead over.  With read_mode 'direct' or 'async', a
+ * range_size of less than a few times block_size * queue_depth spends
+ * much of its time waiting on the first blocks of each range.
+ */
+class FileRangeSource : public FileSource {
+private:
+    RangeQueue *queue;
+    const char terminator;
+
+    FileRange range;
+    uint64_t remaining;     // Bytes of `range` still to read
+    bool needTerminator;    // The range ended the file, without a terminator
+    char lastByte;
+
+public:
+    FileRangeSource(RangeQueue *queue, char terminator, const std::string &readMode,
+                    size_t blockSize, size_t queueDepth)
+        : FileSource("", readMode, blockSize, queueDepth), queue(queue), terminator(terminator),
+          remaining(0), needTerminator(false), lastByte(terminator) {
+        queue->addRef();
+    }
+
+    virtual ~FileRangeSource() {
+        // In case destroy() wasn't called
+        if (queue) RangeQueue::release(queue);
+    }
+
+    virtual void setup(ServerInterface &srvInterface) {
+        reader = FileReader::create(readMode, blockSize, queueDepth);
+        if (reader == NULL) {
+            vt_report_error(0, "Invalid read_mode '%s'", readMode.c_str());
+        }
+    }
+
+    virtual void destroy(ServerInterface &srvInterface) {
+        FileSource::destroy(srvInterface);
+        if (queue) RangeQueue::release(queue);
+        queue = NULL;
+    }
+
+    virtual StreamState process(ServerInterface &srvInterface, DataBuffer &output) {
+        while (output.offset < output.size) {
+            if (remaining > 0) {
+                const size_t n = reader->read(output.buf + output.offset,
+                        std::min((uint64_t)(output.size - output.offset), remaining));
+                if (n == 0) {
+                    vt_report_error(0, "Unexpected end of file [%s] at byte %llu; was it changed during the load?",
+                                    filename.c_str(), (unsigned long long)(range.end - remaining));
+                }
+                lastByte = output.buf[output.offset + n - 1];
+                output.offset += n;
+                remaining -= n;
+                // Don't let the file's last record run on into the next range
+                needTerminator = (remaining == 0 && range.endsFile && lastByte != terminator);
+            } else if (needTerminator) {
+                output.buf[output.offset++] = terminator;
+                needTerminator = false;
+            } else if (queue->next(range)) {
+                reader->close();
+                filename = range.filename;
+                reader->open(filename, range.start, range.end);
+                remaining = range.end - range.start;
+            } else {
+                return DONE;
+            }
+        }
+        return OUTPUT_NEEDED;
+    }
+
+    virtual vint getSize() {
+        return vint_null;
+    }
+};
+
 class FilePortionSourceFactory : public SourceFactory {
 public:
     virtual void plan(ServerInterface &srvInterface,
@@ -58,7 +151,33 @@ public:
         argSpec.push_back((ArgEntry){"nodes", false, VerticaType(VarcharOID, -1)});
         argSpec.push_back((ArgEntry){"offsets", false, VerticaType(VarcharOID, -1)});
         argSpec.push_back((ArgEntry){"local_min_portion_size", false, VerticaType(Int8OID, -1)});
+        argSpec.push_back((ArgEntry){"read_mode", false, VerticaType(VarcharOID, -1)});
+        argSpec.push_back((ArgEntry){"block_size", false, VerticaType(Int8OID, -1)});
+        argSpec.push_back((ArgEntry){"queue_depth", false, VerticaType(Int8OID, -1)});
+        argSpec.push_back((ArgEntry){"record_terminator", false, VerticaType(VarcharOID, -1)});
+        argSpec.push_back((ArgEntry){"dynamic_portions", false, VerticaType(BoolOID, -1)});
+        argSpec.push_back((ArgEntry){"range_size", false, VerticaType(Int8OID, -1)});
+        argSpec.push_back((ArgEntry){"assign_by_size", false, VerticaType(BoolOID, -1)});
+        argSpec.push_back((ArgEntry){"manifest_dir", false, VerticaType(VarcharOID, -1)});
         validateArgs("FilePortionSource", argSpec, srvInterface.getParamReader());
+        if (srvInterface.getParamReader().containsParameter("record_terminator")
+                && srvInterface.getParamReader().getStringRef("record_terminator").length() != 1) {
+            vt_report_error(0, "parameter \"record_terminator\" must be a single character");
+        }
+        if (isDynamic(srvInterface)) {
+            if (!srvInterface.getParamReader().containsParameter("record_terminator")) {
+                vt_report_error(0, "parameter \"dynamic_portions\" needs \"record_terminator\"");
+            }
+            if (srvInterface.getParamReader().containsParameter("offsets")) {
+                vt_report_error(0, "parameters \"dynamic_portions\" and \"offsets\" cannot be used together");
+            }
+            if (getRangeSize(srvInterface) <= 0) {
+                vt_report_error(0, "parameter \"range_size\" must be positive");
+            }
+        }
+        FileReader::validateArgs(FileSourceFactory::getReadMode(srvInterface),
+                                 FileSourceFactory::getBlockSize(srvInterface),
+                                 FileSourceFactory::getQueueDepth(srvInterface));
 
         /* Populate planData */
         // Nothing to do here
@@ -66,35 +185,19 @@ public:
         /* Munge nodes list */
 
         // only add the nodes specified in "nodes" arg, into execution node list;
-        std::string nodes_arg;
-        if (srvInterface.getParamReader().containsParameter("nodes")) {
-            nodes_arg = srvInterface.getParamReader().getStringRef("nodes").str();
-        } else {
-            nodes_arg = srvInterface.getCurrentNodeName();
-        }
-        findExecutionNodes(srvInterface.getParamReader(), planCtxt, nodes_arg);
-
-        std::vector<std::string> exe_nodes = planCtxt.getTargetNodes();
-        uint num_nodes_needed = exe_nodes.size();
+        // with "offsets", no more nodes than there are portions
+        size_t maxNodes = (size_t)-1;
         if (srvInterface.getParamReader().containsParameter("offsets")) {
             std::string offsets = srvInterface.getParamReader().getStringRef("offsets").str();
-            uint num_portions = std::count(offsets.begin(), offsets.end(), ',') + 1;
-            if (num_nodes_needed > num_portions) {
-                num_nodes_needed = num_portions;
-            }
+            maxNodes = std::count(offsets.begin(), offsets.end(), ',') + 1;
         }
-
-        // Set which nodes should be used
-        std::vector<std::string> usedNodesStr;
         // now give each node a unique id so that they know how to grab portions from a source..
-        Vertica::ParamWriter &pwriter = planCtxt.getWriter();
-        for(uint i = 0; i < num_nodes_needed; i++)
-        {
+        planPortionNodes(srvInterface, planCtxt, maxNodes);
+
+        const std::vector<std::string> exe_nodes = planCtxt.getTargetNodes();
+        for (size_t i = 0; i < exe_nodes.size(); i++) {
             srvInterface.log("plan(): actual execution nodes were: %s", exe_nodes[i].c_str());
-            pwriter.setInt(exe_nodes[i], i);
-            usedNodesStr.push_back(exe_nodes[i]);
         }
-        planCtxt.setTargetNodes(usedNodesStr);
     }
 
     /* how many threads do we want to use? */
@@ -109,22 +212,34 @@ public:
          * so it is fine to access and use any local files and resources
          */
         std::vector<std::string> paths;
-
-        glob_t globbuf;
-        globbuf.gl_offs = 0;
-        int globres = glob(filename.c_str(), GLOB_ERR, NULL, &globbuf);
-        if (globres == GLOB_NOSPACE) {
-            vt_report_error(0, "Out of memory when expanding glob: %s", filename.c_str());
-        } else if (globres == GLOB_ABORTED) {
-            vt_report_error(0, "Read error when expanding glob: %s", filename.c_str());
-        } else if (globres == GLOB_NOMATCH) {
+        std::vector<uint64_t> pathSizes;
+
+        const std::string manifestDir = LoadedFiles::getManifestDir(srvInterface);
+        FileEnumerator enumerator(manifestDir);
+        std::vector<FileEntry> files;
+        const FileEnumerator::Result found = enumerator.expand(filename, true, files);
+        if (found == FileEnumerator::READ_ERROR) {
+            vt_report_error(0, "Read error when expanding glob: %s (reading [%s]: %s)", filename.c_str(),
+                            enumerator.getErrorPath().c_str(), strerror(enumerator.getErrorCode()));
+        } else if (found == FileEnumerator::NO_MATCH) {
             vt_report_error(0, "No files matching pattern [%s] were found", filename.c_str());
         } else {
-            for (size_t count = 0; count < globbuf.gl_pathc; count++) {
-                paths.push_back(globbuf.gl_pathv[count]);
+            for (size_t count = 0; count < files.size(); count++) {
+                // Leave out our own record boundary files
+                if (!RecordBoundaries::isSidecarPath(files[count].path)) {
+                    paths.push_back(files[count].path);
+                    pathSizes.push_back(files[count].size);
+                }
             }
+            if (paths.empty()) {
+                vt_report_error(0, "No files matching pattern [%s] were found", filename.c_str());
+            }
+        }
+        if (!manifestDir.empty()) {
+            srvInterface.log("FilePortionSource: used %zu and saved %zu directory manifests in [%s]",
+                             enumerator.getManifestsUsed(), enumerator.getManifestsSaved(),
+                             manifestDir.c_str());
         }
-        globfree(&globbuf);
 
         const std::string nodeName = srvInterface.getCurrentNodeName();
         const size_t nodeId = planCtxt.getWriter().getIntRef(nodeName);
@@ -202,27 +317,64 @@ public:
          *
          * We'll start by figuring out what this node is responsible for.
          */
-        std::map<std::string, Portion> *portions =
-            vt_createFuncObject<std::map<std::string, Portion> >(srvInterface.allocator);
+        std::multimap<std::string, Portion> *portions =
+            vt_createFuncObject<std::multimap<std::string, Portion> >(srvInterface.allocator);
         planCtxt.getWriter().setPointer("portionMap", portions);
 
-        for (std::vector<std::string>::const_iterator file = paths.begin();
-                file != paths.end(); ++file) {
-            const size_t fileSize = getFileSize(*file);
-            Portion p;
-            p.offset = (fileSize / numNodes) * nodeId;
-            p.size = nodeId == numNodes - 1 ?
-                fileSize - p.offset : (fileSize / numNodes); /* last node gets the rest */
-            p.is_first_portion = p.offset == 0;
-
-            if (p.size > 0 || nodeId == numNodes - 1) {
-                (*portions)[*file] = p;
+        if (isAssignedBySize(srvInterface)) {
+            /*
+             * Rather than a slice of every file, each node gets whole files, as
+             * evenly by size as possible; only files bigger than a node's share
+             * are split.  Every node sees the same files (in the same order, as
+             * FileEnumerator sorts them), so they all come up with the same assignment.
+             */
+            const std::vector<FileAssignment> assignments = assignFilesBySize(pathSizes, numNodes, true);
+            for (std::vector<FileAssignment>::const_iterator piece = assignments.begin();
+                    piece != assignments.end(); ++piece) {
+                if (piece->node == nodeId) {
+                    Portion p(piece->offset);
+                    p.size = piece->size;
+                    p.is_first_portion = (piece->offset == 0);
+                    portions->insert(std::make_pair(paths[piece->file], p));
+                    srvInterface.log("FilePortionSource: assigning [%s] [offset = %lld, size = %lld]",
+                            paths[piece->file].c_str(), p.offset, p.size);
+                }
+            }
+        } else {
+            for (size_t file = 0; file < paths.size(); file++) {
+                const size_t fileSize = pathSizes[file];
+                Portion p;
+                p.offset = (fileSize / numNodes) * nodeId;
+                p.size = nodeId == numNodes - 1 ?
+                    fileSize - p.offset : (fileSize / numNodes); /* last node gets the rest */
+                p.is_first_portion = p.offset == 0;
+
+                if (p.size > 0 || nodeId == numNodes - 1) {
+                    portions->insert(std::make_pair(paths[file], p));
+                }
             }
         }
 
+        const vint localMinPortionSize = getLocalMinPortionSize(srvInterface);
+
+        if (isDynamic(srvInterface)) {
+            /*
+             * Sources take ranges from a queue as they go (see
+             * prepareQueuedRanges()), so any number of them can be kept
+             * busy, up to one per smallest range.
+             */
+            vint queued = 0;
+            for (std::multimap<std::string, Portion>::const_iterator portion = portions->begin();
+                    portion != portions->end(); ++portion) {
+                queued += portion->second.size;
+            }
+            return std::max((vint)1, std::min((vint)planCtxt.getMaxAllowedThreads(),
+                                              queued / localMinPortionSize + 1));
+        }
+
         /* avoid requesting more portions than we have threads */
         if (portions->size() >= planCtxt.getMaxAllowedThreads()) {
-            return paths.size();
+            return portions->size();
         }
 
         /*
@@ -235,15 +387,9 @@ public:
          * evenly-sized pieces.  We won't actually split here, just figure out
          * how much splitting we want to do (halting early if we reach the max threads).
          */
-        const vint localMinPortionSize =
-            srvInterface.getParamReader().containsParameter("local_min_portion_size") ?
-            srvInterface.getParamReader().getIntRef("local_min_portion_size") : 1024 * 1024;
-        if (localMinPortionSize <= 0) {
-            vt_report_error(0, "parameter \"local_min_portion_size\" must be positive");
-        }
 
         std::vector<PortionInfo> splitPortions;
-        for (std::map<std::string, Portion>::const_iterator portion = portions->begin();
+        for (std::multimap<std::string, Portion>::const_iterator portion = portions->begin();
                 portion != portions->end(); ++portion) {
             PortionInfo info;
             info.filename = portion->first;
@@ -259,10 +405,10 @@ public:
                 const size_t portionSize = info.portion.size;
                 PortionInfo split;
                 split.filename = info.filename;
-                split.portion.offset = info.portion.offset + portionSize / 2;
+                info.portion.size = (portionSize / 2) + (portionSize % 2);
+                split.portion.offset = info.portion.offset + info.portion.size;
                 split.portion.size = portionSize / 2;
                 split.portion.is_first_portion = false;
-                info.portion.size = (portionSize / 2) + (portionSize % 2);
 
                 splitPortions.push_back(split);
             } else {
@@ -300,13 +446,27 @@ public:
             }
             prepareCustomizedPortions(srvInterface, planCtxt, sources, *expandedPaths, *portions);
         } else {
-            std::map<std::string, Portion> *portions =
-                planCtxt.getWriter().getPointer<std::map<std::string, Portion> >("portionMap");
+            std::multimap<std::string, Portion> *portions =
+                planCtxt.getWriter().getPointer<std::multimap<std::string, Portion> >("portionMap");
             if (portions == NULL) {
                 vt_report_error(0, "Portions map not found in context");
             }
-            prepareGeneratedPortions(srvInterface, planCtxt, sources, *portions);
+            if (isDynamic(srvInterface)) {
+                prepareQueuedRanges(srvInterface, planCtxt, sources, *portions);
+            } else {
+                prepareGeneratedPortions(srvInterface, planCtxt, sources, *portions);
+            }
+        }
+
+        for (std::map<std::string, RecordBoundaries>::iterator file = boundaries.begin();
+                file != boundaries.end(); ++file) {
+            if (!file->second.save()) {
+                // Not fatal; the cuts will just be found again next time
+                srvInterface.log("FilePortionSource: could not write record boundaries file [%s]",
+                        RecordBoundaries::sidecarPath(file->first).c_str());
+            }
         }
+        boundaries.clear();
 
         return sources;
     }
@@ -335,11 +495,9 @@ public:
                 if (fportion.size == -1) {
                     /* as described above, this means from the offset to the end */
                     fportion.size = fileSize - portion->offset;
-                    sources.push_back(vt_createFuncObject<FilePortionSource>(srvInterface.allocator,
-                                *filename, fportion));
+                    addSource(srvInterface, sources, *filename, fportion);
                 } else if (fportion.size > 0) {
-                    sources.push_back(vt_createFuncObject<FilePortionSource>(srvInterface.allocator,
-                                *filename, fportion));
+                    addSource(srvInterface, sources, *filename, fportion);
                 }
             }
         }
@@ -348,13 +506,12 @@ public:
     void prepareGeneratedPortions(ServerInterface &srvInterface,
                                   ExecutorPlanContext &planCtxt,
                                   std::vector<UDSource *> &sources,
-                                  std::map<std::string, Portion> initialPortions) {
+                                  std::multimap<std::string, Portion> initialPortions) {
         if ((ssize_t) initialPortions.size() >= planCtxt.getLoadConcurrency()) {
             /* all threads will be used, don't bother splitting into portions */
-            for (std::map<std::string, Portion>::const_iterator file = initialPortions.begin();
+            for (std::multimap<std::string, Portion>::const_iterator file = initialPortions.begin();
                     file != initialPortions.end(); ++file) {
-                sources.push_back(vt_createFuncObject<FilePortionSource>(srvInterface.allocator,
-                            file->first, file->second));
+                addSource(srvInterface, sources, file->first, file->second);
             }
             return;
         }
@@ -365,7 +522,7 @@ public:
         struct SortFilesByPortionSize sortFiles = SortFilesByPortionSize();
 
         std::vector<PortionInfo> portionHeap;
-        for (std::map<std::string, Portion>::const_iterator file = initialPortions.begin();
+        for (std::multimap<std::string, Portion>::const_iterator file = initialPortions.begin();
                 file != initialPortions.end(); ++file) {
             PortionInfo portion;
             portion.filename = file->first;
@@ -374,9 +531,7 @@ public:
         }
         std::make_heap(portionHeap.begin(), portionHeap.end(), sortFiles);
 
-        const vint localMinPortionSize =
-            srvInterface.getParamReader().containsParameter("local_min_portion_size") ?
-            srvInterface.getParamReader().getIntRef("local_min_portion_size") : 1024 * 1024;
+        const vint localMinPortionSize = getLocalMinPortionSize(srvInterface);
         while (!portionHeap.empty() && (ssize_t) portionHeap.size() < planCtxt.getLoadConcurrency()) {
             std::pop_heap(portionHeap.begin(), portionHeap.end(), sortFiles);
             PortionInfo &portion = portionHeap.back();
@@ -386,11 +541,11 @@ public:
             if ((vint) portionSize >= 2 * localMinPortionSize) {
                 PortionInfo split;
                 split.filename = portion.filename;
-                split.portion.offset = portion.portion.offset + portionSize / 2;
+                portion.portion.size = (portionSize / 2) + (portionSize % 2);
+                split.portion.offset = portion.portion.offset + portion.portion.size;
                 split.portion.size = portionSize / 2;
                 split.portion.is_first_portion = false;
 
-                portion.portion.size = (portionSize / 2) + (portionSize % 2);
                 std::push_heap(portionHeap.begin(), portionHeap.end(), sortFiles);
 
                 portionHeap.push_back(split);
@@ -403,11 +558,83 @@ public:
 
         for (std::vector<PortionInfo>::const_iterator portion = portionHeap.begin();
                 portion != portionHeap.end(); ++portion) {
-            sources.push_back(vt_createFuncObject<FilePortionSource>(srvInterface.allocator,
-                        portion->filename, portion->portion));
+            addSource(srvInterface, sources, portion->filename, portion->portion);
         }
     }
 
+    /*
+     * Put this node's share of each file in a queue, in ranges that
+     * sources take one at a time, so that a source that is slow to get
+     * through its ranges doesn't hold up the load; the others just take
+     * more of them.
+     */
+    void prepareQueuedRanges(ServerInterface &srvInterface,
+                             ExecutorPlanContext &planCtxt,
+                             std::vector<UDSource *> &sources,
+                             const std::multimap<std::string, Portion> &shares) {
+        const size_t numSources = std::max(planCtxt.getLoadConcurrency(), (ssize_t)1);
+        const vint localMinPortionSize = getLocalMinPortionSize(srvInterface);
+
+        RangeQueue *queue = new RangeQueue(numSources, (uint64_t)getRangeSize(srvInterface),
+                                           (uint64_t)localMinPortionSize);
+        queue->addRef();    // Until the sources have theirs
+        for (std::multimap<std::string, Portion>::const_iterator share = shares.begin();
+                share != shares.end(); ++share) {
+            queue->addFile(share->first, share->second.offset, share->second.offset + share->second.size,
+                           getBoundaries(srvInterface, share->first));
+        }
+        queue->plan();
+        srvInterface.log("FilePortionSource: %zu ranges queued for up to %zu sources",
+                         queue->getRangeCount(), numSources);
+
+        const char terminator = srvInterface.getParamReader().getStringRef("record_terminator").str()[0];
+        for (size_t i = 0; i < numSources && i < queue->getRangeCount(); i++) {
+            sources.push_back(vt_createFuncObject<FileRangeSource>(srvInterface.allocator, queue, terminator,
+                    FileSourceFactory::getReadMode(srvInterface),
+                    (size_t)FileSourceFactory::getBlockSize(srvInterface),
+                    (size_t)FileSourceFactory::getQueueDepth(srvInterface)));
+        }
+        RangeQueue::release(queue);
+    }
+
+    void addSource(ServerInterface &srvInterface, std::vector<UDSource *> &sources,
+                   const std::string &filename, const Portion &portion) {
+        Portion p(portion);
+        if (srvInterface.getParamReader().containsParameter("record_terminator")) {
+            /*
+             * Move both ends of the portion onto record terminators.  The
+             * portion next to it moves its end (or start) from the same
+             * offset, so they still meet; a portion with no terminator in
+             * it disappears, and the one before it takes its records.
+             */
+            RecordBoundaries &fileBoundaries = getBoundaries(srvInterface, filename);
+            const uint64_t end = p.offset + p.size;
+            const uint64_t start = p.is_first_portion ? p.offset : fileBoundaries.snap(p.offset);
+            const uint64_t snappedEnd = end >= fileBoundaries.getFileSize() ? end : fileBoundaries.snap(end);
+            if (snappedEnd <= start && !(p.is_first_portion && p.size == 0)) {
+                srvInterface.log("FilePortionSource: dropping portion [offset = %lld, size = %lld] "
+                        "of [%s], which has no record terminators", p.offset, p.size, filename.c_str());
+                return;
+            }
+            p.offset = start;
+            p.size = snappedEnd > start ? snappedEnd - start : 0;
+        }
+
+        sources.push_back(vt_createFuncObject<FilePortionSource>(srvInterface.allocator, filename, p,
+                FileSourceFactory::getReadMode(srvInterface),
+                (size_t)FileSourceFactory::getBlockSize(srvInterface),
+                (size_t)FileSourceFactory::getQueueDepth(srvInterface)));
+    }
+
+    RecordBoundaries &getBoundaries(ServerInterface &srvInterface, const std::string &filename) {
+        if (!boundaries.count(filename)) {
+            const std::string terminator =
+                srvInterface.getParamReader().getStringRef("record_terminator").str();
+            boundaries[filename].open(filename, terminator[0]);
+        }
+        return boundaries[filename];
+    }
+
     off_t getFileSize(const std::string &filename) const {
         struct stat st;
         if (stat(filename.c_str(), &st) == -1) {
@@ -422,6 +649,33 @@ public:
         parameterTypes.addVarchar(65000, "nodes");
         parameterTypes.addVarchar(65000, "offsets");
         parameterTypes.addInt("local_min_portion_size");
+        parameterTypes.addVarchar(16, "read_mode");
+        parameterTypes.addInt("block_size");
+        parameterTypes.addInt("queue_depth");
+        parameterTypes.addVarchar(1, "record_terminator");
+        parameterTypes.addBool("dynamic_portions");
+        parameterTypes.addInt("range_size");
+        parameterTypes.addBool("assign_by_size");
+        parameterTypes.addVarchar(65000, "manifest_dir");
+    }
+
+private:
+    static bool isDynamic(ServerInterface &srvInterface) {
+        ParamReader args(srvInterface.getParamReader());
+        return args.containsParameter("dynamic_portions") && args.getBoolRef("dynamic_portions");
     }
+
+    static bool isAssignedBySize(ServerInterface &srvInterface) {
+        ParamReader args(srvInterface.getParamReader());
+        return args.containsParameter("assign_by_size") && args.getBoolRef("assign_by_size");
+    }
+
+    static vint getRangeSize(ServerInterface &srvInterface) {
+        ParamReader args(srvInterface.getParamReader());
+        return args.containsParameter("range_size") ? args.getIntRef("range_size") : 8 * 1024 * 1024;
+    }
+
+    // Cut points snapped so far, by file; only used with "record_terminator"
+    std::map<std::string, RecordBoundaries> boundaries;
 };
 RegisterFactory(FilePortionSourceFactory);
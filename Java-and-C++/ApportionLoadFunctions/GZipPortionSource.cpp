@@ -0,0 +1,201 @@
+/* Copyright (c) 2005 - 2016 Hewlett Packard Enterprise Development LP  -*- C++ -*-*/
+
+#include "Vertica.h"
+#include "LoadArgParsers.h"
+#include "GZipIndex.h"
+#include "PortionPlanner.h"
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+using namespace Vertica;
+
+/**
+ * GZipPortionSource
+ *
+ * Reads a portion of a gzip file, where the portion is given in terms
+ * of the *uncompressed* data.  Decompression starts at the nearest
+ * checkpoint in the file's GZipIndex, so every portion of a large .gz
+ * file can be decompressed at once, on different threads and nodes.
+ *
+ * Like FilePortionSource, the source keeps producing data past the end
+ * of its portion, so that the parser can finish the last record.
+ *
+ * The index is loaded (or built) once per node, by the factory, and
+ * shared by all of that node's sources.
+ *
+ * (Vertica only apportions loads at the source, not through filters,
+ * so this is a source that decompresses rather than a GZip filter mode.)
+ */
+class GZipPortionSource : public UDSource {
+private:
+    std::string filename;
+    Portion portion;
+    const GZipIndex *index;
+    GZipIndexReader reader;
+
+public:
+    GZipPortionSource(const std::string &filename, Portion p, const GZipIndex *index)
+        : filename(filename), portion(p), index(index) {}
+
+    // This function is required for apportion load to get source's portion information
+    Portion getPortion() {
+        return portion;
+    }
+
+    void setup(ServerInterface &srvInterface) {
+        reader.open(filename, *index, portion.offset);
+    }
+
+    void destroy(ServerInterface &srvInterface) {
+        reader.close();
+    }
+
+    StreamState process(ServerInterface &srvInterface, DataBuffer &output) {
+        output.offset += reader.read(output.buf + output.offset, output.size - output.offset);
+        return reader.isEof() ? DONE : OUTPUT_NEEDED;
+    }
+
+    virtual std::string getUri() {
+        return filename;
+    }
+
+    virtual vint getSize() {
+        return portion.size;
+    }
+};
+
+class GZipPortionSourceFactory : public SourceFactory {
+public:
+    // Default distance between index checkpoints, in MB of uncompressed data
+    static const vint DEFAULT_INDEX_SPAN_MB = 4;
+
+    virtual void plan(ServerInterface &srvInterface,
+            NodeSpecifyingPlanContext &planCtxt) {
+
+        /* Check parameters */
+        std::vector<ArgEntry> argSpec;
+        argSpec.push_back((ArgEntry){"file", true, VerticaType(VarcharOID, -1)});
+        argSpec.push_back((ArgEntry){"nodes", false, VerticaType(VarcharOID, -1)});
+        argSpec.push_back((ArgEntry){"index_span_mb", false, VerticaType(Int8OID, -1)});
+        argSpec.push_back((ArgEntry){"local_min_portion_size", false, VerticaType(Int8OID, -1)});
+        validateArgs("GZipPortionSource", argSpec, srvInterface.getParamReader());
+
+        if (getIndexSpan(srvInterface) <= 0) {
+            vt_report_error(0, "parameter \"index_span_mb\" must be positive");
+        }
+
+        /* Pick the nodes, and give each one an id so that it knows which part of each file to read */
+        planPortionNodes(srvInterface, planCtxt);
+    }
+
+    /* how many threads do we want to use? */
+    virtual ssize_t getDesiredThreads(ServerInterface &srvInterface,
+            ExecutorPlanContext &planCtxt) {
+        // Leave out our own index files
+        const std::vector<std::string> paths = expandPortionGlob(
+                srvInterface.getParamReader().getStringRef("file").str(), GZipIndex::isSidecarPath);
+        const size_t span = getIndexSpan(srvInterface);
+
+        std::vector<GZipPortion> *portions =
+            vt_createFuncObject<std::vector<GZipPortion> >(srvInterface.allocator);
+        planCtxt.getWriter().setPointer("portions", portions);
+        std::vector<GZipIndex> *indexes =
+            vt_createFuncObject<std::vector<GZipIndex> >(srvInterface.allocator);
+        indexes->resize(paths.size());
+        planCtxt.getWriter().setPointer("indexes", indexes);
+
+        if (!planCtxt.canApportionSource()) {
+            /* no apportioning; each file is read from start to end, which needs no index */
+            for (size_t i = 0; i < paths.size(); i++) {
+                (*indexes)[i].initStartOnly();
+                GZipPortion p;
+                p.filename = paths[i];
+                p.file = i;
+                p.portion = Portion(0);
+                p.portion.size = -1;
+                p.portion.is_first_portion = true;
+                portions->push_back(p);
+            }
+            return portions->size();
+        }
+
+        const size_t nodeId = planCtxt.getWriter().getIntRef(srvInterface.getCurrentNodeName());
+        const size_t numNodes = planCtxt.getTargetNodes().size();
+        const vint localMinPortionSize = getLocalMinPortionSize(srvInterface);
+        const size_t threadsPerFile =
+            std::max((size_t)1, (size_t)planCtxt.getMaxAllowedThreads() / std::max((size_t)1, paths.size()));
+
+        for (size_t i = 0; i < paths.size(); i++) {
+            /* every node uses the same index, so all nodes agree on where the cuts are */
+            GZipIndex &index = (*indexes)[i];
+            index.loadOrBuild(srvInterface, paths[i], span);
+
+            /* split this node's share of the file at checkpoints */
+            std::vector<uint64_t> cuts;
+            for (size_t c = 0; c < index.getCheckpoints().size(); c++) {
+                cuts.push_back(index.getCheckpoints()[c].out);
+            }
+            std::vector<Portion> filePortions = planPortionsAtCuts(cuts, index.getUncompressedSize(),
+                    nodeId, numNodes, threadsPerFile, localMinPortionSize);
+            for (size_t j = 0; j < filePortions.size(); j++) {
+                GZipPortion p;
+                p.filename = paths[i];
+                p.file = i;
+                p.portion = filePortions[j];
+                portions->push_back(p);
+                srvInterface.log("GZipPortionSource: assigning portion of %s: [offset = %lld, size = %lld]",
+                        paths[i].c_str(), p.portion.offset, p.portion.size);
+            }
+        }
+
+        return std::max((size_t)1, portions->size());
+    }
+
+    virtual std::vector<UDSource*> prepareUDSourcesExecutor(ServerInterface &srvInterface,
+            ExecutorPlanContext &planCtxt) {
+        std::vector<GZipPortion> *portions =
+            planCtxt.getWriter().getPointer<std::vector<GZipPortion> >("portions");
+        const std::vector<GZipIndex> *indexes =
+            planCtxt.getWriter().getPointer<std::vector<GZipIndex> >("indexes");
+        if (portions == NULL || indexes == NULL) {
+            vt_report_error(0, "Portions not found in context");
+        }
+
+        std::vector<UDSource *> sources;
+        for (size_t i = 0; i < portions->size(); i++) {
+            sources.push_back(vt_createFuncObject<GZipPortionSource>(srvInterface.allocator,
+                        (*portions)[i].filename, (*portions)[i].portion, &(*indexes)[(*portions)[i].file]));
+        }
+        return sources;
+    }
+
+    // This function is required for apportion load to get source factory's apportionability
+    virtual bool isSourceApportionable() {
+        return true;
+    }
+
+    virtual void getParameterType(ServerInterface &srvInterface,
+                                  SizedColumnTypes &parameterTypes) {
+        parameterTypes.addVarchar(65000, "file");
+        parameterTypes.addVarchar(65000, "nodes");
+        parameterTypes.addInt("index_span_mb");
+        parameterTypes.addInt("local_min_portion_size");
+    }
+
+private:
+    struct GZipPortion {
+        std::string filename;
+        size_t file;        // Index into the "indexes" vector
+        Portion portion;
+    };
+
+    size_t getIndexSpan(ServerInterface &srvInterface) {
+        ParamReader params = srvInterface.getParamReader();
+        const vint spanMB = params.containsParameter("index_span_mb") ?
+            params.getIntRef("index_span_mb") : DEFAULT_INDEX_SPAN_MB;
+        return spanMB * 1024 * 1024;
+    }
+};
+RegisterFactory(GZipPortionSourceFactory);
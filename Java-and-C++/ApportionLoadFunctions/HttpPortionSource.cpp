@@ -0,0 +1,229 @@
+/* Copyright (c) 2005 - 2016 Hewlett Packard Enterprise Development LP  -*- C++ -*-*/
+
+#include "Vertica.h"
+#include "LoadArgParsers.h"
+#include "PortionPlanner.h"
+#include "curl_fopen.h"
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <limits>
+
+using namespace Vertica;
+
+/**
+ * HttpPortionSource
+ *
+ * Reads a portion of one object over HTTP with range requests, so that
+ * a single large URL can be loaded by many threads on many nodes at
+ * once, each with its own connection; rather than through one
+ * connection, as with the cURL source.
+ *
+ * Like FilePortionSource, the source keeps producing data past the end
+ * of its portion, so that the parser can finish the last record.  The
+ * first request asks for the portion and RANGE_OVERRUN bytes more,
+ * which covers the last record unless records are very long; if the
+ * parser wants more than that, it is fetched in requests that double in
+ * size each time.  Each of those is only made once the parser has seen
+ * everything before it, and has asked for more.
+ *
+ * An object whose server doesn't do range requests is read from start
+ * to end by one source.
+ */
+class HttpPortionSource : public UDSource {
+private:
+    /* How far past the end of its portion the first request reads */
+    static const vint RANGE_OVERRUN = 64 * 1024;
+
+    std::string url;
+    Portion portion;
+    vint total;             // Size of the object; -1 if unknown
+    URL_FILE *handle;       // The request being read; NULL between requests
+    vint pos;               // Offset in the object of the next byte
+    int requests;           // Made so far
+
+    /* The one portion of an object that isn't split */
+    bool isWhole() const {
+        return portion.offset == 0 && (total < 0 || portion.size >= total);
+    }
+
+    void open() {
+        // The portion and a little more, then more and more of what follows
+        vint end = -1;
+        if (!isWhole() && total >= 0) {
+            const vint length = (requests == 0) ?
+                portion.size + RANGE_OVERRUN : RANGE_OVERRUN << std::min(requests, 16);
+            end = std::min(pos + length, total) - 1;
+        }
+        requests++;
+        handle = url_fopen_range(url.c_str(), pos, end);
+        if (handle == NULL) {
+            vt_report_error(0, "Could not fetch bytes %lld-%lld of [%s]",
+                            (long long)pos, (long long)end, url.c_str());
+        }
+
+        // A server that ignores the range sends the whole object, which is
+        // only right for a source that is reading all of it
+        const long code = url_response_code(handle);
+        if (code != 206 && !(pos == 0 && isWhole())) {
+            url_fclose(handle);
+            handle = NULL;
+            vt_report_error(0, "Server for [%s] ignored a request for bytes %lld-%lld (status %ld)",
+                            url.c_str(), (long long)pos, (long long)end, code);
+        }
+    }
+
+public:
+    HttpPortionSource(const std::string &url, Portion p, vint total)
+        : url(url), portion(p), total(total), handle(NULL), pos(0), requests(0) {}
+
+    virtual ~HttpPortionSource() {
+        if (handle) url_fclose(handle);
+    }
+
+    // This function is required for apportion load to get source's portion information
+    Portion getPortion() {
+        return portion;
+    }
+
+    void setup(ServerInterface &srvInterface) {
+        pos = portion.offset;
+        requests = 0;
+    }
+
+    void destroy(ServerInterface &srvInterface) {
+        if (handle) url_fclose(handle);
+        handle = NULL;
+    }
+
+    StreamState process(ServerInterface &srvInterface, DataBuffer &output) {
+        while (output.offset < output.size) {
+            if (handle == NULL) {
+                if (total >= 0 && pos >= total) return DONE;
+                open();
+            }
+
+            const size_t got = url_fread(output.buf + output.offset, 1,
+                                         output.size - output.offset, handle);
+            output.offset += got;
+            pos += got;
+
+            if (url_feof(handle)) {
+                if (url_ferror(handle)) {
+                    vt_report_error(0, "Error reading [%s] at offset %lld: %s",
+                                    url.c_str(), (long long)pos, url_strerror(handle));
+                }
+                url_fclose(handle);
+                handle = NULL;
+                // An object of unknown size ends where its one request does
+                if (total < 0 || pos >= total) return DONE;
+                // Past the end of the portion, the parser may already have
+                // the last record; let it say so before asking for more
+                if (pos >= portion.offset + portion.size) return OUTPUT_NEEDED;
+            }
+        }
+        return OUTPUT_NEEDED;
+    }
+
+    virtual std::string getUri() {
+        return url;
+    }
+
+    virtual vint getSize() {
+        return portion.size;
+    }
+};
+
+class HttpPortionSourceFactory : public SourceFactory {
+public:
+    virtual void plan(ServerInterface &srvInterface,
+            NodeSpecifyingPlanContext &planCtxt) {
+
+        /* Check parameters */
+        std::vector<ArgEntry> argSpec;
+        argSpec.push_back((ArgEntry){"url", true, VerticaType(VarcharOID, -1)});
+        argSpec.push_back((ArgEntry){"nodes", false, VerticaType(VarcharOID, -1)});
+        argSpec.push_back((ArgEntry){"local_min_portion_size", false, VerticaType(Int8OID, -1)});
+        validateArgs("HttpPortionSource", argSpec, srvInterface.getParamReader());
+
+        /* Pick the nodes, and give each one an id so that it knows which part of the object to read */
+        planPortionNodes(srvInterface, planCtxt);
+    }
+
+    /* how many threads do we want to use? */
+    virtual ssize_t getDesiredThreads(ServerInterface &srvInterface,
+            ExecutorPlanContext &planCtxt) {
+        const std::string url = srvInterface.getParamReader().getStringRef("url").str();
+        const size_t nodeId = planCtxt.getWriter().getIntRef(srvInterface.getCurrentNodeName());
+        const size_t numNodes = planCtxt.getTargetNodes().size();
+
+        HttpPlan *httpPlan = vt_createFuncObject<HttpPlan>(srvInterface.allocator);
+        planCtxt.getWriter().setPointer("plan", httpPlan);
+
+        curl_off_t size;
+        const int ranges = url_range_size(url.c_str(), &size);
+        if (ranges < 0) {
+            vt_report_error(0, "Could not get the size of [%s]", url.c_str());
+        }
+        httpPlan->total = size;
+
+        if (ranges && planCtxt.canApportionSource()) {
+            const vint localMinPortionSize = getLocalMinPortionSize(srvInterface);
+            /* split this node's share of the object anywhere; the parser finds the records */
+            httpPlan->portions = planPortions(size, nodeId, numNodes,
+                    planCtxt.getMaxAllowedThreads(), localMinPortionSize);
+        } else if (nodeId == 0) {
+            /* one source on one node reads the whole object */
+            if (!ranges) {
+                srvInterface.log("HttpPortionSource: server for %s doesn't do range requests; it will not be split",
+                        url.c_str());
+            }
+            Portion whole(0);
+            whole.size = (size >= 0) ? size : std::numeric_limits<vint>::max();
+            whole.is_first_portion = true;
+            httpPlan->portions.push_back(whole);
+        }
+
+        for (size_t i = 0; i < httpPlan->portions.size(); i++) {
+            srvInterface.log("HttpPortionSource: assigning portion of %s: [offset = %lld, size = %lld]",
+                    url.c_str(), httpPlan->portions[i].offset, httpPlan->portions[i].size);
+        }
+        return std::max((size_t)1, httpPlan->portions.size());
+    }
+
+    virtual std::vector<UDSource*> prepareUDSourcesExecutor(ServerInterface &srvInterface,
+            ExecutorPlanContext &planCtxt) {
+        HttpPlan *httpPlan = planCtxt.getWriter().getPointer<HttpPlan>("plan");
+        if (httpPlan == NULL) {
+            vt_report_error(0, "Portions not found in context");
+        }
+
+        const std::string url = srvInterface.getParamReader().getStringRef("url").str();
+        std::vector<UDSource *> sources;
+        for (size_t i = 0; i < httpPlan->portions.size(); i++) {
+            sources.push_back(vt_createFuncObject<HttpPortionSource>(srvInterface.allocator,
+                        url, httpPlan->portions[i], httpPlan->total));
+        }
+        return sources;
+    }
+
+    // This function is required for apportion load to get source factory's apportionability
+    virtual bool isSourceApportionable() {
+        return true;
+    }
+
+    virtual void getParameterType(ServerInterface &srvInterface,
+                                  SizedColumnTypes &parameterTypes) {
+        parameterTypes.addVarchar(65000, "url");
+        parameterTypes.addVarchar(65000, "nodes");
+        parameterTypes.addInt("local_min_portion_size");
+    }
+
+private:
+    struct HttpPlan {
+        vint total;                     // Size of the object; -1 if unknown
+        std::vector<Portion> portions;  // This node's
+    };
+};
+RegisterFactory(HttpPortionSourceFactory);
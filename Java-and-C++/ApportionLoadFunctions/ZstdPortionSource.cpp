@@ -0,0 +1,176 @@
+/* Copyright (c) 2005 - 2016 Hewlett Packard Enterprise Development LP  -*- C++ -*-*/
+
+#include "Vertica.h"
+#include "LoadArgParsers.h"
+#include "ZstdSeekable.h"
+#include "PortionPlanner.h"
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <limits>
+
+using namespace Vertica;
+
+/**
+ * ZstdPortionSource
+ *
+ * Reads a portion of a zstd file, where the portion is given in terms
+ * of the *decompressed* data.  Files written in the seekable format
+ * (see contrib/seekable_format in the zstd sources) end with a table of
+ * their frames; decompression starts at the frame containing the
+ * portion's offset, so the frames of one file can be decompressed on
+ * different threads and nodes at once.  Files without a seek table are
+ * read from start to end by one source.
+ *
+ * Like FilePortionSource, the source keeps producing data past the end
+ * of its portion, so that the parser can finish the last record.
+ */
+class ZstdPortionSource : public UDSource {
+private:
+    std::string filename;
+    Portion portion;
+    ZstdSeekableReader reader;
+
+public:
+    ZstdPortionSource(const std::string &filename, Portion p)
+        : filename(filename), portion(p) {}
+
+    // This function is required for apportion load to get source's portion information
+    Portion getPortion() {
+        return portion;
+    }
+
+    void setup(ServerInterface &srvInterface) {
+        ZstdSeekTable table;
+        table.load(filename);
+        reader.open(filename, table, portion.offset);
+    }
+
+    void destroy(ServerInterface &srvInterface) {
+        reader.close();
+    }
+
+    StreamState process(ServerInterface &srvInterface, DataBuffer &output) {
+        output.offset += reader.read(output.buf + output.offset, output.size - output.offset);
+        return reader.isEof() ? DONE : OUTPUT_NEEDED;
+    }
+
+    virtual std::string getUri() {
+        return filename;
+    }
+
+    virtual vint getSize() {
+        return portion.size;
+    }
+};
+
+class ZstdPortionSourceFactory : public SourceFactory {
+public:
+    virtual void plan(ServerInterface &srvInterface,
+            NodeSpecifyingPlanContext &planCtxt) {
+
+        /* Check parameters */
+        std::vector<ArgEntry> argSpec;
+        argSpec.push_back((ArgEntry){"file", true, VerticaType(VarcharOID, -1)});
+        argSpec.push_back((ArgEntry){"nodes", false, VerticaType(VarcharOID, -1)});
+        argSpec.push_back((ArgEntry){"local_min_portion_size", false, VerticaType(Int8OID, -1)});
+        validateArgs("ZstdPortionSource", argSpec, srvInterface.getParamReader());
+
+        /* Pick the nodes, and give each one an id so that it knows which part of each file to read */
+        planPortionNodes(srvInterface, planCtxt);
+    }
+
+    /* how many threads do we want to use? */
+    virtual ssize_t getDesiredThreads(ServerInterface &srvInterface,
+            ExecutorPlanContext &planCtxt) {
+        const std::vector<std::string> paths =
+            expandPortionGlob(srvInterface.getParamReader().getStringRef("file").str());
+
+        std::vector<ZstdPortion> *portions =
+            vt_createFuncObject<std::vector<ZstdPortion> >(srvInterface.allocator);
+        planCtxt.getWriter().setPointer("portions", portions);
+
+        if (!planCtxt.canApportionSource()) {
+            /* no apportioning; each file is read from start to end */
+            for (size_t i = 0; i < paths.size(); i++) {
+                ZstdPortion p;
+                p.filename = paths[i];
+                p.portion = Portion(0);
+                p.portion.size = -1;
+                p.portion.is_first_portion = true;
+                portions->push_back(p);
+            }
+            return portions->size();
+        }
+
+        const size_t nodeId = planCtxt.getWriter().getIntRef(srvInterface.getCurrentNodeName());
+        const size_t numNodes = planCtxt.getTargetNodes().size();
+        const vint localMinPortionSize = getLocalMinPortionSize(srvInterface);
+        const size_t threadsPerFile =
+            std::max((size_t)1, (size_t)planCtxt.getMaxAllowedThreads() / std::max((size_t)1, paths.size()));
+
+        for (size_t i = 0; i < paths.size(); i++) {
+            ZstdSeekTable table;
+            std::vector<Portion> filePortions;
+            if (table.load(paths[i])) {
+                /* split this node's share of the file at frame boundaries */
+                filePortions = planPortionsAtCuts(table.getFrameStarts(), table.getUncompressedSize(),
+                        nodeId, numNodes, threadsPerFile, localMinPortionSize);
+            } else if (nodeId == 0) {
+                /* no seek table; one source on one node reads the whole file */
+                srvInterface.log("ZstdPortionSource: %s has no seek table; it will not be split",
+                        paths[i].c_str());
+                Portion whole(0);
+                whole.size = std::numeric_limits<vint>::max();
+                whole.is_first_portion = true;
+                filePortions.push_back(whole);
+            }
+            for (size_t j = 0; j < filePortions.size(); j++) {
+                ZstdPortion p;
+                p.filename = paths[i];
+                p.portion = filePortions[j];
+                portions->push_back(p);
+                srvInterface.log("ZstdPortionSource: assigning portion of %s: [offset = %lld, size = %lld]",
+                        paths[i].c_str(), p.portion.offset, p.portion.size);
+            }
+        }
+
+        return std::max((size_t)1, portions->size());
+    }
+
+    virtual std::vector<UDSource*> prepareUDSourcesExecutor(ServerInterface &srvInterface,
+            ExecutorPlanContext &planCtxt) {
+        std::vector<ZstdPortion> *portions =
+            planCtxt.getWriter().getPointer<std::vector<ZstdPortion> >("portions");
+        if (portions == NULL) {
+            vt_report_error(0, "Portions not found in context");
+        }
+
+        std::vector<UDSource *> sources;
+        for (size_t i = 0; i < portions->size(); i++) {
+            sources.push_back(vt_createFuncObject<ZstdPortionSource>(srvInterface.allocator,
+                        (*portions)[i].filename, (*portions)[i].portion));
+        }
+        return sources;
+    }
+
+    // This function is required for apportion load to get source factory's apportionability
+    virtual bool isSourceApportionable() {
+        return true;
+    }
+
+    virtual void getParameterType(ServerInterface &srvInterface,
+                                  SizedColumnTypes &parameterTypes) {
+        parameterTypes.addVarchar(65000, "file");
+        parameterTypes.addVarchar(65000, "nodes");
+        parameterTypes.addInt("local_min_portion_size");
+    }
+
+private:
+    struct ZstdPortion {
+        std::string filename;
+        Portion portion;
+    };
+};
+RegisterFactory(ZstdPortionSourceFactory);
@@ -11,6 +11,9 @@
 \set searchandreplace_libfile '\''`pwd`'/build/SearchAndReplaceFilter.so\'';
 CREATE LIBRARY SearchAndReplaceLib AS :searchandreplace_libfile;
 
+\set grep_libfile '\''`pwd`'/build/GrepFilter.so\'';
+CREATE LIBRARY GrepLib AS :grep_libfile;
+
 \set iconverter_libfile '\''`pwd`'/build/IconverterLib.so\'';
 CREATE LIBRARY IconverterLib AS :iconverter_libfile;
 
@@ -20,32 +23,62 @@ CREATE LIBRARY GZipLib AS :gzip_libfile;
 \set bzip_libfile '\''`pwd`'/build/BZipLib.so\'';
 CREATE LIBRARY BZipLib AS :bzip_libfile;
 
+\set zstd_libfile '\''`pwd`'/build/ZstdLib.so\'';
+CREATE LIBRARY ZstdLib AS :zstd_libfile;
+
+\set lz4_libfile '\''`pwd`'/build/LZ4Lib.so\'';
+CREATE LIBRARY LZ4Lib AS :lz4_libfile;
+
 -- Step 2: Create Functions
 CREATE FILTER SearchAndReplace AS 
 LANGUAGE 'C++' NAME 'SearchAndReplaceFilterFactory' LIBRARY SearchAndReplaceLib;
 
+CREATE FILTER MultiSearchAndReplace AS 
+LANGUAGE 'C++' NAME 'MultiSearchAndReplaceFilterFactory' LIBRARY SearchAndReplaceLib;
+
+CREATE FILTER Grep AS 
+LANGUAGE 'C++' NAME 'GrepFilterFactory' LIBRARY GrepLib;
+
 CREATE FILTER Iconverter AS 
 LANGUAGE 'C++' NAME 'IconverterFactory' LIBRARY IconverterLib;
 
+CREATE FILTER Utf8Validator AS 
+LANGUAGE 'C++' NAME 'Utf8ValidatorFactory' LIBRARY IconverterLib;
+
 CREATE FILTER GZip AS 
 LANGUAGE 'C++' NAME 'GZipUnpackerFactory' LIBRARY GZipLib;
 
 CREATE FILTER BZip AS 
 LANGUAGE 'C++' NAME 'BZipUnpackerFactory' LIBRARY BZipLib;
 
+CREATE FILTER Zstd AS 
+LANGUAGE 'C++' NAME 'ZstdUnpackerFactory' LIBRARY ZstdLib;
+
+CREATE FILTER LZ4 AS 
+LANGUAGE 'C++' NAME 'LZ4UnpackerFactory' LIBRARY LZ4Lib;
+
 -- Step 3: Use Functions
 create table t (i integer);
 
 \! mkdir -p /tmp/vertica_udsource_example/
 \! python -c 'for i in xrange(1000000): print i' > /tmp/vertica_udsource_example/data.txt
 \! iconv -f utf8 -t utf16 < /tmp/vertica_udsource_example/data.txt > /tmp/vertica_udsource_example/data_utf16.txt
+\! iconv -f utf8 -t latin1 < /tmp/vertica_udsource_example/data.txt > /tmp/vertica_udsource_example/data_latin1.txt
+\! cp /tmp/vertica_udsource_example/data.txt /tmp/vertica_udsource_example/data_bad_utf8.txt
+\! printf '12\xe93\n' >> /tmp/vertica_udsource_example/data_bad_utf8.txt
 \! gzip < /tmp/vertica_udsource_example/data.txt > /tmp/vertica_udsource_example/data.txt.gz
 \! bzip2 < /tmp/vertica_udsource_example/data.txt > /tmp/vertica_udsource_example/data.txt.bz2
 
 \! cp /tmp/vertica_udsource_example/data.txt.gz /tmp/vertica_udsource_example/data.txt.concat.gz
 \! echo "-1" | gzip >> /tmp/vertica_udsource_example/data.txt.concat.gz
+\! split -l 10000 --filter='gzip' /tmp/vertica_udsource_example/data.txt > /tmp/vertica_udsource_example/data.txt.multi.gz
+\! split -l 10 --filter='gzip' /tmp/vertica_udsource_example/data.txt > /tmp/vertica_udsource_example/data.txt.tiny.gz
 \! cp /tmp/vertica_udsource_example/data.txt.bz2 /tmp/vertica_udsource_example/data.txt.concat.bz2
 \! echo "-1" | bzip2 >> /tmp/vertica_udsource_example/data.txt.concat.bz2
+\! zstd -q < /tmp/vertica_udsource_example/data.txt > /tmp/vertica_udsource_example/data.txt.zst
+\! echo "-1" | zstd -q >> /tmp/vertica_udsource_example/data.txt.zst
+\! lz4 -q < /tmp/vertica_udsource_example/data.txt > /tmp/vertica_udsource_example/data.txt.lz4
+\! echo "-1" | lz4 -q >> /tmp/vertica_udsource_example/data.txt.lz4
 
 
 copy t from '/tmp/vertica_udsource_example/data.txt' with filter SearchAndReplace(pattern='0', replace_with='10');
@@ -53,11 +86,45 @@ select * from t order by i limit 10;
 select count(*) from t;
 truncate table t;
 
+-- Several patterns at once, in a single pass; each pattern is replaced
+-- by the replacement at the same position in the list
+copy t from '/tmp/vertica_udsource_example/data.txt' with filter MultiSearchAndReplace(patterns='0,1,99', replacements='10,2,7');
+select * from t order by i limit 10;
+select count(*) from t;
+truncate table t;
+
+-- Only load the records that match, without parsing the others
+create table orders (id integer, tenant varchar(20), amount integer);
+\! python -c 'for i in xrange(1000000): print "%d|tenant%03d|%d" % (i, i % 1000, i * 7)' > /tmp/vertica_udsource_example/orders.txt
+copy orders from '/tmp/vertica_udsource_example/orders.txt' with filter Grep(patterns='tenant042', column=2, exact=true);
+select count(*) from orders;
+truncate table orders;
+
+-- Several values at once; or with invert=true, everything but them
+copy orders from '/tmp/vertica_udsource_example/orders.txt' with filter Grep(patterns='tenant042,tenant077', column=2, exact=true, invert=true);
+select count(*) from orders;
+drop table orders;
+
 copy t from '/tmp/vertica_udsource_example/data_utf16.txt' with filter Iconverter(from_encoding='UTF-16');
 select * from t order by i limit 10;
 select count(*) from t;
 truncate table t;
 
+-- Invalid UTF-8 can fail the load (mode='fail', the default), be
+-- replaced with U+FFFD (mode='replace'), or be dropped (mode='drop')
+copy t from '/tmp/vertica_udsource_example/data_bad_utf8.txt' with filter Utf8Validator();
+copy t from '/tmp/vertica_udsource_example/data_bad_utf8.txt' with filter Utf8Validator(mode='drop');
+select * from t where i > 999999;
+select count(*) from t;
+truncate table t;
+
+-- UTF-16 and ISO-8859-1 to UTF-8 use a built-in converter; other
+-- encodings go through iconv
+copy t from '/tmp/vertica_udsource_example/data_latin1.txt' with filter Iconverter(from_encoding='ISO-8859-1');
+select * from t order by i limit 10;
+select count(*) from t;
+truncate table t;
+
 copy t from '/tmp/vertica_udsource_example/data.txt.gz' with filter GZip();
 select * from t order by i limit 10;
 select count(*) from t;
@@ -73,18 +140,55 @@ select * from t order by i limit 10;
 select count(*) from t;
 truncate table t;
 
+-- Files made of many tiny members (100000 members of 10 rows here), as
+-- produced by some log shippers; compare the timing with data.txt.gz
+\timing
+copy t from '/tmp/vertica_udsource_example/data.txt.gz' with filter GZip();
+truncate table t;
+copy t from '/tmp/vertica_udsource_example/data.txt.tiny.gz' with filter GZip();
+\timing
+select count(*) from t;
+truncate table t;
+
+-- Multi-member files (many gzip files concatenated, or BGZF) can be
+-- decompressed on several threads
+copy t from '/tmp/vertica_udsource_example/data.txt.multi.gz' with filter GZip(threads=4);
+select * from t order by i limit 10;
+select count(*) from t;
+truncate table t;
+
 copy t from '/tmp/vertica_udsource_example/data.txt.concat.bz2' with filter BZip();
 select * from t order by i limit 10;
 select count(*) from t;
 truncate table t;
 
+-- bzip2 blocks can be decompressed on several threads
+copy t from '/tmp/vertica_udsource_example/data.txt.concat.bz2' with filter BZip(threads=4);
+select * from t order by i limit 10;
+select count(*) from t;
+truncate table t;
+
+-- Multi-frame zstd and lz4 files (two concatenated files here)
+copy t from '/tmp/vertica_udsource_example/data.txt.zst' with filter Zstd();
+select * from t order by i limit 10;
+select count(*) from t;
+truncate table t;
+
+copy t from '/tmp/vertica_udsource_example/data.txt.lz4' with filter LZ4();
+select * from t order by i limit 10;
+select count(*) from t;
+truncate table t;
+
 -- Step 4: Cleanup
 DROP TABLE t;
 
 DROP LIBRARY SearchAndReplaceLib CASCADE;
+DROP LIBRARY GrepLib CASCADE;
 DROP LIBRARY IconverterLib CASCADE;
 DROP LIBRARY GZipLib CASCADE;
 DROP LIBRARY BZipLib CASCADE;
+DROP LIBRARY ZstdLib CASCADE;
+DROP LIBRARY LZ4Lib CASCADE;
 
 \! rm -r /tmp/vertica_udsource_example/
 
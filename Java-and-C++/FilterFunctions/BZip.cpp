@@ -1,8 +1,14 @@
 /* Copyright (c) 2005 - 2016 Hewlett Packard Enterprise Development LP  -*- C++ -*-*/
 
 #include <bzlib.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
 
 #include "Vertica.h"
+#include "WorkerPool.h"
 using namespace Vertica;
 
 
@@ -93,17 +99,370 @@ public:
 };
 
 
+/**
+ * Decodes one bzip2 block, on a WorkerPool thread.
+ *
+ * bzip2 blocks are not byte-aligned, so the block's bits [startBit,
+ * endBit) of the compressed buffer are copied into a stand-alone,
+ * single-block bzip2 stream: a stream header, the block, and an
+ * end-of-stream marker whose combined CRC (for a single block) is the
+ * block's own CRC.  libbz2 then decodes that stream as usual, checking
+ * the block CRC.
+ *
+ * The block boundaries are only candidates (see BZipParallelUnpacker),
+ * so decoding may fail; that is not an error by itself.
+ */
+class BZipBlockJob : public PoolJob {
+public:
+    BZipBlockJob(const unsigned char *buf, uint64_t startBit, uint64_t endBit)
+        : buf(buf), startBit(startBit), endBit(endBit), ok(false),
+          out(NULL), outSize(0), outCapacity(0) {}
+
+    ~BZipBlockJob() { free(out); }
+
+    void run() {
+        std::vector<char> stream;
+        buildStream(stream);
+
+        bz_stream bs;
+        bs.bzalloc = NULL;
+        bs.bzfree = NULL;
+        bs.opaque = NULL;
+        if (BZ2_bzDecompressInit(&bs, 0, 0) != BZ_OK) return;
+        bs.next_in = &stream[0];
+        bs.avail_in = stream.size();
+
+        // Blocks hold up to 900KB before the initial run-length encoding
+        outCapacity = 1024 * 1024;
+        int bReturn = BZ_OK;
+        do {
+            if (out == NULL || outSize == outCapacity) {
+                if (out != NULL) outCapacity *= 2;
+                char *grown = (char *)realloc(out, outCapacity);
+                if (grown == NULL) {
+                    bReturn = BZ_MEM_ERROR;
+                    break;
+                }
+                out = grown;
+            }
+            bs.next_out = out + outSize;
+            bs.avail_out = outCapacity - outSize;
+            bReturn = BZ2_bzDecompress(&bs);
+            outSize = outCapacity - bs.avail_out;
+        } while (bReturn == BZ_OK && (bs.avail_in > 0 || bs.avail_out == 0));
+
+        ok = (bReturn == BZ_STREAM_END);
+        BZ2_bzDecompressEnd(&bs);
+    }
+
+    const unsigned char *buf;
+    uint64_t startBit;
+    uint64_t endBit;
+    bool ok;
+
+    // Decompressed data
+    char *out;
+    size_t outSize;
+    size_t outCapacity;
+
+private:
+    void buildStream(std::vector<char> &stream) {
+        const uint64_t nbits = endBit - startBit;
+        // Header, block, end-of-stream magic and CRC, padding
+        stream.assign(4 + (nbits + 48 + 32 + 7) / 8 + 1, 0);
+        memcpy(&stream[0], "BZh9", 4);
+
+        // Copy the block bits, shifting them into byte alignment
+        unsigned char *dst = (unsigned char *)&stream[4];
+        const unsigned char *src = buf + startBit / 8;
+        const unsigned shift = startBit % 8;
+        const size_t nbytes = (nbits + 7) / 8;
+        for (size_t i = 0; i < nbytes; i++) {
+            dst[i] = (src[i] << shift) | (shift ? src[i + 1] >> (8 - shift) : 0);
+        }
+        if (nbits % 8) dst[nbits / 8] &= 0xff << (8 - nbits % 8);
+
+        // The block CRC is the 32 bits following the block magic
+        uint32_t crc = 0;
+        for (unsigned i = 0; i < 32; i++) {
+            crc = (crc << 1) | getBit(buf, startBit + 48 + i);
+        }
+        uint64_t pos = 32 + nbits;
+        putBits((unsigned char *)&stream[0], pos, BZIP_EOS_MAGIC, 48);
+        putBits((unsigned char *)&stream[0], pos, crc, 32);
+        stream.resize((pos + 7) / 8);
+    }
+
+    static unsigned getBit(const unsigned char *p, uint64_t bit) {
+        return (p[bit / 8] >> (7 - bit % 8)) & 1;
+    }
+
+    static void putBits(unsigned char *p, uint64_t &pos, uint64_t value, unsigned n) {
+        for (unsigned i = 0; i < n; i++, pos++) {
+            if ((value >> (n - 1 - i)) & 1) p[pos / 8] |= 0x80 >> (pos % 8);
+        }
+    }
+
+public:
+    static const uint64_t BZIP_BLOCK_MAGIC = 0x314159265359ULL;  // BCD pi
+    static const uint64_t BZIP_EOS_MAGIC = 0x177245385090ULL;    // BCD sqrt(pi)
+};
+
+/**
+ * BZipParallelUnpacker.  Decodes .bz2 files on several threads.
+ *
+ * bzip2 compresses each block (of up to 900KB) independently, and
+ * starts each with a 48-bit magic number, at any bit offset.  Compressed
+ * input is collected into batches, which are scanned for block and
+ * end-of-stream magic numbers; the blocks between them are decoded in
+ * parallel, then emitted in file order.  Concatenated .bz2 files are
+ * handled too, since their end-of-stream markers end blocks as well.
+ *
+ * A magic number can also turn up by chance inside compressed data.
+ * Decoding of the (cut-short) block containing it then fails, and it is
+ * retried merged with the following piece; output only ever follows the
+ * chain of blocks actually decoded from the start of the batch.
+ */
+class BZipParallelUnpacker : public UDFilter {
+public:
+    BZipParallelUnpacker(size_t numThreads) : numThreads(numThreads) {}
+
+    // Amount of compressed data per thread to collect before decoding a batch
+    static const size_t BATCH_BYTES_PER_THREAD = 1024 * 1024;
+
+    // Most threads the "threads" parameter may ask for
+    static const size_t MAX_THREADS = 64;
+
+    // Enough for two whole blocks, so every full batch has one to decode
+    static const size_t MIN_BATCH_BYTES = 4 * 1024 * 1024;
+
+    // Give up on data whose blocks won't decode even when merged this far
+    static const size_t MAX_MERGED_PIECES = 8;
+
+private:
+    struct Marker {
+        uint64_t bit;   // Position, in bits from the start of the batch
+        bool isBlock;   // Block start, or end of stream
+    };
+
+    size_t numThreads;
+    WorkerPool pool;
+
+    // Compressed input collected so far; batch[0, batchEnd) is in use,
+    // and decoding resumes at bit startBit
+    std::vector<unsigned char> batch;
+    size_t batchEnd;
+    uint64_t startBit;
+    bool checkedHeader;
+
+    // Decoded blocks from the last batch, in order, waiting to be emitted
+    std::vector<BZipBlockJob*> ready;
+    size_t readyIndex;     // Block currently being emitted
+    size_t readyOffset;    // Position within its output
+
+    virtual void setup(ServerInterface &srvInterface) {
+        batch.resize(std::max(numThreads * BATCH_BYTES_PER_THREAD, (size_t)MIN_BATCH_BYTES));
+        batchEnd = 0;
+        startBit = 0;
+        checkedHeader = false;
+        readyIndex = readyOffset = 0;
+
+        // The calling thread works on each batch too
+        if (!pool.start(numThreads - 1)) {
+            srvInterface.log("BZip: only started %zu of %zu decompression threads",
+                             pool.numThreads() + 1, numThreads);
+        }
+    }
+
+    virtual void destroy(ServerInterface &srvInterface) {
+        pool.stop();
+        clearReady();
+    }
+
+    void clearReady() {
+        for (size_t i = 0; i < ready.size(); i++) delete ready[i];
+        ready.clear();
+        readyIndex = readyOffset = 0;
+    }
+
+    /** Find every block and end-of-stream magic number in bits [from, to) of the batch */
+    void findMarkers(uint64_t from, uint64_t to, std::vector<Marker> &markers) {
+        const unsigned char *buf = &batch[0];
+        uint64_t window = 0;  // The last 64 bits read
+        for (size_t i = from / 8; i < (to + 7) / 8; i++) {
+            window = (window << 8) | buf[i];
+            for (unsigned b = 0; b < 8; b++) {
+                // The 48 bits ending at bit (i * 8 + b) of the batch
+                const uint64_t end = (uint64_t)i * 8 + b + 1;
+                if (end < 48 || end > to || end - 48 < from) continue;
+                const uint64_t bits = (window >> (7 - b)) & 0xffffffffffffULL;
+                if (bits == BZipBlockJob::BZIP_BLOCK_MAGIC || bits == BZipBlockJob::BZIP_EOS_MAGIC) {
+                    Marker m;
+                    m.bit = end - 48;
+                    m.isBlock = (bits == BZipBlockJob::BZIP_BLOCK_MAGIC);
+                    markers.push_back(m);
+                }
+            }
+        }
+    }
+
+    /**
+     * Decode every complete block in the batch, in parallel.
+     * Fills `ready` with the blocks decoded, in order, and moves
+     * startBit past them.
+     */
+    void decodeBatch(bool isEof) {
+        std::vector<Marker> markers;
+        findMarkers(startBit, (uint64_t)batchEnd * 8, markers);
+
+        // Skip end-of-stream markers (and stream trailers and headers) up
+        // to the first block
+        size_t first = 0;
+        while (first < markers.size() && !markers[first].isBlock) first++;
+
+        // One job per candidate block: from a block magic to the next marker
+        std::vector<BZipBlockJob*> jobs(markers.size(), (BZipBlockJob*)NULL);
+        std::vector<PoolJob*> poolJobs;
+        for (size_t i = first; i + 1 < markers.size(); i++) {
+            if (!markers[i].isBlock) continue;
+            jobs[i] = new BZipBlockJob(&batch[0], markers[i].bit, markers[i + 1].bit);
+            poolJobs.push_back(jobs[i]);
+        }
+        pool.runAll(poolJobs);
+
+        // Follow the chain of blocks from the first one
+        clearReady();
+        size_t i = first;
+        while (i + 1 < markers.size()) {
+            if (!markers[i].isBlock) {
+                i++;
+                continue;
+            }
+            // Normally the block ends at the next marker; if it doesn't
+            // decode, one of the markers in it was a false match
+            size_t end = i + 1;
+            BZipBlockJob *job = jobs[i];
+            jobs[i] = NULL;
+            while (!job->ok && end + 1 < markers.size() && end - i < MAX_MERGED_PIECES) {
+                delete job;
+                end++;
+                job = new BZipBlockJob(&batch[0], markers[i].bit, markers[end].bit);
+                job->run();
+            }
+            if (!job->ok) {
+                delete job;
+                if (end - i >= MAX_MERGED_PIECES || isEof) {
+                    vt_report_error(0, "Error occurred during BZIP decompression: invalid block at bit offset %llu of the input batch",
+                                    (unsigned long long)markers[i].bit);
+                }
+                break;  // Wait for more input
+            }
+            ready.push_back(job);
+            startBit = markers[end].bit;
+            i = end;
+        }
+        for (size_t j = 0; j < jobs.size(); j++) delete jobs[j];
+
+        if (isEof) {
+            // Only the last stream's trailer may be left over
+            for (size_t j = i; j < markers.size(); j++) {
+                if (markers[j].bit >= startBit && markers[j].isBlock) {
+                    vt_report_error(0, "Error occurred during BZIP decompression: unexpected end of input");
+                }
+            }
+        } else if (ready.empty() && batchEnd == batch.size()) {
+            // No whole block fits in the batch; make room for more
+            if (batch.size() >= MAX_MERGED_PIECES * MIN_BATCH_BYTES) {
+                vt_report_error(0, "Error occurred during BZIP decompression: no valid block found in %zu bytes", batch.size());
+            }
+            batch.resize(batch.size() * 2);
+        }
+    }
+
+    virtual StreamState process(ServerInterface &srvInterface,
+                                  DataBuffer      &input,
+                                  InputState       input_state,
+                                  DataBuffer      &output)
+    {
+        while (true) {
+            // Emit decoded blocks that are ready
+            if (readyIndex < ready.size()) {
+                const BZipBlockJob *block = ready[readyIndex];
+                const size_t len = std::min(block->outSize - readyOffset, output.size - output.offset);
+                memcpy(output.buf + output.offset, block->out + readyOffset, len);
+                output.offset += len;
+                readyOffset += len;
+                if (readyOffset == block->outSize) {
+                    readyIndex++;
+                    readyOffset = 0;
+                }
+                if (output.offset == output.size) return OUTPUT_NEEDED;
+                continue;
+            }
+
+            // Collect input for the next batch, after whatever was left
+            // over from the last one (keeping the byte that startBit is in)
+            const size_t keepFrom = startBit / 8;
+            if (keepFrom > 0) {
+                memmove(&batch[0], &batch[keepFrom], batchEnd - keepFrom);
+                batchEnd -= keepFrom;
+                startBit -= (uint64_t)keepFrom * 8;
+            }
+            const size_t len = std::min(input.size - input.offset, batch.size() - batchEnd);
+            memcpy(&batch[batchEnd], input.buf + input.offset, len);
+            batchEnd += len;
+            input.offset += len;
+
+            if (!checkedHeader && batchEnd >= 4) {
+                if (memcmp(&batch[0], "BZh", 3) != 0 || batch[3] < '1' || batch[3] > '9') {
+                    vt_report_error(0, "Error occurred during BZIP decompression.  BZIP error code: %d", BZ_DATA_ERROR_MAGIC);
+                }
+                checkedHeader = true;
+            }
+
+            const bool isEof = (input_state == END_OF_FILE && input.offset == input.size);
+            const bool batchFull = (batchEnd == batch.size());
+            if (!batchFull && !isEof) return INPUT_NEEDED;
+
+            const uint64_t before = startBit;
+            decodeBatch(isEof);
+            if (isEof && ready.empty() && startBit == before) return DONE;
+        }
+    }
+};
+
+
 class BZipUnpackerFactory : public FilterFactory {
 public:
     virtual void plan(ServerInterface &srvInterface,
             PlanContext &planCtxt)
-    { /* No plan-time setup work to do */ }
+    {
+        // Each thread gets its own share of a batch held in memory, so
+        // don't let a typo ask for thousands of them
+        ParamReader params = srvInterface.getParamReader();
+        if (params.containsParameter("threads")
+                && (params.getIntRef("threads") < 1 || params.getIntRef("threads") > (vint)BZipParallelUnpacker::MAX_THREADS)) {
+            vt_report_error(0, "parameter \"threads\" must be between 1 and %d", (int)BZipParallelUnpacker::MAX_THREADS);
+        }
+    }
 
     virtual UDFilter* prepare(ServerInterface &srvInterface,
             PlanContext &planCtxt)
     {
+        ParamReader params = srvInterface.getParamReader();
+        if (params.containsParameter("threads") && params.getIntRef("threads") > 1) {
+            return vt_createFuncObject<BZipParallelUnpacker>(srvInterface.allocator,
+                                                             (size_t)params.getIntRef("threads"));
+        }
         return vt_createFuncObject<BZipUnpacker>(srvInterface.allocator);
     }
+
+    virtual void getParameterType(ServerInterface &srvInterface,
+                                  SizedColumnTypes &parameterTypes)
+    {
+        // Decompress blocks on this many threads
+        parameterTypes.addInt("threads");
+    }
 };
 RegisterFactory(BZipUnpackerFactory);
 
@@ -1,8 +1,13 @@
 /* Copyright (c) 2005 - 2016 Hewlett Packard Enterprise Development LP  -*- C++ -*-*/
 
 #include <zlib.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
 
 #include "Vertica.h"
+#include "WorkerPool.h"
 using namespace Vertica;
 
 
@@ -35,9 +40,10 @@ protected:
                                   InputState       input_state,
                                   DataBuffer      &output)
     {
-        int zReturn;
-
-        do {
+        // Keep inflating, across gzip member boundaries, until we run out
+        // of input or of room for output.  Files made of many small members
+        // would otherwise cost a round trip to the server per member.
+        while (true) {
             zStream.next_in = (Bytef*)(input.buf + input.offset);
             zStream.avail_in = input.size - input.offset;
 
@@ -47,17 +53,18 @@ protected:
             // Maybe done or maybe output was needed too?
             if (zStream.avail_in==0 && input_state==END_OF_FILE) return DONE;
             if (zStream.avail_out==0) return OUTPUT_NEEDED;
+            if (zStream.avail_in==0) return INPUT_NEEDED;
 
-            zReturn = inflate(&zStream, Z_NO_FLUSH);
+            int zReturn = inflate(&zStream, Z_NO_FLUSH);
+
+            input.offset += (input.size - input.offset) - zStream.avail_in;
+            output.offset += (output.size - output.offset) - zStream.avail_out;
 
             // According to zlib manual, inflate() returns Z_BUF_ERROR if no progress is 
             // possible or if there was not enough room in the output buffer when Z_FINISH 
             // is used. Note that Z_BUF_ERROR is not fatal, and inflate() can be called 
             // again with more input and more output space to continue decompressing.
             if (zReturn == Z_BUF_ERROR) {
-                input.offset += (input.size - input.offset) - zStream.avail_in;
-                output.offset += (output.size - output.offset) - zStream.avail_out;
-
                 if (input_state == END_OF_FILE && zStream.avail_in == 0) {
                     return DONE;
                 } else if (zStream.avail_out == 0) {
@@ -66,51 +73,385 @@ protected:
                     return INPUT_NEEDED;
                 }
             }
-            else if (zReturn == Z_OK || zReturn == Z_STREAM_END)
+            else if (zReturn == Z_STREAM_END)
             {
-                input.offset += (input.size - input.offset) - zStream.avail_in;
-                output.offset += (output.size - output.offset) - zStream.avail_out;
+                if (input_state == END_OF_FILE && input.offset == input.size) {
+                    return DONE;
+                }
+
+                // Support concatenated gzip files
+                // If two or more gzip files are concatenated together, the
+                // gzip library will realize that it's at the end of the first
+                // file; we have to reset it to start with the second file.
+                // Resetting keeps the already-allocated inflate state and window.
+                zReturn = inflateReset2(&zStream, 32 + MAX_WBITS);
+                if (zReturn != Z_OK) {
+                    vt_report_error(0, "Error occurred during ZLIB initialization.  ZLIB error code: %d, Message: %s", zReturn, zStream.msg);
+                }
             }
-            else
+            else if (zReturn != Z_OK)
             {
                 vt_report_error(0, "Error occurred during ZLIB decompression.  ZLIB error code: %d, Message: %s", zReturn, zStream.msg);
             }
-
             // In case of corrupt data, end early
-            if (zReturn == Z_OK && zStream.avail_in == 0 && input_state == END_OF_FILE) {
+            else if (zStream.avail_in == 0 && input_state == END_OF_FILE) {
                 return DONE;
             }
+        }
+    }
 
-            if (zReturn == Z_STREAM_END) {
-                if (!(input_state == END_OF_FILE && input.offset == input.size)) {
-                    // Support concatenated gzip files
-                    // If two or more gzip files are concatenated together, the
-                    // gzip library will realize that it's at the end of the first
-                    // file; we have to reset it to start with the second file.
-                    destroy(srvInterface);
-                    setup(srvInterface);
-                }
-                else {
-                    return DONE;
+    virtual void destroy(ServerInterface &srvInterface) {
+        inflateEnd(&zStream);
+    }
+
+public:
+        GZipUnpacker() {}
+};
+
+
+
+/**
+ * Inflates one gzip member, starting at a given offset of a buffer,
+ * on a WorkerPool thread.
+ *
+ * The offset is only a candidate member start; it may turn out to be
+ * a false match, in which case inflating simply fails (or is ignored,
+ * if it never lines up with the end of the previous member).
+ */
+class GZipMemberJob : public PoolJob {
+public:
+    GZipMemberJob(const char *buf, size_t size, size_t start, size_t sizeHint)
+        : buf(buf), size(size), start(start), end(0), result(INCOMPLETE),
+          out(NULL), outSize(0), outCapacity(sizeHint) {}
+
+    ~GZipMemberJob() { free(out); }
+
+    enum Result {
+        COMPLETE,    // Inflated a whole member, ending at `end`
+        INCOMPLETE,  // Ran out of input before the member ended
+        FAILED,      // Not a valid gzip member
+    };
+
+    void run() {
+        z_stream_s zs;
+        zs.zalloc = Z_NULL;
+        zs.zfree = Z_NULL;
+        zs.opaque = Z_NULL;
+        zs.next_in = (Bytef*)(buf + start);
+        zs.avail_in = size - start;
+
+        // gzip only (no zlib auto-detection); checks the CRC and length
+        if (inflateInit2(&zs, 16 + MAX_WBITS) != Z_OK) {
+            result = FAILED;
+            return;
+        }
+
+        int zReturn;
+        do {
+            if (outSize == outCapacity || out == NULL) {
+                outCapacity = (out == NULL) ? std::max(outCapacity, (size_t)4096) : outCapacity * 2;
+                char *grown = (char *)realloc(out, outCapacity);
+                if (grown == NULL) {
+                    result = FAILED;
+                    inflateEnd(&zs);
+                    return;
                 }
+                out = grown;
             }
-        } while (zReturn == Z_OK && output.offset != output.size && input.offset != input.size); 
+            zs.next_out = (Bytef*)(out + outSize);
+            zs.avail_out = outCapacity - outSize;
 
-        if (output.offset == output.size) {
-            return OUTPUT_NEEDED;
-        } else if (input.offset == input.size) {
-            return INPUT_NEEDED;
+            zReturn = inflate(&zs, Z_NO_FLUSH);
+            outSize = outCapacity - zs.avail_out;
+        } while (zReturn == Z_OK || (zReturn == Z_BUF_ERROR && zs.avail_in > 0));
+
+        if (zReturn == Z_STREAM_END) {
+            result = COMPLETE;
+            end = size - zs.avail_in;
+        } else if (zReturn == Z_BUF_ERROR) {
+            result = INCOMPLETE;
         } else {
-            return KEEP_GOING;
+            result = FAILED;
+        }
+        inflateEnd(&zs);
+    }
+
+    const char *buf;
+    size_t size;
+    size_t start;
+    size_t end;
+    Result result;
+
+    // Decompressed data
+    char *out;
+    size_t outSize;
+    size_t outCapacity;
+};
+
+/**
+ * GZipParallelUnpacker.  Decodes multi-member .gz files (as written by
+ * bgzip, or by concatenating gzip files) on several threads.
+ *
+ * Compressed input is collected into batches.  Each batch is split at
+ * gzip member boundaries: BGZF blocks record their own size in a header
+ * field, so their boundaries are known exactly; other members are found
+ * by scanning for gzip headers.  The members are inflated in parallel,
+ * then emitted in file order, starting from the front of the batch and
+ * only ever following the end of the last member actually decoded, so
+ * spurious header matches can't produce output.
+ *
+ * A member that doesn't fit in a batch (or anything that isn't a
+ * multi-member gzip file, such as a zlib stream) is decoded serially,
+ * the same way GZipUnpacker does, and batching resumes after it.
+ */
+class GZipParallelUnpacker : public UDFilter {
+public:
+    GZipParallelUnpacker(size_t numThreads) : numThreads(numThreads), serialMode(false) {}
+
+    // Amount of compressed data per thread to collect before inflating a batch
+    static const size_t BATCH_BYTES_PER_THREAD = 1024 * 1024;
+
+    // Most threads the "threads" parameter may ask for
+    static const size_t MAX_THREADS = 64;
+
+    // Upper bound on the number of candidate members inflated per batch
+    static const size_t MAX_JOBS_PER_BATCH = 1024;
+
+private:
+    size_t numThreads;
+    WorkerPool pool;
+
+    // Compressed input collected so far; bytes [batchStart, batchEnd) are in use
+    std::vector<char> batch;
+    size_t batchStart;
+    size_t batchEnd;
+    size_t batchCapacity;
+
+    // Decompressed members from the last batch, in order, waiting to be emitted
+    std::vector<GZipMemberJob*> ready;
+    size_t readyIndex;     // Member currently being emitted
+    size_t readyOffset;    // Position within its output
+
+    // Serial fallback
+    bool serialMode;
+    z_stream_s zStream;
+
+    virtual void setup(ServerInterface &srvInterface) {
+        batchCapacity = numThreads * BATCH_BYTES_PER_THREAD;
+        batch.resize(batchCapacity);
+        batchStart = batchEnd = 0;
+        readyIndex = readyOffset = 0;
+        serialMode = false;
+
+        // The calling thread works on each batch too
+        if (!pool.start(numThreads - 1)) {
+            srvInterface.log("GZip: only started %zu of %zu decompression threads",
+                             pool.numThreads() + 1, numThreads);
         }
     }
 
     virtual void destroy(ServerInterface &srvInterface) {
-        inflateEnd(&zStream);
+        pool.stop();
+        clearReady();
+        if (serialMode) {
+            inflateEnd(&zStream);
+            serialMode = false;
+        }
     }
 
-public:
-        GZipUnpacker() {}
+    void clearReady() {
+        for (size_t i = 0; i < ready.size(); i++) delete ready[i];
+        ready.clear();
+        readyIndex = readyOffset = 0;
+    }
+
+    /** Returns the size of the BGZF block starting at `p`, or 0 if it isn't one */
+    static size_t bgzfBlockSize(const unsigned char *p, size_t len) {
+        // Fixed header (10 bytes), FEXTRA flag set, then XLEN
+        if (len < 12 || p[0] != 0x1f || p[1] != 0x8b || p[2] != 8 || !(p[3] & 4)) return 0;
+        const size_t xlen = p[10] | (p[11] << 8);
+        if (len < 12 + xlen) return 0;
+
+        // Look for the 'BC' subfield, which holds the block size minus 1
+        size_t pos = 12;
+        while (pos + 4 <= 12 + xlen) {
+            const size_t slen = p[pos + 2] | (p[pos + 3] << 8);
+            if (p[pos] == 'B' && p[pos + 1] == 'C' && slen == 2 && pos + 6 <= 12 + xlen) {
+                return (p[pos + 4] | (p[pos + 5] << 8)) + 1;
+            }
+            pos += 4 + slen;
+        }
+        return 0;
+    }
+
+    /** Could a gzip member start at `p`?  Checks the magic number, method and flags */
+    static bool isMemberHeader(const unsigned char *p, size_t len) {
+        return len >= 10 && p[0] == 0x1f && p[1] == 0x8b && p[2] == 8 && (p[3] & 0xe0) == 0;
+    }
+
+    /**
+     * Inflate everything in the batch that can be, in parallel.
+     * Fills `ready` with the members found, in order; leaves whatever
+     * follows the last of them in the batch.
+     * Switches to serial mode if no member could be decoded from the
+     * start of the batch, and isEof or the batch is full.
+     */
+    void inflateBatch(bool isEof) {
+        const char *data = &batch[batchStart];
+        const size_t batchSize = batchEnd - batchStart;
+        const unsigned char *buf = (const unsigned char *)data;
+
+        // Candidate member starts
+        std::vector<GZipMemberJob*> jobs;
+        size_t pos = 0;
+        while (pos < batchSize && jobs.size() < MAX_JOBS_PER_BATCH) {
+            if (!isMemberHeader(buf + pos, batchSize - pos)) {
+                const void *next = memchr(buf + pos + 1, 0x1f, batchSize - pos - 1);
+                if (next == NULL) break;
+                pos = (const unsigned char *)next - buf;
+                continue;
+            }
+            // BGZF blocks tell us where they end, and so (from the
+            // trailer) how large they are uncompressed.  Otherwise,
+            // guess a typical compression ratio.
+            const size_t bsize = bgzfBlockSize(buf + pos, batchSize - pos);
+            size_t sizeHint = 4 * std::min(batchSize - pos, (size_t)(256 * 1024));
+            if (bsize >= 18 && pos + bsize <= batchSize) {
+                const unsigned char *isize = buf + pos + bsize - 4;
+                sizeHint = (isize[0] | (isize[1] << 8) | (isize[2] << 16) | ((size_t)isize[3] << 24)) + 1;
+            }
+            jobs.push_back(new GZipMemberJob(data, batchSize, pos, sizeHint));
+            pos += bsize ? bsize : 1;
+        }
+
+        std::vector<PoolJob*> poolJobs(jobs.begin(), jobs.end());
+        pool.runAll(poolJobs);
+
+        // Follow the chain of members from the start of the batch
+        clearReady();
+        size_t consumed = 0;
+        for (size_t i = 0; i < jobs.size(); i++) {
+            if (jobs[i]->start == consumed && jobs[i]->result == GZipMemberJob::COMPLETE) {
+                consumed = jobs[i]->end;
+                ready.push_back(jobs[i]);
+            } else {
+                delete jobs[i];
+            }
+        }
+
+        // Keep the rest for the next batch
+        batchStart += consumed;
+
+        if (consumed == 0 && batchSize > 0 && (isEof || batchSize == batchCapacity)) {
+            startSerial();
+        }
+    }
+
+    void startSerial() {
+        zStream.next_in = Z_NULL;
+        zStream.avail_in = 0;
+        zStream.zalloc = Z_NULL;
+        zStream.zfree = Z_NULL;
+        zStream.opaque = Z_NULL;
+
+        //The 2nd parameter tells zlib to detect gzip/zlib.
+        int zReturn = inflateInit2(&zStream, 32 + MAX_WBITS);
+        if (zReturn != Z_OK) {
+            vt_report_error(0, "Error occurred during ZLIB initialization.  ZLIB error code: %d, Message: %s", zReturn, zStream.msg);
+        }
+        serialMode = true;
+    }
+
+    /**
+     * Inflate serially into `output`, from the batch first, then
+     * straight from `input`.  Returns true once the member has ended.
+     */
+    bool inflateSerial(DataBuffer &input, InputState input_state, DataBuffer &output, StreamState &result) {
+        const bool fromBatch = batchStart < batchEnd;
+        zStream.next_in = fromBatch ? (Bytef*)&batch[batchStart] : (Bytef*)(input.buf + input.offset);
+        zStream.avail_in = fromBatch ? batchEnd - batchStart : input.size - input.offset;
+        zStream.next_out = (Bytef*)(output.buf + output.offset);
+        zStream.avail_out = output.size - output.offset;
+        const size_t availIn = zStream.avail_in;
+
+        int zReturn = inflate(&zStream, Z_NO_FLUSH);
+
+        const size_t used = availIn - zStream.avail_in;
+        if (fromBatch) {
+            batchStart += used;
+        } else {
+            input.offset += used;
+        }
+        output.offset = output.size - zStream.avail_out;
+
+        if (zReturn == Z_STREAM_END) {
+            inflateEnd(&zStream);
+            serialMode = false;
+            return true;
+        }
+        if (zReturn != Z_OK && zReturn != Z_BUF_ERROR) {
+            vt_report_error(0, "Error occurred during ZLIB decompression.  ZLIB error code: %d, Message: %s", zReturn, zStream.msg);
+        }
+
+        if (output.offset == output.size) {
+            result = OUTPUT_NEEDED;
+        } else if (batchStart == batchEnd && input.offset == input.size) {
+            // In case of corrupt (truncated) data, end early
+            result = (input_state == END_OF_FILE) ? DONE : INPUT_NEEDED;
+        } else {
+            result = KEEP_GOING;
+        }
+        return false;
+    }
+
+    virtual StreamState process(ServerInterface &srvInterface,
+                                  DataBuffer      &input,
+                                  InputState       input_state,
+                                  DataBuffer      &output)
+    {
+        while (true) {
+            // Emit decompressed members that are ready
+            if (readyIndex < ready.size()) {
+                const GZipMemberJob *member = ready[readyIndex];
+                const size_t len = std::min(member->outSize - readyOffset, output.size - output.offset);
+                memcpy(output.buf + output.offset, member->out + readyOffset, len);
+                output.offset += len;
+                readyOffset += len;
+                if (readyOffset == member->outSize) {
+                    readyIndex++;
+                    readyOffset = 0;
+                }
+                if (output.offset == output.size) return OUTPUT_NEEDED;
+                continue;
+            }
+
+            if (serialMode) {
+                StreamState result;
+                if (!inflateSerial(input, input_state, output, result)) {
+                    if (result != KEEP_GOING) return result;
+                }
+                continue;
+            }
+
+            // Collect input for the next batch, after whatever was left
+            // over from the last one
+            if (batchStart > 0) {
+                memmove(&batch[0], &batch[batchStart], batchEnd - batchStart);
+                batchEnd -= batchStart;
+                batchStart = 0;
+            }
+            const size_t len = std::min(input.size - input.offset, batchCapacity - batchEnd);
+            memcpy(&batch[batchEnd], input.buf + input.offset, len);
+            batchEnd += len;
+            input.offset += len;
+
+            const bool isEof = (input_state == END_OF_FILE && input.offset == input.size);
+            if (batchEnd == 0 && isEof) return DONE;
+            if (batchEnd < batchCapacity && !isEof) return INPUT_NEEDED;
+
+            inflateBatch(isEof);
+        }
+    }
 };
 
 
@@ -118,13 +459,33 @@ class GZipUnpackerFactory : public FilterFactory {
 public:
     virtual void plan(ServerInterface &srvInterface,
             PlanContext &planCtxt)
-    { /* No plan-time setup work to do */ }
+    {
+        // Each thread gets its own share of a batch held in memory, so
+        // don't let a typo ask for thousands of them
+        ParamReader params = srvInterface.getParamReader();
+        if (params.containsParameter("threads")
+                && (params.getIntRef("threads") < 1 || params.getIntRef("threads") > (vint)GZipParallelUnpacker::MAX_THREADS)) {
+            vt_report_error(0, "parameter \"threads\" must be between 1 and %d", (int)GZipParallelUnpacker::MAX_THREADS);
+        }
+    }
 
     virtual UDFilter* prepare(ServerInterface &srvInterface,
             PlanContext &planCtxt)
     {
+        ParamReader params = srvInterface.getParamReader();
+        if (params.containsParameter("threads") && params.getIntRef("threads") > 1) {
+            return vt_createFuncObject<GZipParallelUnpacker>(srvInterface.allocator,
+                                                             (size_t)params.getIntRef("threads"));
+        }
         return vt_createFuncObject<GZipUnpacker>(srvInterface.allocator);
     }
+
+    virtual void getParameterType(ServerInterface &srvInterface,
+                                  SizedColumnTypes &parameterTypes)
+    {
+        // Decompress multi-member files on this many threads
+        parameterTypes.addInt("threads");
+    }
 };
 RegisterFactory(GZipUnpackerFactory);
 
@@ -0,0 +1,267 @@
+/* Copyright (c) 2005 - 2016 Hewlett Packard Enterprise Development LP  -*- C++ -*-*/
+
+#include "Vertica.h"
+#include "ContinuousUDFilter.h"
+#include "LoadArgParsers.h"
+#include "MultiPatternMatcher.h"
+#include "SubstringSearch.h"
+
+#include <algorithm>
+#include <set>
+
+using namespace Vertica;
+
+/**
+ * Passes through only the records that contain (or, with `exact`,
+ * consist of) one of a list of patterns; optionally looking only at one
+ * field of delimited records.  With `invert`, passes through the
+ * records that don't match instead.
+ *
+ * Putting this in front of a parser means that the parser only sees
+ * the records that will be loaded: the filter doesn't look at records
+ * at all, it searches the whole block for the patterns and then only
+ * picks out the records around each hit.  Surviving records are copied
+ * through in runs, not one at a time.
+ */
+class GrepFilter : public ContinuousUDFilter {
+private:
+    const MultiPatternMatcher matcher;  // Used when there are several patterns
+    const std::string pattern;          // The pattern, when there's just one
+    const char recordTerminator;
+    const char delimiter;
+    const size_t column;                // 1-based; 0 for the whole record
+    const bool exact;
+    const bool invert;
+
+    // Byte ranges of the current reservation to pass through
+    std::vector<std::pair<size_t, size_t> > keep;
+
+public:
+    GrepFilter(const MultiPatternMatcher &matcher, char recordTerminator, char delimiter,
+               size_t column, bool exact, bool invert)
+        : matcher(matcher),
+          pattern(matcher.numPatterns() == 1 ? matcher.getPattern(0) : std::string()),
+          recordTerminator(recordTerminator), delimiter(delimiter),
+          column(column), exact(exact), invert(invert) {}
+
+    static const size_t RESERVE = 65536;
+
+    void run() {
+        size_t reserveSize = RESERVE;
+
+        while (true) {
+            // Take everything that's already available, and at least reserveSize
+            const size_t avail = cr.reserve(std::max(reserveSize, cr.capacity()));
+            if (avail == 0) break;
+            const bool atEnd = cr.noMoreData();
+            const char *data = (const char*)cr.getDataPtr();
+
+            // Only look at whole records
+            size_t end = avail;
+            if (!atEnd) {
+                const char *lastTerminator = (const char*)memrchr(data, recordTerminator, avail);
+                if (lastTerminator == NULL) {
+                    reserveSize = avail * 2;
+                    continue;
+                }
+                end = lastTerminator - data + 1;
+            }
+            reserveSize = RESERVE;
+
+            selectRecords(data, end);
+
+            // Pass through the selected runs of records; skip the rest
+            size_t pos = 0;
+            for (size_t i = 0; i < keep.size(); i++) {
+                cr.seek(keep[i].first - pos);
+                cw.passthrough(cr, keep[i].second - keep[i].first);
+                pos = keep[i].second;
+            }
+            if (end > pos) cr.seek(end - pos);
+        }
+    }
+
+private:
+    /** Fill `keep` with the runs of records in data[0, end) to pass through */
+    void selectRecords(const char *data, size_t end) {
+        keep.clear();
+        size_t keptUpTo = 0;    // With invert, the end of the last match
+
+        size_t pos = 0;
+        while (pos < end) {
+            const size_t hit = search(data, pos, end);
+            if (hit == end) break;
+
+            // The record around the hit
+            const char *terminatorBefore = (const char*)memrchr(data + pos, recordTerminator, hit - pos);
+            const size_t recordStart = terminatorBefore ? terminatorBefore - data + 1 : pos;
+            const char *terminatorAfter = (const char*)memchr(data + hit, recordTerminator, end - hit);
+            const size_t recordEnd = terminatorAfter ? terminatorAfter - data + 1 : end;
+            pos = recordEnd;
+
+            if (!recordMatches(data + recordStart, recordEnd - recordStart)) continue;
+
+            if (invert) {
+                addRun(keptUpTo, recordStart);
+                keptUpTo = recordEnd;
+            } else {
+                addRun(recordStart, recordEnd);
+            }
+        }
+        if (invert) addRun(keptUpTo, end);
+    }
+
+    void addRun(size_t start, size_t end) {
+        if (start == end) return;
+        if (!keep.empty() && keep.back().second == start) {
+            keep.back().second = end;
+        } else {
+            keep.push_back(std::make_pair(start, end));
+        }
+    }
+
+    /** Position of the first pattern occurrence in data[pos, end), or end */
+    size_t search(const char *data, size_t pos, size_t end) const {
+        if (!pattern.empty()) {
+            const char *found = findSubstring(data + pos, end - pos, pattern.data(), pattern.size());
+            return found ? found - data : end;
+        }
+        size_t start, which;
+        return matcher.find(data + pos, end - pos, true, start, which) ? pos + start : end;
+    }
+
+    /** Does the record (which contains a pattern somewhere) match? */
+    bool recordMatches(const char *record, size_t len) const {
+        if (len > 0 && record[len - 1] == recordTerminator) len--;
+
+        // Find the field to check
+        const char *field = record;
+        size_t fieldLen = len;
+        if (column > 0) {
+            for (size_t c = 1; c < column; c++) {
+                const char *next = (const char*)memchr(field, delimiter, fieldLen);
+                if (next == NULL) return false;     // Too few fields
+                fieldLen -= next + 1 - field;
+                field = next + 1;
+            }
+            const char *fieldEnd = (const char*)memchr(field, delimiter, fieldLen);
+            if (fieldEnd) fieldLen = fieldEnd - field;
+        } else if (!exact) {
+            return true;    // The hit is somewhere in the record
+        }
+
+        if (!pattern.empty()) {
+            if (exact) return fieldLen == pattern.size() && memcmp(field, pattern.data(), fieldLen) == 0;
+            return findSubstring(field, fieldLen, pattern.data(), pattern.size()) != NULL;
+        }
+        size_t start, which;
+        if (!matcher.find(field, fieldLen, true, start, which)) return false;
+        // The longest pattern at the start of the field is the field itself, if any is
+        return !exact || (start == 0 && matcher.getPattern(which).size() == fieldLen);
+    }
+};
+
+
+
+class GrepFilterFactory : public FilterFactory {
+public:
+    static const size_t MAX_PATTERN_LENGTH = 1000;
+
+    virtual void plan(ServerInterface &srvInterface,
+            PlanContext &planCtxt) {
+        std::vector<std::string> args = srvInterface.getParamReader().getParamNames();
+
+        const char *knownArgs[] = { "patterns", "separator", "record_terminator", "delimiter",
+                                    "column", "exact", "invert" };
+        std::set<std::string> known(knownArgs, knownArgs + sizeof(knownArgs) / sizeof(knownArgs[0]));
+        known.insert(LoadCounters::paramName());
+        known.insert(CoroutineTracer::paramName());
+        for (size_t i = 0; i < args.size(); i++) {
+            if (known.count(args[i]) == 0) {
+                vt_report_error(0, "Invalid argument to Grep: '%s'", args[i].c_str());
+            }
+        }
+        if (find(args.begin(), args.end(), "patterns") == args.end()) {
+            vt_report_error(0, "Invalid arguments to Grep.  Please specify 'patterns'.");
+        }
+
+        // Parse everything now, so that errors are reported before the load starts
+        MultiPatternMatcher matcher;
+        parsePatterns(srvInterface, matcher);
+        if (getColumn(srvInterface) < 0) {
+            vt_report_error(0, "'column' must be 1 or more (or 0 for the whole record)");
+        }
+    }
+
+    virtual UDFilter* prepare(ServerInterface &srvInterface,
+            PlanContext &planCtxt) {
+        ParamReader params = srvInterface.getParamReader();
+        MultiPatternMatcher matcher;
+        parsePatterns(srvInterface, matcher);
+        matcher.compile();
+
+        return vt_createFuncObject<GrepFilter>(srvInterface.allocator, matcher,
+                getChar(params, "record_terminator", '\n'), getChar(params, "delimiter", '|'),
+                (size_t)getColumn(srvInterface),
+                params.containsParameter("exact") && params.getBoolRef("exact") == vbool_true,
+                params.containsParameter("invert") && params.getBoolRef("invert") == vbool_true);
+    }
+
+    virtual void getParameterType(ServerInterface &srvInterface,
+                                  SizedColumnTypes &parameterTypes) {
+        parameterTypes.addVarchar(65000, "patterns");
+        parameterTypes.addVarchar(1, "separator");
+        parameterTypes.addVarchar(1, "record_terminator");
+        parameterTypes.addVarchar(1, "delimiter");
+        parameterTypes.addInt("column");
+        parameterTypes.addBool("exact");
+        parameterTypes.addBool("invert");
+        LoadCounters::addParameterType(parameterTypes);
+        CoroutineTracer::addParameterType(parameterTypes);
+    }
+
+private:
+    static char getChar(ParamReader &params, const std::string &name, char defaultValue) {
+        if (!params.containsParameter(name)) return defaultValue;
+        const std::string value = params.getStringRef(name).str();
+        if (value.size() != 1) {
+            vt_report_error(0, "'%s' must be a single character", name.c_str());
+        }
+        return value[0];
+    }
+
+    static vint getColumn(ServerInterface &srvInterface) {
+        ParamReader params = srvInterface.getParamReader();
+        return params.containsParameter("column") ? params.getIntRef("column") : 0;
+    }
+
+    static void parsePatterns(ServerInterface &srvInterface, MultiPatternMatcher &matcher) {
+        ParamReader params = srvInterface.getParamReader();
+
+        const char separator = getChar(params, "separator", ',');
+        const char recordTerminator = getChar(params, "record_terminator", '\n');
+        if (separator == '\\') {
+            vt_report_error(0, "'separator' can't be backslash");
+        }
+
+        std::vector<std::string> patterns =
+            splitEscapedList(params.getStringRef("patterns").str(), separator, "patterns");
+        std::set<std::string> seen;
+        for (size_t i = 0; i < patterns.size(); i++) {
+            if (patterns[i].empty()) {
+                vt_report_error(0, "Can't have a zero-length pattern (entry %zu of 'patterns'); must have something to match with", i + 1);
+            }
+            if (patterns[i].size() > MAX_PATTERN_LENGTH) {
+                vt_report_error(0, "Entry %zu of 'patterns' is too long; must be at most %zu characters",
+                                i + 1, MAX_PATTERN_LENGTH);
+            }
+            if (patterns[i].find(recordTerminator) != std::string::npos) {
+                vt_report_error(0, "Entry %zu of 'patterns' contains the record terminator; it can never match", i + 1);
+            }
+            if (seen.insert(patterns[i]).second) {
+                matcher.addPattern(patterns[i]);
+            }
+        }
+    }
+};
+RegisterFactory(GrepFilterFactory);
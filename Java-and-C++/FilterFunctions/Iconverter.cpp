@@ -1,6 +1,7 @@
 /* Copyright (c) 2005 - 2016 Hewlett Packard Enterprise Development LP  -*- C++ -*-*/
 
 #include "Vertica.h"
+#include "Transcoders.h"
 
 using namespace Vertica;
 
@@ -9,16 +10,31 @@ using namespace Vertica;
 #include <iconv.h>
 #include <errno.h>
 
-
+/**
+ * Converts between character encodings.
+ *
+ * UTF-16 and ISO-8859-1 to UTF-8 have a fast built-in path (see
+ * Transcoders.h); all other conversions go through iconv.
+ */
 class Iconverter : public UDFilter
 {
 private:
     std::string fromEncoding, toEncoding;
     iconv_t cd; // the conversion descriptor opened
     uint converted; // how many characters have been converted
+    uint64_t inputOffset; // offset in the input of the start of the current input buffer
+    Utf8Transcoder transcoder;
+    bool useTranscoder;
 
 protected:
     virtual void setup(ServerInterface &srvInterface) {
+        Utf8Transcoder::Encoding encoding = Utf8Transcoder::lookup(fromEncoding, toEncoding);
+        useTranscoder = (encoding != Utf8Transcoder::NONE);
+        if (useTranscoder) {
+            transcoder = Utf8Transcoder(encoding);
+            return;
+        }
+
         cd = iconv_open(toEncoding.c_str(), fromEncoding.c_str());
         if (cd == (iconv_t)(-1)) {
             vt_report_error(0, "Error initializing iconv: %m");
@@ -34,6 +50,10 @@ protected:
     virtual StreamState process(ServerInterface &srvInterface, DataBuffer &input, InputState input_state,
                                 DataBuffer &output)
     {
+        if (useTranscoder) {
+            return transcode(input, input_state, output);
+        }
+
         char *input_buf = (char *)input.buf + input.offset;
         char *output_buf = (char *)output.buf + output.offset;
         size_t inBytesLeft = input.size - input.offset, outBytesLeft = output.size - output.offset;
@@ -69,8 +89,8 @@ protected:
                 break;
             case EILSEQ:
                 // invalid sequence seen, throw
-                // TODO: reporting the wrong byte position
-                vt_report_error(1, "Invalid byte sequence when doing %u-th conversion", converted);
+                vt_report_error(1, "Invalid byte sequence at byte offset %llu of the input",
+                                (unsigned long long)(inputOffset + (input_buf - (char *)input.buf)));
             case EBADF:
                 // something wrong with descriptor, throw
                 vt_report_error(0, "Invalid descriptor");
@@ -87,13 +107,44 @@ protected:
         // move position pointer
         input.offset = input.size - inBytesLeft;
         output.offset = output.size - outBytesLeft;
+        if (retStatus != OUTPUT_NEEDED) {
+            inputOffset += input.offset;
+        }
 
         return retStatus;
     }
 
+    StreamState transcode(DataBuffer &input, InputState input_state, DataBuffer &output)
+    {
+        Utf8Transcoder::Result result = transcoder.transcode(
+                (const unsigned char *)input.buf, input.size, input.offset,
+                (unsigned char *)output.buf, output.size, output.offset);
+
+        switch (result)
+        {
+        case Utf8Transcoder::OUTPUT_FULL:
+            return OUTPUT_NEEDED;
+        case Utf8Transcoder::INVALID:
+            vt_report_error(1, "Invalid byte sequence at byte offset %llu of the input",
+                            (unsigned long long)(inputOffset + input.offset));
+        case Utf8Transcoder::INCOMPLETE:
+            if (input_state == END_OF_FILE) {
+                vt_report_error(1, "Incomplete character at byte offset %llu, at the end of the input",
+                                (unsigned long long)(inputOffset + input.offset));
+            }
+            break;
+        case Utf8Transcoder::OK:
+            break;
+        }
+
+        inputOffset += input.offset;
+        return input_state == END_OF_FILE ? DONE : INPUT_NEEDED;
+    }
+
 public:
     Iconverter(const std::string &from, const std::string &to) :
-        fromEncoding(from), toEncoding(to), converted(0) {}
+        fromEncoding(from), toEncoding(to), cd((iconv_t)(-1)), converted(0), inputOffset(0),
+        useTranscoder(false) {}
 };
 
 class IconverterFactory : public FilterFactory
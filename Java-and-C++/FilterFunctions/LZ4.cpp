@@ -0,0 +1,90 @@
+/* Copyright (c) 2005 - 2016 Hewlett Packard Enterprise Development LP  -*- C++ -*-*/
+
+#include <lz4frame.h>
+
+#include "Vertica.h"
+using namespace Vertica;
+
+
+/**
+ * LZ4Unpacker. Decodes .lz4 (LZ4 frame) format.
+ *
+ * Files with several frames (e.g. concatenated .lz4 files) are decoded
+ * frame after frame; skippable frames produce no output.
+ */
+class LZ4Unpacker : public UDFilter {
+private:
+    LZ4F_dctx *dCtx;
+    bool inFrame;
+
+protected:
+    virtual void setup(ServerInterface &srvInterface) {
+        LZ4F_errorCode_t lReturn = LZ4F_createDecompressionContext(&dCtx, LZ4F_VERSION);
+        if (LZ4F_isError(lReturn)) {
+            vt_report_error(0, "Error occurred during LZ4 initialization.  Message: %s", LZ4F_getErrorName(lReturn));
+        }
+        inFrame = false;
+    }
+
+    virtual StreamState process(ServerInterface &srvInterface,
+                                  DataBuffer      &input,
+                                  InputState       input_state,
+                                  DataBuffer      &output)
+    {
+        while (true) {
+            size_t inSize = input.size - input.offset;
+            size_t outSize = output.size - output.offset;
+            const size_t inAvail = inSize, outAvail = outSize;
+
+            if (outAvail == 0) return OUTPUT_NEEDED;
+
+            // Returns 0 at the end of each frame; the next call starts on the next frame
+            size_t lReturn = LZ4F_decompress(dCtx, output.buf + output.offset, &outSize,
+                                             input.buf + input.offset, &inSize, NULL);
+            if (LZ4F_isError(lReturn)) {
+                vt_report_error(0, "Error occurred during LZ4 decompression.  Message: %s", LZ4F_getErrorName(lReturn));
+            }
+
+            // On return, inSize and outSize hold the amounts consumed and produced
+            input.offset += inSize;
+            output.offset += outSize;
+            if (inSize > 0 || outSize > 0) {
+                inFrame = (lReturn != 0);
+            }
+
+            // All input used, and nothing left buffered inside the decoder?
+            if (inSize == inAvail && outSize < outAvail) {
+                if (input_state == END_OF_FILE) {
+                    if (inFrame) {
+                        vt_report_error(0, "Error occurred during LZ4 decompression.  Message: Truncated input");
+                    }
+                    return DONE;
+                }
+                return INPUT_NEEDED;
+            }
+        }
+    }
+
+    virtual void destroy(ServerInterface &srvInterface) {
+        LZ4F_freeDecompressionContext(dCtx);
+        dCtx = NULL;
+    }
+
+public:
+        LZ4Unpacker() : dCtx(NULL), inFrame(false) {}
+};
+
+
+class LZ4UnpackerFactory : public FilterFactory {
+public:
+    virtual void plan(ServerInterface &srvInterface,
+            PlanContext &planCtxt)
+    { /* No plan-time setup work to do */ }
+
+    virtual UDFilter* prepare(ServerInterface &srvInterface,
+            PlanContext &planCtxt)
+    {
+        return vt_createFuncObject<LZ4Unpacker>(srvInterface.allocator);
+    }
+};
+RegisterFactory(LZ4UnpackerFactory);
@@ -0,0 +1,153 @@
+/* Copyright (c) 2005 - 2016 Hewlett Packard Enterprise Development LP  -*- C++ -*-*/
+
+#include "Vertica.h"
+#include "ContinuousUDFilter.h"
+#include "MultiPatternMatcher.h"
+#include "LoadArgParsers.h"
+
+#include <algorithm>
+#include <set>
+
+using namespace Vertica;
+
+/**
+ * Replaces every occurrence of any of a list of patterns with that
+ * pattern's replacement, in a single pass over the data.
+ *
+ * Where patterns overlap, the match starting first wins; of matches
+ * starting at the same place, the longest.  Replaced text is not
+ * searched again.
+ */
+class MultiSearchAndReplaceFilter : public ContinuousUDFilter {
+private:
+    const MultiPatternMatcher matcher;
+    const std::vector<std::string> replacements;
+
+public:
+    MultiSearchAndReplaceFilter(const MultiPatternMatcher &matcher,
+                                const std::vector<std::string> &replacements)
+        : matcher(matcher), replacements(replacements) {}
+
+    // Ask for big blocks of input, so that runs of unmatched data are
+    // found and copied through in as few steps as possible
+    static const size_t RESERVE = 65536;
+
+    void run() {
+        size_t reserveSize = RESERVE;
+
+        while (true) {
+            const size_t avail = cr.reserve(reserveSize);
+            if (avail == 0) break;
+            const bool atEnd = cr.noMoreData();
+
+            size_t start, pattern;
+            const bool found = matcher.find((const char*)cr.getDataPtr(), avail, atEnd, start, pattern);
+
+            // Everything before the match (or everything that can't be
+            // part of a match) is unchanged
+            cw.passthrough(cr, start);
+
+            if (found) {
+                const std::string &replacement = replacements[pattern];
+                if (!replacement.empty()) {
+                    cw.write(replacement.c_str(), replacement.size());
+                }
+                cr.seek(matcher.getPattern(pattern).size());
+                reserveSize = RESERVE;
+            } else if (start == 0) {
+                // A possible match runs off the end of the available
+                // data; we need to see more of it to decide
+                reserveSize = std::max(reserveSize, avail) * 2;
+            } else {
+                reserveSize = RESERVE;
+            }
+        }
+    }
+};
+
+
+
+class MultiSearchAndReplaceFilterFactory : public FilterFactory {
+public:
+    static const size_t MAX_PATTERN_LENGTH = 1000;
+
+    virtual void plan(ServerInterface &srvInterface,
+            PlanContext &planCtxt) {
+        std::vector<std::string> args = srvInterface.getParamReader().getParamNames();
+
+        const size_t numOptionalArgs =
+            (srvInterface.getParamReader().containsParameter("separator") ? 1 : 0) +
+            (srvInterface.getParamReader().containsParameter(LoadCounters::paramName()) ? 1 : 0) +
+            (srvInterface.getParamReader().containsParameter(CoroutineTracer::paramName()) ? 1 : 0);
+
+        if (!(args.size() == 2 + numOptionalArgs
+                && find(args.begin(), args.end(), "patterns") != args.end()
+                && find(args.begin(), args.end(), "replacements") != args.end()))
+        {
+            vt_report_error(0, "Invalid arguments to MultiSearchAndReplace.  Please specify 'patterns' and 'replacements', and optionally 'separator'.");
+        }
+
+        // Parse everything now, so that errors are reported before the load starts
+        MultiPatternMatcher matcher;
+        std::vector<std::string> replacements;
+        parseArgs(srvInterface, matcher, replacements);
+    }
+
+    virtual UDFilter* prepare(ServerInterface &srvInterface,
+            PlanContext &planCtxt) {
+        MultiPatternMatcher matcher;
+        std::vector<std::string> replacements;
+        parseArgs(srvInterface, matcher, replacements);
+        matcher.compile();
+        return vt_createFuncObject<MultiSearchAndReplaceFilter>(srvInterface.allocator, matcher, replacements);
+    }
+
+    virtual void getParameterType(ServerInterface &srvInterface,
+                                  SizedColumnTypes &parameterTypes) {
+        parameterTypes.addVarchar(65000, "patterns");
+        parameterTypes.addVarchar(65000, "replacements");
+        parameterTypes.addVarchar(1, "separator");
+        LoadCounters::addParameterType(parameterTypes);
+        CoroutineTracer::addParameterType(parameterTypes);
+    }
+
+private:
+    static void parseArgs(ServerInterface &srvInterface, MultiPatternMatcher &matcher,
+                          std::vector<std::string> &replacements) {
+        ParamReader params = srvInterface.getParamReader();
+
+        char separator = ',';
+        if (params.containsParameter("separator")) {
+            const std::string sep = params.getStringRef("separator").str();
+            if (sep.size() != 1 || sep[0] == '\\') {
+                vt_report_error(0, "'separator' must be a single character other than backslash");
+            }
+            separator = sep[0];
+        }
+
+        std::vector<std::string> patterns =
+            splitEscapedList(params.getStringRef("patterns").str(), separator, "patterns");
+        replacements = splitEscapedList(params.getStringRef("replacements").str(), separator, "replacements");
+
+        if (patterns.size() != replacements.size()) {
+            vt_report_error(0, "'patterns' has %zu entries but 'replacements' has %zu; they must match",
+                            patterns.size(), replacements.size());
+        }
+
+        std::set<std::string> seen;
+        for (size_t i = 0; i < patterns.size(); i++) {
+            if (patterns[i].empty()) {
+                vt_report_error(0, "Can't have a zero-length pattern (entry %zu of 'patterns'); must have something to match with", i + 1);
+            }
+            if (patterns[i].size() > MAX_PATTERN_LENGTH) {
+                vt_report_error(0, "Entry %zu of 'patterns' is too long; must be at most %zu characters",
+                                i + 1, MAX_PATTERN_LENGTH);
+            }
+            if (!seen.insert(patterns[i]).second) {
+                vt_report_error(0, "Entry %zu of 'patterns' is a duplicate", i + 1);
+            }
+            matcher.addPattern(patterns[i]);
+        }
+    }
+};
+RegisterFactory(MultiSearchAndReplaceFilterFactory);
@@ -4,7 +4,6 @@
 #include "ContinuousUDFilter.h"
 
 #include <algorithm>
-using std::min;
 
 using namespace Vertica;
 
@@ -16,63 +15,51 @@ public:
     SearchAndReplaceFilter(std::string pattern, std::string replace_with)
         : pattern(pattern), replace_with(replace_with) {}
 
-    static const size_t RESERVE = 256;
-
     void run() {
-        // Reserve data in 256-byte chunks.
-        // Be careful about not missing a pattern that's on a chunk border.
-
-        while (!cr.isEof()) {
-            size_t in_size = cr.reserve(RESERVE);
-            char *in_ptr = (char*)cr.getDataPtr();
-
-            size_t out_size = cw.reserve(RESERVE);
-            char *out_ptr = (char*)cw.getDataPtr();
-
-            size_t pos;
-            size_t max_size = min(in_size, out_size);
-
-            if (max_size < pattern.size()) break; // No more matches here
-
-            for (pos = 0; pos < max_size - pattern.size() + 1; pos++) {
-                if ((in_ptr[pos] == pattern[0])  // Check the first byte inline
-                    && (memcmp(&in_ptr[pos], pattern.c_str(), pattern.size()) == 0)) {
-
-                    // We found the pattern.
-                    // We're going to be playing games with the output stream,
-                    // so seek through everything we're done with first.
-                    if (pos) cr.seek(pos);
-                    if (pos) cw.seek(pos);
-
-                    // Make sure we have enough space in the output stream for it
-                    cw.reserve(replace_with.size());
-
-                    // Then copy it to the output stream
-                    memcpy(cw.getDataPtr(), replace_with.c_str(), replace_with.size());
-                    cw.seek(replace_with.size());
-
-                    // We don't need to do anything else with the pattern in
-                    // the input stream
-                    cr.seek(pattern.size());
-
-                    // Reset position to 0 so that we don't try to seek
-                    pos = 0;
+        const size_t patternSize = pattern.size();
+
+        // Work on whatever input is currently available, but at least
+        // enough of it to hold one instance of the pattern, so that we
+        // don't miss a pattern that's on a block border.
+        size_t available;
+        while ((available = cr.reserve(patternSize)) >= patternSize) {
+            const char *in_ptr = (const char*)cr.getDataPtr();
+
+            // Only positions at which the whole pattern fits can match
+            const size_t searchable = cr.capacity() - patternSize + 1;
+
+            // Find the first match; memchr() for the first byte, then
+            // check the rest
+            size_t pos = 0;
+            bool found = false;
+            while (pos < searchable) {
+                const char *candidate = (const char*)memchr(in_ptr + pos, pattern[0], searchable - pos);
+                if (candidate == NULL) break;
+                pos = candidate - in_ptr;
+                if (memcmp(candidate, pattern.c_str(), patternSize) == 0) {
+                    found = true;
                     break;
                 }
-                out_ptr[pos] = in_ptr[pos];
+                pos++;
             }
+            if (!found) pos = searchable;
 
-            if (pos) cr.seek(pos);
-            if (pos) cw.seek(pos);
+            // Everything before the match is unchanged
+            cw.passthrough(cr, pos);
+
+            if (found) {
+                // Copy the replacement to the output stream.
+                // We don't need to do anything else with the pattern in
+                // the input stream
+                cw.write(replace_with.c_str(), replace_with.size());
+                cr.seek(patternSize);
+            }
         }
 
         // We know the last few bytes can't contain an instance of pattern;
-        // it's too short.  So just copy them.
-        cw.reserve(pattern.size()-1);
-        size_t data_left = cr.reserve(RESERVE);
-        memcpy(cw.getDataPtr(), cr.getDataPtr(), data_left);
-        cr.seek(data_left);
-        cw.seek(data_left);
+        // it's too short.  So just copy them -- all of them, which is
+        // what reserve() came back with at the end of the input.
+        cw.passthrough(cr, available);
     }
 };
 
@@ -84,7 +71,11 @@ public:
             PlanContext &planCtxt) {
         std::vector<std::string> args = srvInterface.getParamReader().getParamNames();
 
-        if (!(args.size() == 2
+        const size_t numOptionalArgs =
+            (srvInterface.getParamReader().containsParameter(LoadCounters::paramName()) ? 1 : 0) +
+            (srvInterface.getParamReader().containsParameter(CoroutineTracer::paramName()) ? 1 : 0);
+
+        if (!(args.size() == 2 + numOptionalArgs
                 && find(args.begin(), args.end(), "pattern") != args.end()
                 && find(args.begin(), args.end(), "replace_with") != args.end())) // No args
         {
@@ -110,6 +101,8 @@ public:
                                   SizedColumnTypes &parameterTypes) {
         parameterTypes.addVarchar(65000, "pattern");
         parameterTypes.addVarchar(65000, "replace_with");
+        LoadCounters::addParameterType(parameterTypes);
+        CoroutineTracer::addParameterType(parameterTypes);
     }
 };
 RegisterFactory(SearchAndReplaceFilterFactory);
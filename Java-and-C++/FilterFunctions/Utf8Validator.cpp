@@ -0,0 +1,130 @@
+/* Copyright (c) 2005 - 2016 Hewlett Packard Enterprise Development LP  -*- C++ -*-*/
+
+#include "Vertica.h"
+#include "Utf8Validation.h"
+
+using namespace Vertica;
+
+#include <string>
+#include <algorithm>
+
+
+/**
+ * Checks that the data is valid UTF-8, passing it through unchanged.
+ *
+ * Depending on `mode`, an invalid sequence either fails the load, is
+ * replaced with U+FFFD, or is dropped.  The number of invalid sequences
+ * found is logged when the filter is torn down.
+ */
+class Utf8Validator : public UDFilter
+{
+public:
+    enum Mode { FAIL, REPLACE, DROP };
+
+private:
+    Mode mode;
+    uint64_t inputOffset; // offset in the input of the start of the current input buffer
+    uint64_t invalidCount;
+
+protected:
+    virtual void setup(ServerInterface &srvInterface) {
+        inputOffset = 0;
+        invalidCount = 0;
+    }
+
+    virtual void destroy(ServerInterface &srvInterface) {
+        if (invalidCount > 0) {
+            srvInterface.log("Utf8Validator: %s %llu invalid UTF-8 sequences",
+                             (mode == REPLACE) ? "replaced" : "dropped", (unsigned long long)invalidCount);
+        }
+    }
+
+    virtual StreamState process(ServerInterface &srvInterface, DataBuffer &input, InputState input_state,
+                                DataBuffer &output)
+    {
+        const unsigned char *in = (const unsigned char *)input.buf;
+        char *out = output.buf;
+
+        while (true) {
+            // Copy through the valid data
+            const size_t room = std::min(input.size - input.offset, output.size - output.offset);
+            const size_t valid = Utf8Validation::validPrefix(in + input.offset, room);
+            memcpy(out + output.offset, in + input.offset, valid);
+            input.offset += valid;
+            output.offset += valid;
+
+            if (input.offset == input.size) break;
+            if (output.offset == output.size) return OUTPUT_NEEDED;
+
+            // Copy or handle the character that stopped validPrefix()
+            const int n = Utf8Validation::checkCharacter(in + input.offset, input.size - input.offset,
+                                                         input_state == END_OF_FILE);
+            if (n == 0) break;  // Ends partway through a character; need more input
+            if (n > 0) {
+                if (output.size - output.offset < (size_t)n) return OUTPUT_NEEDED;
+                memcpy(out + output.offset, in + input.offset, n);
+                input.offset += n;
+                output.offset += n;
+                continue;
+            }
+
+            if (mode == FAIL) {
+                vt_report_error(1, "Invalid UTF-8 sequence at byte offset %llu of the input",
+                                (unsigned long long)(inputOffset + input.offset));
+            }
+            if (mode == REPLACE) {
+                static const char replacement[] = "\xEF\xBF\xBD";
+                if (output.size - output.offset < sizeof(replacement) - 1) return OUTPUT_NEEDED;
+                memcpy(out + output.offset, replacement, sizeof(replacement) - 1);
+                output.offset += sizeof(replacement) - 1;
+            }
+            input.offset += -n;
+            invalidCount++;
+        }
+
+        inputOffset += input.offset;
+        return input_state == END_OF_FILE ? DONE : INPUT_NEEDED;
+    }
+
+public:
+    Utf8Validator(Mode mode) : mode(mode), inputOffset(0), invalidCount(0) {}
+};
+
+class Utf8ValidatorFactory : public FilterFactory
+{
+public:
+    virtual void plan(ServerInterface &srvInterface,
+            PlanContext &planCtxt) {
+        std::vector<std::string> args = srvInterface.getParamReader().getParamNames();
+
+        if (!(args.size() == 0 ||
+                (args.size() == 1 && find(args.begin(), args.end(), "mode") != args.end()))) {
+            vt_report_error(0, "Invalid arguments.  Must specify either no arguments, or 'mode'.");
+        }
+        getMode(srvInterface);
+    }
+
+    virtual UDFilter* prepare(ServerInterface &srvInterface,
+            PlanContext &planCtxt) {
+        return vt_createFuncObject<Utf8Validator>(srvInterface.allocator, getMode(srvInterface));
+    }
+
+    virtual void getParameterType(ServerInterface &srvInterface,
+                                  SizedColumnTypes &parameterTypes) {
+        parameterTypes.addVarchar(16, "mode");
+    }
+
+private:
+    static Utf8Validator::Mode getMode(ServerInterface &srvInterface) {
+        ParamReader params = srvInterface.getParamReader();
+        if (!params.containsParameter("mode")) return Utf8Validator::FAIL;
+
+        const std::string mode = params.getStringRef("mode").str();
+        if (mode == "fail") return Utf8Validator::FAIL;
+        if (mode == "replace") return Utf8Validator::REPLACE;
+        if (mode == "drop") return Utf8Validator::DROP;
+        vt_report_error(0, "Invalid mode [%s]; must be 'fail', 'replace' or 'drop'", mode.c_str());
+        return Utf8Validator::FAIL;
+    }
+};
+RegisterFactory(Utf8ValidatorFactory);
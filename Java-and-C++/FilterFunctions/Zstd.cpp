@@ -0,0 +1,93 @@
+/* Copyright (c) 2005 - 2016 Hewlett Packard Enterprise Development LP  -*- C++ -*-*/
+
+#include <zstd.h>
+
+#include "Vertica.h"
+using namespace Vertica;
+
+
+/**
+ * ZstdUnpacker. Decodes .zst format.
+ *
+ * Files with several frames (concatenated .zst files, or files written
+ * in the seekable format) are decoded frame after frame; skippable
+ * frames, such as the seekable format's seek table, produce no output.
+ */
+class ZstdUnpacker : public UDFilter {
+private:
+    ZSTD_DStream *dStream;
+    bool inFrame;
+
+protected:
+    virtual void setup(ServerInterface &srvInterface) {
+        dStream = ZSTD_createDStream();
+        if (dStream == NULL) {
+            vt_report_error(0, "Error occurred during ZSTD initialization");
+        }
+
+        size_t zReturn = ZSTD_initDStream(dStream);
+        if (ZSTD_isError(zReturn)) {
+            vt_report_error(0, "Error occurred during ZSTD initialization.  Message: %s", ZSTD_getErrorName(zReturn));
+        }
+        inFrame = false;
+    }
+
+    virtual StreamState process(ServerInterface &srvInterface,
+                                  DataBuffer      &input,
+                                  InputState       input_state,
+                                  DataBuffer      &output)
+    {
+        while (true) {
+            ZSTD_inBuffer in = { input.buf + input.offset, input.size - input.offset, 0 };
+            ZSTD_outBuffer out = { output.buf + output.offset, output.size - output.offset, 0 };
+
+            if (out.size == 0) return OUTPUT_NEEDED;
+
+            // Returns 0 at the end of each frame; the next call starts on the next frame
+            size_t zReturn = ZSTD_decompressStream(dStream, &out, &in);
+            if (ZSTD_isError(zReturn)) {
+                vt_report_error(0, "Error occurred during ZSTD decompression.  Message: %s", ZSTD_getErrorName(zReturn));
+            }
+
+            input.offset += in.pos;
+            output.offset += out.pos;
+            if (in.pos > 0 || out.pos > 0) {
+                inFrame = (zReturn != 0);
+            }
+
+            // All input used, and nothing left buffered inside the decoder?
+            if (in.pos == in.size && out.pos < out.size) {
+                if (input_state == END_OF_FILE) {
+                    if (inFrame) {
+                        vt_report_error(0, "Error occurred during ZSTD decompression.  Message: Truncated input");
+                    }
+                    return DONE;
+                }
+                return INPUT_NEEDED;
+            }
+        }
+    }
+
+    virtual void destroy(ServerInterface &srvInterface) {
+        ZSTD_freeDStream(dStream);
+        dStream = NULL;
+    }
+
+public:
+        ZstdUnpacker() : dStream(NULL), inFrame(false) {}
+};
+
+
+class ZstdUnpackerFactory : public FilterFactory {
+public:
+    virtual void plan(ServerInterface &srvInterface,
+            PlanContext &planCtxt)
+    { /* No plan-time setup work to do */ }
+
+    virtual UDFilter* prepare(ServerInterface &srvInterface,
+            PlanContext &planCtxt)
+    {
+        return vt_createFuncObject<ZstdUnpacker>(srvInterface.allocator);
+    }
+};
+RegisterFactory(ZstdUnpackerFactory);
@@ -0,0 +1,309 @@
+/* Copyright (c) 2005 - 2016 Hewlett Packard Enterprise Development LP  -*- C++ -*-*/
+/****************************
+ * Vertica Analytic Database
+ *
+ * UDL helper; keeping several file reads in flight at once, with
+ * io_uring where the kernel has it and a pool of pread() threads
+ * where it doesn't.
+ *
+ ****************************/
+
+#include <pthread.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <vector>
+#include <deque>
+#include <algorithm>
+
+#ifdef HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+#ifndef ASYNC_READ_ENGINE_H_
+#define ASYNC_READ_ENGINE_H_
+
+/**
+ * AsyncReadEngine
+ *
+ * Runs reads in the background and reports their completions, in
+ * whatever order they finish.  Each read is identified by a tag, which
+ * must be less than the depth passed to start(), and must not be reused
+ * until that read has completed.
+ *
+ * None of these calls report errors through the server; results are
+ * returned as for pread(), except that failures are -errno.
+ */
+class AsyncReadEngine {
+public:
+    virtual ~AsyncReadEngine() {}
+
+    /** Get ready for up to `depth` reads at once; false if this engine can't be used */
+    virtual bool start(size_t depth) = 0;
+
+    /** Queue a read of up to `len` bytes at offset `off` of `fd` into `buf` */
+    virtual void read(int fd, char *buf, size_t len, off_t off, size_t tag) = 0;
+
+    /** Start the reads queued since the last flush(); false (errno set) on failure */
+    virtual bool flush() = 0;
+
+    /** Wait for any read to complete; false (errno set) on failure */
+    virtual bool wait(size_t &tag, ssize_t &result) = 0;
+
+    virtual void stop() = 0;
+
+    virtual const char *getName() const = 0;
+};
+
+#ifdef HAVE_IO_URING
+/**
+ * Reads through an io_uring, set up with the raw system calls (so as
+ * not to depend on liburing).  start() fails on kernels without io_uring,
+ * or where it has been disabled.
+ */
+class IoUringReadEngine : public AsyncReadEngine {
+public:
+    IoUringReadEngine() : ringFd(-1), sqRing(NULL), cqRing(NULL), sqes(NULL), unsubmitted(0) {}
+    ~IoUringReadEngine() { stop(); }
+
+    bool start(size_t depth) {
+        stop();
+        struct io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        ringFd = syscall(__NR_io_uring_setup, (unsigned)depth, &params);
+        if (ringFd < 0) return false;
+
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        bool singleMmap = false;
+#ifdef IORING_FEAT_SINGLE_MMAP
+        singleMmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (singleMmap) sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+#endif
+        sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+
+        sqRing = mapRing(sqRingSize, IORING_OFF_SQ_RING);
+        cqRing = singleMmap ? sqRing : mapRing(cqRingSize, IORING_OFF_CQ_RING);
+        sqes = (struct io_uring_sqe *)mapRing(sqesSize, IORING_OFF_SQES);
+        if (sqRing == NULL || cqRing == NULL || sqes == NULL) {
+            stop();
+            return false;
+        }
+
+        sqTail = (unsigned *)(sqRing + params.sq_off.tail);
+        sqMask = (unsigned *)(sqRing + params.sq_off.ring_mask);
+        sqArray = (unsigned *)(sqRing + params.sq_off.array);
+        cqHead = (unsigned *)(cqRing + params.cq_off.head);
+        cqTail = (unsigned *)(cqRing + params.cq_off.tail);
+        cqMask = (unsigned *)(cqRing + params.cq_off.ring_mask);
+        cqes = (struct io_uring_cqe *)(cqRing + params.cq_off.cqes);
+
+        // The kernel may read a request's iovec after it has taken the
+        // request off the queue, so each tag gets its own
+        iovecs.resize(depth);
+        unsubmitted = 0;
+        return true;
+    }
+
+    void read(int fd, char *buf, size_t len, off_t off, size_t tag) {
+        const unsigned tail = *sqTail;
+        const unsigned index = tail & *sqMask;
+        struct io_uring_sqe *sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+
+        iovecs[tag].iov_base = buf;
+        iovecs[tag].iov_len = len;
+        sqe->opcode = IORING_OP_READV;     // Rather than READ, which needs Linux 5.6
+        sqe->fd = fd;
+        sqe->off = off;
+        sqe->addr = (uintptr_t)&iovecs[tag];
+        sqe->len = 1;
+        sqe->user_data = tag;
+
+        sqArray[index] = index;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+        unsubmitted++;
+    }
+
+    bool flush() {
+        while (unsubmitted > 0) {
+            const int n = syscall(__NR_io_uring_enter, ringFd, unsubmitted, 0, 0, NULL, 0);
+            if (n < 0) {
+                if (errno == EINTR || errno == EAGAIN) continue;
+                return false;
+            }
+            unsubmitted -= n;
+        }
+        return true;
+    }
+
+    bool wait(size_t &tag, ssize_t &result) {
+        while (true) {
+            const unsigned head = *cqHead;
+            if (head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+                const struct io_uring_cqe *cqe = &cqes[head & *cqMask];
+                tag = cqe->user_data;
+                result = cqe->res;
+                __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+                return true;
+            }
+            if (syscall(__NR_io_uring_enter, ringFd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0
+                    && errno != EINTR) {
+                return false;
+            }
+        }
+    }
+
+    void stop() {
+        if (sqes) munmap(sqes, sqesSize);
+        if (cqRing && cqRing != sqRing) munmap(cqRing, cqRingSize);
+        if (sqRing) munmap(sqRing, sqRingSize);
+        sqes = NULL;
+        sqRing = cqRing = NULL;
+        if (ringFd >= 0) close(ringFd);
+        ringFd = -1;
+    }
+
+    const char *getName() const { return "io_uring"; }
+
+private:
+    char *mapRing(size_t size, off_t offset) {
+        void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, offset);
+        return p == MAP_FAILED ? NULL : (char *)p;
+    }
+
+    int ringFd;
+    char *sqRing;
+    char *cqRing;
+    struct io_uring_sqe *sqes;
+    size_t sqRingSize, cqRingSize, sqesSize;
+
+    unsigned *sqTail, *sqMask, *sqArray;
+    unsigned *cqHead, *cqTail, *cqMask;
+    struct io_uring_cqe *cqes;
+
+    std::vector<struct iovec> iovecs;
+    unsigned unsubmitted;
+};
+#endif // HAVE_IO_URING
+
+/**
+ * Reads with pread() on a pool of threads, one per read in flight.
+ */
+class ThreadPoolReadEngine : public AsyncReadEngine {
+public:
+    static const size_t MAX_THREADS = 32;
+
+    ThreadPoolReadEngine() : stopping(false) {
+        pthread_mutex_init(&lock, NULL);
+        pthread_cond_init(&requestReady, NULL);
+        pthread_cond_init(&readDone, NULL);
+    }
+
+    ~ThreadPoolReadEngine() {
+        stop();
+        pthread_cond_destroy(&readDone);
+        pthread_cond_destroy(&requestReady);
+        pthread_mutex_destroy(&lock);
+    }
+
+    bool start(size_t depth) {
+        stop();
+        stopping = false;
+        const size_t numThreads = depth < MAX_THREADS ? depth : MAX_THREADS;
+        for (size_t i = 0; i < numThreads; i++) {
+            pthread_t t;
+            if (pthread_create(&t, NULL, workerMain, this) != 0) break;
+            threads.push_back(t);
+        }
+        return !threads.empty();
+    }
+
+    void read(int fd, char *buf, size_t len, off_t off, size_t tag) {
+        Request r = { fd, buf, len, off, tag, 0 };
+        pthread_mutex_lock(&lock);
+        requests.push_back(r);
+        pthread_cond_signal(&requestReady);
+        pthread_mutex_unlock(&lock);
+    }
+
+    bool flush() { return true; }
+
+    bool wait(size_t &tag, ssize_t &result) {
+        pthread_mutex_lock(&lock);
+        while (done.empty()) {
+            pthread_cond_wait(&readDone, &lock);
+        }
+        tag = done.front().tag;
+        result = done.front().result;
+        done.pop_front();
+        pthread_mutex_unlock(&lock);
+        return true;
+    }
+
+    /** Stop the threads, once they have finished the reads they have started */
+    void stop() {
+        pthread_mutex_lock(&lock);
+        stopping = true;
+        pthread_cond_broadcast(&requestReady);
+        pthread_mutex_unlock(&lock);
+        for (size_t i = 0; i < threads.size(); i++) {
+            pthread_join(threads[i], NULL);
+        }
+        threads.clear();
+        requests.clear();
+        done.clear();
+    }
+
+    const char *getName() const { return "thread pool"; }
+
+private:
+    struct Request {
+        int fd;
+        char *buf;
+        size_t len;
+        off_t off;
+        size_t tag;
+        ssize_t result;
+    };
+
+    static void *workerMain(void *arg) {
+        ThreadPoolReadEngine *pool = (ThreadPoolReadEngine *)arg;
+        pthread_mutex_lock(&pool->lock);
+        while (true) {
+            while (pool->requests.empty() && !pool->stopping) {
+                pthread_cond_wait(&pool->requestReady, &pool->lock);
+            }
+            if (pool->stopping) break;
+            Request r = pool->requests.front();
+            pool->requests.pop_front();
+            pthread_mutex_unlock(&pool->lock);
+
+            do {
+                r.result = pread(r.fd, r.buf, r.len, r.off);
+            } while (r.result < 0 && errno == EINTR);
+            if (r.result < 0) r.result = -errno;
+
+            pthread_mutex_lock(&pool->lock);
+            pool->done.push_back(r);
+            pthread_cond_signal(&pool->readDone);
+        }
+        pthread_mutex_unlock(&pool->lock);
+        return NULL;
+    }
+
+    pthread_mutex_t lock;
+    pthread_cond_t requestReady;
+    pthread_cond_t readDone;
+    bool stopping;
+    std::vector<pthread_t> threads;
+    std::deque<Request> requests;
+    std::deque<Request> done;
+};
+
+#endif // ASYNC_READ_ENGINE_H_
@@ -0,0 +1,258 @@
+/* Copyright (c) 2005 - 2016 Hewlett Packard Enterprise Development LP  -*- C++ -*-*/
+/****************************
+ * Vertica Analytic Database
+ *
+ * UDL helper; a bounded queue of fixed-size data blocks, for handing
+ * data from a background producer thread to a UDx.
+ *
+ ****************************/
+
+#include <pthread.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/time.h>
+#include <string>
+#include <vector>
+#include <deque>
+
+#ifndef BLOCK_QUEUE_H_
+#define BLOCK_QUEUE_H_
+
+/**
+ * A block of data in a BlockQueue.
+ * `data` points at `capacity` bytes, of which the first `size` are valid.
+ */
+struct QueueBlock {
+    char *data;
+    size_t size;
+    size_t capacity;
+};
+
+/**
+ * BlockQueue
+ *
+ * A bounded single-producer, single-consumer queue of pre-allocated
+ * blocks.  The producer takes empty blocks from the free list, fills
+ * them and pushes them; the consumer pops full blocks and hands them
+ * back to the free list once it is done with them.  No memory is
+ * allocated after init(), and the producer blocks (and so stops
+ * reading) once all blocks are full.
+ *
+ * The consumer side never blocks for longer than the timeout it asks
+ * for, so it can be driven from a UDx's process() method.
+ */
+class BlockQueue {
+public:
+    BlockQueue() : producerDone(false), cancelled(false) {
+        pthread_mutex_init(&lock, NULL);
+        pthread_cond_init(&notFull, NULL);
+        pthread_cond_init(&notEmpty, NULL);
+    }
+
+    ~BlockQueue() {
+        pthread_cond_destroy(&notEmpty);
+        pthread_cond_destroy(&notFull);
+        pthread_mutex_destroy(&lock);
+    }
+
+    /**
+     * Carve `memory` (which must be at least numBlocks * blockSize bytes,
+     * and must outlive the queue) into numBlocks free blocks.
+     */
+    void init(char *memory, size_t numBlocks, size_t blockSize) {
+        blocks.resize(numBlocks);
+        free.clear();
+        full.clear();
+        for (size_t i = 0; i < numBlocks; i++) {
+            blocks[i].data = memory + i * blockSize;
+            blocks[i].size = 0;
+            blocks[i].capacity = blockSize;
+            free.push_back(&blocks[i]);
+        }
+        producerDone = false;
+        cancelled = false;
+        error.clear();
+    }
+
+    // Producer side
+
+    /**
+     * Wait for an empty block.
+     * Returns NULL if the consumer has cancelled the queue.
+     */
+    QueueBlock *getFreeBlock() {
+        pthread_mutex_lock(&lock);
+        while (free.empty() && !cancelled) {
+            pthread_cond_wait(&notFull, &lock);
+        }
+        QueueBlock *b = NULL;
+        if (!cancelled) {
+            b = free.front();
+            free.pop_front();
+            b->size = 0;
+        }
+        pthread_mutex_unlock(&lock);
+        return b;
+    }
+
+    /** Hand a filled block to the consumer */
+    void pushFullBlock(QueueBlock *b) {
+        pthread_mutex_lock(&lock);
+        full.push_back(b);
+        pthread_cond_signal(&notEmpty);
+        pthread_mutex_unlock(&lock);
+    }
+
+    /**
+     * Declare that no more blocks will be pushed.
+     * A non-empty `errorMessage` indicates that the producer failed.
+     */
+    void finish(const std::string &errorMessage = "") {
+        pthread_mutex_lock(&lock);
+        producerDone = true;
+        error = errorMessage;
+        pthread_cond_signal(&notEmpty);
+        pthread_mutex_unlock(&lock);
+    }
+
+    // Consumer side
+
+    /**
+     * Get the next full block, waiting at most timeoutUs microseconds
+     * for one to arrive.
+     * Returns NULL if there is none yet, or if the producer is done;
+     * check isDrained() to tell the two apart.
+     */
+    QueueBlock *getFullBlock(long timeoutUs) {
+        pthread_mutex_lock(&lock);
+        if (full.empty() && !producerDone && timeoutUs > 0) {
+            struct timeval now;
+            gettimeofday(&now, NULL);
+            struct timespec deadline;
+            long usec = now.tv_usec + timeoutUs;
+            deadline.tv_sec = now.tv_sec + usec / 1000000;
+            deadline.tv_nsec = (usec % 1000000) * 1000;
+            while (full.empty() && !producerDone) {
+                if (pthread_cond_timedwait(&notEmpty, &lock, &deadline) == ETIMEDOUT) break;
+            }
+        }
+        QueueBlock *b = NULL;
+        if (!full.empty()) {
+            b = full.front();
+            full.pop_front();
+        }
+        pthread_mutex_unlock(&lock);
+        return b;
+    }
+
+    /** Return a block obtained from getFullBlock() to the free list */
+    void releaseBlock(QueueBlock *b) {
+        pthread_mutex_lock(&lock);
+        free.push_back(b);
+        pthread_cond_signal(&notFull);
+        pthread_mutex_unlock(&lock);
+    }
+
+    /** True once the producer is done and every full block has been taken */
+    bool isDrained() {
+        pthread_mutex_lock(&lock);
+        bool drained = producerDone && full.empty();
+        pthread_mutex_unlock(&lock);
+        return drained;
+    }
+
+    /** The producer's error message, if it failed; empty otherwise */
+    std::string getError() {
+        pthread_mutex_lock(&lock);
+        std::string e = error;
+        pthread_mutex_unlock(&lock);
+        return e;
+    }
+
+    /** Tell the producer to stop; wakes it up if it is waiting for a block */
+    void cancel() {
+        pthread_mutex_lock(&lock);
+        cancelled = true;
+        pthread_cond_broadcast(&notFull);
+        pthread_mutex_unlock(&lock);
+    }
+
+    bool isCancelled() {
+        pthread_mutex_lock(&lock);
+        bool c = cancelled;
+        pthread_mutex_unlock(&lock);
+        return c;
+    }
+
+private:
+    std::vector<QueueBlock> blocks;
+    std::deque<QueueBlock*> free;
+    std::deque<QueueBlock*> full;
+
+    bool producerDone;
+    bool cancelled;
+    std::string error;
+
+    pthread_mutex_t lock;
+    pthread_cond_t notFull;
+    pthread_cond_t notEmpty;
+};
+
+/**
+ * BlockQueueWriter
+ *
+ * Producer-side stream interface on top of a BlockQueue.  Copies
+ * arbitrary-sized writes into queue blocks, and pushes each block
+ * once it is full (or when flush() is called).
+ */
+class BlockQueueWriter {
+public:
+    BlockQueueWriter(BlockQueue &queue) : queue(queue), current(NULL) {}
+
+    /**
+     * Write `n` bytes from buf to the queue, waiting for free blocks
+     * as needed.
+     *
+     * Returns `n`, or a smaller value if the queue was cancelled,
+     * in which case the producer should stop.
+     */
+    size_t write(const void *buf, size_t n) {
+        const char *src = (const char *)buf;
+        size_t written = 0;
+        while (written < n) {
+            if (current == NULL) {
+                current = queue.getFreeBlock();
+                if (current == NULL) break;  // Cancelled
+            }
+            size_t len = n - written;
+            if (len > current->capacity - current->size) len = current->capacity - current->size;
+            memcpy(current->data + current->size, src + written, len);
+            current->size += len;
+            written += len;
+            if (current->size == current->capacity) flush();
+        }
+        return written;
+    }
+
+    /** Push out the current partially-filled block, if any */
+    void flush() {
+        if (current == NULL) return;
+        if (current->size > 0) {
+            queue.pushFullBlock(current);
+        } else {
+            queue.releaseBlock(current);
+        }
+        current = NULL;
+    }
+
+    /** True if the consumer has asked the producer to stop */
+    bool isCancelled() {
+        return queue.isCancelled();
+    }
+
+private:
+    BlockQueue &queue;
+    QueueBlock *current;
+};
+
+#endif // BLOCK_QUEUE_H_
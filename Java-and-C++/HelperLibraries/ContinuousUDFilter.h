@@ -172,6 +172,9 @@ public:
         this->srvInterface = &srvInterface;
 
         c.initializeNewContext(&getServerInterface());
+        c.counters.reset();
+        c.counters.enabled = LoadCounters::isRequested(srvInterface);
+        c.tracer.start(srvInterface, "ContinuousUDFilter");
 
         initialize(srvInterface);
 
@@ -186,6 +189,11 @@ public:
     // Wrap UDFilter::destroy(); we have some tear-down of our own to do
     void destroy(Vertica::ServerInterface &srvInterface) {
         this->srvInterface = &srvInterface;
+        if (c.counters.enabled) {
+            c.counters.log(srvInterface, "ContinuousUDFilter",
+                           cr.getBytesConsumed(), cw.getBytesConsumed());
+        }
+        c.tracer.finish(srvInterface);
         deinitialize(srvInterface);
         this->srvInterface = NULL;
         state = CLOSED;
@@ -234,11 +242,13 @@ public:
 
         if (this->cr.needInput) {
             this->cr.needInput = false;
+            c.counters.inputNeeded++;
             return Vertica::INPUT_NEEDED;
         }
 
         if (this->cw.needInput) {
             this->cw.needInput = false;
+            c.counters.outputNeeded++;
             return Vertica::OUTPUT_NEEDED;
         }
 
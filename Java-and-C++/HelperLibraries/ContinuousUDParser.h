@@ -114,6 +114,16 @@ protected:
         c.switchBack();
     }
 
+    /**
+     * Emit the row that has been built up on the StreamWriter.
+     * Equivalent to writer->next(), but also keeps the load counters
+     * up to date; prefer it over calling writer->next() directly.
+     */
+    void emitRow() {
+        writer->next();
+        c.counters.rowsEmitted++;
+    }
+
     /**
      * ContinuousReader
      * Houses methods relevant to reading raw binary buffers
@@ -165,6 +175,10 @@ private:
         REPORT_ERROR, // report_error() was called.  DOES NOT RETURN!
     } state;
 
+    /** What to return once all rows rejected by run() are delivered */
+    Vertica::StreamState deferredState;
+    bool haveDeferredState;
+
 protected:
     static int _ContinuousUDParserRunner(ContinuousUDParser *parser) {
         // Internal error, haven't set a parser but are trying to run it
@@ -199,7 +213,7 @@ public:
     // In particular, various members need access to our Coroutine.
     // Also, initialize POD types to
     ContinuousUDParser() : cr(c), crej(c), srvInterface(NULL),
-                           err_code(0) {}
+                           err_code(0), haveDeferredState(false) {}
 
     // Wrap UDParser::setup(); we have some initialization of our own to do
     void setup(Vertica::ServerInterface &srvInterface,
@@ -214,6 +228,11 @@ public:
         this->srvInterface = &srvInterface;
 
         c.initializeNewContext(&getServerInterface());
+        c.counters.reset();
+        c.counters.enabled = LoadCounters::isRequested(srvInterface);
+        c.tracer.start(srvInterface, "ContinuousUDParser");
+        crej.configure(srvInterface);
+        haveDeferredState = false;
 
         initialize(srvInterface, returnType);
 
@@ -231,6 +250,10 @@ public:
     void destroy(Vertica::ServerInterface &srvInterface,
             Vertica::SizedColumnTypes &returnType) {
         this->srvInterface = &srvInterface;
+        if (c.counters.enabled) {
+            c.counters.log(srvInterface, "ContinuousUDParser", cr.getBytesConsumed(), 0);
+        }
+        c.tracer.finish(srvInterface);
         deinitialize(srvInterface, returnType);
         this->srvInterface = NULL;
         state = CLOSED;
@@ -245,6 +268,17 @@ public:
      */
     Vertica::StreamState process(Vertica::ServerInterface &srvInterface,
             Vertica::DataBuffer &input, Vertica::InputState input_state) {
+        // Rows that run() rejected are delivered one per call, before
+        // anything else (including whatever run() last asked for)
+        if (crej.hasPendingRejects()) {
+            crej.deliverNextReject();
+            return Vertica::REJECT;
+        }
+        if (haveDeferredState) {
+            haveDeferredState = false;
+            return deferredState;
+        }
+
         // Capture the new state for this run
         // IMPORTANT:  It is unsafe to access any of these values outside of
         // this function call!
@@ -274,25 +308,38 @@ public:
         }
 
         // Propagate exception.
-        if (exception.get()) throw *exception;
+        // Rethrowing *exception would slice a udf_exception (such as the
+        // reject-rate circuit breaker's) down to std::exception and lose
+        // its message, so rethrow those the way ContinuousUDSource does.
+        if (exception.get()) {
+            udf_exception *e = dynamic_cast<udf_exception *>(exception.get());
+            if (e) {
+                Vertica::vt_throw_exception(e->errorcode, e->what(), e->filename, e->lineno);
+            }
+            throw *exception;
+        }
 
+        Vertica::StreamState result;
         if (this->cr.needInput) {
             this->cr.needInput = false;
-            return Vertica::INPUT_NEEDED;
+            c.counters.inputNeeded++;
+            result = Vertica::INPUT_NEEDED;
+        } else if (state == RUN_START) {
+            result = Vertica::KEEP_GOING;
+        } else {
+            // We should only be able to get here if we're finished
+            VIAssert(state == FINISHED);
+            result = Vertica::DONE;
         }
 
-        if (this->crej.haveRejectedRecord) {
-            this->crej.haveRejectedRecord = false;
+        // Hand over any rows that run() rejected first
+        if (crej.hasPendingRejects()) {
+            deferredState = result;
+            haveDeferredState = true;
+            crej.deliverNextReject();
             return Vertica::REJECT;
         }
-
-        if (state == RUN_START) {
-            return Vertica::KEEP_GOING;
-        }
-
-        // We should only be able to get here if we're finished
-        VIAssert(state == FINISHED);
-        return Vertica::DONE;
+        return result;
     }
 
     /** Returns information about the rejected record */
@@ -9,6 +9,7 @@
  ****************************/
 
 #include "CoroutineHelpers.h"
+#include "BlockQueue.h"
 
 #ifndef CONTINUOUSUDSOURCE_H_
 #define CONTINUOUSUDSOURCE_H_
@@ -54,6 +55,24 @@ public:
      */
     virtual void run() {}
 
+    /**
+     * ContinuousUDSource::runInBackground()
+     *
+     * Only used if enablePrefetch() was called from initialize().
+     * In that case run() is not called; instead, this method is run
+     * on a dedicated I/O thread, and should write all of its data to
+     * `out`.  Blocking reads and network waits here don't hold up
+     * the load: process() keeps handing the blocks that are already
+     * filled to the server in the meantime.
+     *
+     * This runs on a thread the server doesn't know about, so it must
+     * not call getServerInterface(), yield(), or any method on 'cw'.
+     * It should return as soon as out.write() returns a short count,
+     * which means the load was canceled.  Exceptions thrown here fail
+     * the load.
+     */
+    virtual void runInBackground(BlockQueueWriter &out) {}
+
     /**
      * ContinuousUDSource::deinitialize()
      *
@@ -85,6 +104,21 @@ protected:
         c.switchBack();
     }
 
+    /**
+     * Switch to background-prefetch mode: run runInBackground() on an
+     * I/O thread that fills up to numBlocks blocks of blockSize bytes
+     * ahead of the server, instead of calling run().
+     *
+     * Must be called from initialize().  The blocks are allocated once,
+     * up front.
+     */
+    void enablePrefetch(size_t numBlocks, size_t blockSize) {
+        VIAssert(numBlocks > 0 && blockSize > 0);
+        char *blocks = (char*)getServerInterface().allocator->alloc(numBlocks * blockSize);
+        prefetchQueue.init(blocks, numBlocks, blockSize);
+        prefetchEnabled = true;
+    }
+
     /**
      * ContinuousWriter
      * Houses methods relevant to writing raw binary buffers.
@@ -118,6 +152,11 @@ private:
 
     Coroutine c;
 
+    /** Background prefetch mode; see enablePrefetch() */
+    bool prefetchEnabled;
+    BlockQueue prefetchQueue;
+    pthread_t prefetchThread;
+
     /** State of the internal worker context */
     enum State
     {
@@ -151,15 +190,90 @@ protected:
      * set-up and tear-down for run()
      */
     void runHelper() {
-        run();
+        if (prefetchEnabled) {
+            runPrefetched();
+        } else {
+            run();
+        }
         state = FINISHED;
     }
 
+    /** How long process() waits for the I/O thread before yielding */
+    static const long PREFETCH_WAIT_US = 10000;
+
+    static void *_ContinuousUDSourcePrefetcher(void *arg) {
+        ContinuousUDSource *source = (ContinuousUDSource *)arg;
+        BlockQueueWriter out(source->prefetchQueue);
+        std::string error;
+        try {
+            source->runInBackground(out);
+            out.flush();
+        } catch (std::exception &e) {
+            error = e.what();
+            if (error.empty()) error = "Exception in background I/O thread";
+        } catch (...) {
+            error = "Unknown exception caught in background I/O thread";
+        }
+        source->prefetchQueue.finish(error);
+        return NULL;
+    }
+
+    /**
+     * run() replacement for prefetch mode.  Start the I/O thread, then
+     * copy the blocks it fills to the output as they arrive.  Whenever
+     * none is ready, wait a little for one (so that a source waiting on
+     * the network doesn't spin), then switch back to the server.
+     *
+     * If destroy() cancels the load, the exception it throws in here
+     * stops and joins the I/O thread before propagating.
+     */
+    void runPrefetched() {
+        int err = pthread_create(&prefetchThread, NULL, _ContinuousUDSourcePrefetcher, this);
+        if (err != 0) {
+            // vt_report_error() isn't usable inside the coroutine; throw directly
+            throw udf_exception(0, std::string("Could not start background I/O thread: ") + strerror(err),
+                                __FILE__, __LINE__);
+        }
+
+        try {
+            while (true) {
+                QueueBlock *b = prefetchQueue.getFullBlock(PREFETCH_WAIT_US);
+                if (b == NULL) {
+                    if (prefetchQueue.isDrained()) break;
+                    yield();
+                    continue;
+                }
+
+                // Output blocks may be smaller than ours; copy what fits
+                size_t copied = 0;
+                while (copied < b->size) {
+                    cw.reserve(1);
+                    size_t len = b->size - copied;
+                    if (len > cw.capacity()) len = cw.capacity();
+                    memcpy(cw.getDataPtr(), b->data + copied, len);
+                    cw.seek(len);
+                    copied += len;
+                }
+                prefetchQueue.releaseBlock(b);
+            }
+        } catch (...) {
+            prefetchQueue.cancel();
+            pthread_join(prefetchThread, NULL);
+            throw;
+        }
+
+        pthread_join(prefetchThread, NULL);
+        const std::string error = prefetchQueue.getError();
+        if (!error.empty()) {
+            throw udf_exception(0, "Background I/O thread failed: " + error, __FILE__, __LINE__);
+        }
+    }
+
 public:
     // Constructor.  Initialize stuff properly.
     // In particular, various members need access to our Coroutine.
     // Also, initialize POD types to
-    ContinuousUDSource() : cw(c), srvInterface(NULL) {}
+    ContinuousUDSource() : cw(c), srvInterface(NULL), prefetchEnabled(false) {}
 
     // Wrap UDParser::setup(); we have some initialization of our own to do
     void setup(Vertica::ServerInterface &srvInterface) {
@@ -173,6 +287,10 @@ public:
         this->srvInterface = &srvInterface;
 
         c.initializeNewContext(&getServerInterface());
+        c.counters.reset();
+        c.counters.enabled = LoadCounters::isRequested(srvInterface);
+        c.tracer.start(srvInterface, "ContinuousUDSource");
+        prefetchEnabled = false;
 
         initialize(srvInterface);
 
@@ -205,6 +323,10 @@ public:
         // If the run() method didn't return after we threw the exception, 
         //   shut down the UDx with a failed assertion
         VIAssert(state == FINISHED || state == ABORTED);
+        if (c.counters.enabled) {
+            c.counters.log(srvInterface, "ContinuousUDSource", 0, cw.getBytesConsumed());
+        }
+        c.tracer.finish(srvInterface);
         deinitialize(srvInterface);
         this->srvInterface = NULL;
         state = CLOSED;
@@ -250,6 +372,7 @@ public:
 
         if (this->cw.needInput) {
             this->cw.needInput = false;
+            c.counters.outputNeeded++;
             return Vertica::OUTPUT_NEEDED;
         }
 
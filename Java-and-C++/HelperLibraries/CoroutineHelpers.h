@@ -12,8 +12,20 @@
 #endif
 
 #include <ucontext.h>
+#include <time.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/syscall.h>
 #include <memory>
 #include <exception>
+#include <string>
+#include <vector>
+#include <map>
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#endif
 
 #include "Vertica.h"
 #include "UdfException.h"
@@ -30,6 +42,275 @@ using Vertica::int64;
 #include "Session/ThreadDebugContext.h"
 #endif
 
+/**
+ * Read a cheap, monotonically-increasing cycle counter.
+ * Uses the TSC where one is available; elsewhere, falls back to a
+ * nanosecond-resolution monotonic clock.
+ */
+inline uint64_t readCycleCounter() {
+#if defined(__i386__) || defined(__x86_64__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/**
+ * LoadCounters
+ *
+ * Cheap instrumentation counters for the Continuous* UDL wrappers.
+ * The plain counters are always maintained (they are single increments
+ * on paths that already do far more work).  Cycle accounting and the
+ * summary log line are only enabled when the UDx is invoked with
+ * the boolean parameter named by LoadCounters::paramName(), e.g.:
+ *
+ *   COPY t FROM ... PARSER ExampleDelimitedParser(load_counters=true);
+ *
+ * Factories whose UDxs derive from the Continuous* wrappers should
+ * declare that parameter via LoadCounters::addParameterType().
+ *
+ * rowsEmitted only counts rows emitted with ContinuousUDParser::emitRow();
+ * a parser that calls writer->next() itself reports 0.
+ */
+struct LoadCounters {
+    LoadCounters() : enabled(false) { reset(); }
+
+    void reset() {
+        rowsEmitted = rowsRejected = 0;
+        reserveCalls = switches = 0;
+        inputNeeded = outputNeeded = 0;
+        cyclesInRun = cyclesOutsideRun = 0;
+        lastSwitchOut = 0;
+    }
+
+    /** Name of the UDx parameter that turns on timing and logging */
+    static const char *paramName() { return "load_counters"; }
+
+    /** Declare the load_counters parameter on a factory */
+    static void addParameterType(Vertica::SizedColumnTypes &parameterTypes) {
+        parameterTypes.addBool(paramName());
+    }
+
+    /** Was the load_counters parameter passed, and set to true? */
+    static bool isRequested(Vertica::ServerInterface &srvInterface) {
+        Vertica::ParamReader &params = srvInterface.getParamReader();
+        return params.containsParameter(paramName())
+            && params.getBoolRef(paramName()) == Vertica::vbool_true;
+    }
+
+    /**
+     * Emit all counters as a single structured line to the UDx log.
+     * `bytesIn` and `bytesOut` are tracked by the input and output
+     * streamers; pass 0 for a side that doesn't exist.
+     */
+    void log(Vertica::ServerInterface &srvInterface, const char *udxType,
+             uint64_t bytesIn, uint64_t bytesOut) const {
+        srvInterface.log("load_counters: udx=%s bytes_in=%llu bytes_out=%llu"
+                " rows_emitted=%llu rows_rejected=%llu reserve_calls=%llu"
+                " switches=%llu input_needed=%llu output_needed=%llu"
+                " cycles_in_run=%llu cycles_outside_run=%llu",
+                udxType, (unsigned long long)bytesIn, (unsigned long long)bytesOut,
+                (unsigned long long)rowsEmitted, (unsigned long long)rowsRejected,
+                (unsigned long long)reserveCalls, (unsigned long long)switches,
+                (unsigned long long)inputNeeded, (unsigned long long)outputNeeded,
+                (unsigned long long)cyclesInRun, (unsigned long long)cyclesOutsideRun);
+    }
+
+    /** If false, cycles are not measured and nothing is logged */
+    bool enabled;
+
+    uint64_t rowsEmitted;
+    uint64_t rowsRejected;
+    uint64_t reserveCalls;
+    uint64_t switches;          // Switches into the run() coroutine
+    uint64_t inputNeeded;       // INPUT_NEEDED returned to the server
+    uint64_t outputNeeded;      // OUTPUT_NEEDED returned to the server
+    uint64_t cyclesInRun;       // Spent inside the run() coroutine
+    uint64_t cyclesOutsideRun;  // Spent in the server between process() calls
+
+    // Cycle counter reading taken the last time run() switched back
+    uint64_t lastSwitchOut;
+};
+
+/**
+ * Kinds of events recorded by CoroutineTracer
+ */
+enum TraceEventType {
+    TRACE_SWITCH_IN,        // process() switched into run()
+    TRACE_SWITCH_OUT,       // run() switched back to process()
+    TRACE_RESERVE_BLOCKED,  // reserve() had to go back to the server for more data
+    TRACE_CHUNK_ALIGNED,    // A chunker found a record-aligned chunk boundary
+    TRACE_REJECT,           // A row was rejected
+};
+
+// @cond INTERNAL
+struct TraceEvent {
+    uint64_t timestampNs;
+    const char *stage;
+    const void *instance;
+    TraceEventType type;
+};
+
+/**
+ * Per-thread ring of trace events.
+ *
+ * Each ring is only ever written to and read from by the thread that
+ * owns it, so recording an event is a couple of plain stores with no
+ * locking.  When the ring is full, the oldest events are overwritten.
+ */
+struct TraceRing {
+    static const size_t CAPACITY = 1 << 16;  // Power of two
+
+    TraceRing(const std::string &dir) : written(0), users(0), dir(dir) {}
+
+    void push(const char *stage, const void *instance, TraceEventType type) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        TraceEvent &e = events[written & (CAPACITY - 1)];
+        e.timestampNs = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+        e.stage = stage;
+        e.instance = instance;
+        e.type = type;
+        written++;
+    }
+
+    /**
+     * Write the ring out as a Chrome trace_event JSON file, loadable
+     * in chrome://tracing or Perfetto.  Returns the file name, or the
+     * empty string if the file couldn't be written.
+     */
+    std::string dump() {
+        static __thread unsigned dumpSeq = 0;
+        const long tid = syscall(SYS_gettid);
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/udx_trace_%d_%ld_%u.json",
+                 dir.c_str(), (int)getpid(), tid, dumpSeq++);
+
+        FILE *f = fopen(path, "w");
+        if (f == NULL) return std::string();
+
+        fprintf(f, "{\"traceEvents\":[\n");
+        fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%ld,"
+                "\"args\":{\"name\":\"UDx thread %ld\"}}", (int)getpid(), tid, tid);
+
+        const uint64_t first = written > CAPACITY ? written - CAPACITY : 0;
+        for (uint64_t i = first; i < written; i++) {
+            const TraceEvent &e = events[i & (CAPACITY - 1)];
+            const char *name, *ph;
+            switch (e.type) {
+            case TRACE_SWITCH_IN:       name = "run"; ph = "B"; break;
+            case TRACE_SWITCH_OUT:      name = "run"; ph = "E"; break;
+            case TRACE_RESERVE_BLOCKED: name = "reserve-blocked"; ph = "i"; break;
+            case TRACE_CHUNK_ALIGNED:   name = "chunk-aligned"; ph = "i"; break;
+            case TRACE_REJECT:          name = "reject"; ph = "i"; break;
+            default:                    name = "unknown"; ph = "i"; break;
+            }
+            fprintf(f, ",\n{\"name\":\"%s %s\",\"cat\":\"%s\",\"ph\":\"%s\",%s"
+                    "\"ts\":%llu.%03u,\"pid\":%d,\"tid\":%ld,\"args\":{\"instance\":\"%p\"}}",
+                    e.stage, name, e.stage, ph, (ph[0] == 'i' ? "\"s\":\"t\"," : ""),
+                    (unsigned long long)(e.timestampNs / 1000), (unsigned)(e.timestampNs % 1000),
+                    (int)getpid(), tid, e.instance);
+        }
+        fprintf(f, "\n]}\n");
+        fclose(f);
+        return std::string(path);
+    }
+
+    TraceEvent events[CAPACITY];
+    uint64_t written;   // Total number of events ever pushed
+    int users;          // Number of traced UDx instances on this thread
+    std::string dir;    // Where to write the trace at teardown
+};
+
+/**
+ * CoroutineTracer
+ *
+ * Opt-in timeline tracing for UDL stages.  Aggregate counters (see
+ * LoadCounters) can't show when a stage was starved or stalled; this
+ * records a timestamped event for each coroutine switch, blocked
+ * reserve(), aligned chunk and rejected row.
+ *
+ * Tracing is enabled by passing the UDx parameter named by
+ * CoroutineTracer::paramName() (a directory).  Every traced UDx
+ * running on a thread shares that thread's TraceRing, so source,
+ * filter, chunker and parser events end up on one timeline.  When the
+ * last traced UDx on a thread is destroyed, the ring is written to
+ * that directory as a Chrome trace_event JSON file.
+ *
+ * Assumes, as Vertica does, that a UDx instance's setup(), process()
+ * and destroy() calls all happen on the same thread.
+ */
+class CoroutineTracer {
+public:
+    CoroutineTracer() : ring(NULL), stage("") {}
+
+    /** Name of the UDx parameter that names the trace output directory */
+    static const char *paramName() { return "trace_dir"; }
+
+    /** Declare the trace_dir parameter on a factory */
+    static void addParameterType(Vertica::SizedColumnTypes &parameterTypes) {
+        parameterTypes.addVarchar(4096, paramName());
+    }
+
+    /**
+     * Start tracing this UDx instance if trace_dir was specified.
+     * `stage` must be a string literal; it labels this instance's events.
+     */
+    void start(Vertica::ServerInterface &srvInterface, const char *stage) {
+        finish(srvInterface);
+        this->stage = stage;
+
+        Vertica::ParamReader &params = srvInterface.getParamReader();
+        if (!params.containsParameter(paramName())) return;
+        const std::string dir = params.getStringRef(paramName()).str();
+        if (dir.empty()) return;
+
+        TraceRing *&threadRing = currentThreadRing();
+        if (threadRing == NULL) {
+            threadRing = new TraceRing(dir);
+        }
+        ring = threadRing;
+        ring->users++;
+    }
+
+    /** Record an event.  A no-op unless tracing was started. */
+    void record(TraceEventType type) {
+        if (ring) ring->push(stage, this, type);
+    }
+
+    /**
+     * Stop tracing this UDx instance.  If it was the last traced
+     * instance on this thread, write out and free the thread's ring.
+     */
+    void finish(Vertica::ServerInterface &srvInterface) {
+        if (ring == NULL) return;
+        VIAssert(ring == currentThreadRing());
+
+        if (--ring->users == 0) {
+            const std::string path = ring->dump();
+            if (path.empty()) {
+                srvInterface.log("trace: could not write trace file to directory [%s]", ring->dir.c_str());
+            } else {
+                srvInterface.log("trace: wrote %s", path.c_str());
+            }
+            delete ring;
+            currentThreadRing() = NULL;
+        }
+        ring = NULL;
+    }
+
+private:
+    static TraceRing *&currentThreadRing() {
+        static __thread TraceRing *threadRing = NULL;
+        return threadRing;
+    }
+
+    TraceRing *ring;
+    const char *stage;
+};
+
 // Can only pass integer args to makecontext. This code wrapes a pointer
 // into two integer args in a very non portable way.
 // @cond INTERNAL
@@ -110,8 +391,24 @@ public:
 #ifdef VERTICA_INTERNAL
         Session::ThreadDebugContext::StackSetter ss((char *)stack, stacksize);
 #endif
+        counters.switches++;
+        tracer.record(TRACE_SWITCH_IN);
+        uint64_t switchIn = 0;
+        if (counters.enabled) {
+            switchIn = readCycleCounter();
+            if (counters.lastSwitchOut) {
+                counters.cyclesOutsideRun += switchIn - counters.lastSwitchOut;
+            }
+        }
+
         int stat = swapcontext(&ccontext, &pcontext);
         VIAssert(stat == 0);
+
+        if (counters.enabled) {
+            counters.lastSwitchOut = readCycleCounter();
+            counters.cyclesInRun += counters.lastSwitchOut - switchIn;
+        }
+        tracer.record(TRACE_SWITCH_OUT);
     }
 
     /**
@@ -173,6 +470,10 @@ public:
     // @cond: INTERNAL
     std::exception * coroutine_exception;
 
+    /** Instrumentation shared by everything that talks to this coroutine */
+    LoadCounters counters;
+    CoroutineTracer tracer;
+
     // Part of an x86_64-specific hack used by Coroutine to work around
     // makecontext() being limited to 32-bit pointers by taking two pairs
     // of 32-bit pointer parts and convert them into a pair of 64-bit pointers.
@@ -249,6 +550,7 @@ public:
      * Check capacity to see how many bytes were reserved.
      */
     size_t reserve(size_t size) {
+        c.counters.reserveCalls++;
         while (1) {
             lastReservationSize = size < capacity() ? size : capacity();
             // Break at EOF or if we have enough.
@@ -265,6 +567,7 @@ public:
             if (*state == Vertica::END_OF_CHUNK && lastReservationSize > 0) break;
             // Switch context to get more input.
             needInput = true;
+            c.tracer.record(TRACE_RESERVE_BLOCKED);
             c.switchBack();
         }
         return lastReservationSize;
@@ -479,35 +782,255 @@ public:
         memcpy(getDataPtr(), buf, reserved);
         return seek(reserved);
     }
+
+    /**
+     * Forwards the next `n` bytes of `cr` to the output stream unchanged,
+     * consuming them from `cr`.
+     *
+     * Returns the number of bytes forwarded, which is less than `n` only
+     * if `cr` reached end-of-file first.
+     *
+     * Unlike write(), this doesn't go through a caller-side buffer or
+     * reserve a fixed amount: each step copies as much as is currently
+     * available in both the input and the output block, with a single
+     * memcpy().  Filters that only change a few bytes of their input
+     * should use this for the unchanged ranges in between.
+     *
+     * Like write(), passthrough() invalidates getDataPtr() on both
+     * streams.
+     */
+    size_t passthrough(ContinuousReader &cr, size_t n) {
+        size_t forwarded = 0;
+        while (forwarded < n) {
+            // Make sure both streams have at least one byte available;
+            // either may switch out to the server to get it
+            if (reserve(1) == 0) break;
+            if (cr.reserve(1) == 0) break;
+
+            size_t len = n - forwarded;
+            if (len > cr.capacity()) len = cr.capacity();
+            if (len > capacity()) len = capacity();
+
+            memcpy(getDataPtr(), cr.getDataPtr(), len);
+            cr.seek(len);
+            seek(len);
+            forwarded += len;
+        }
+        return forwarded;
+    }
 };
 
+/**
+ * ContinuousRejecter
+ *
+ * Rejects rows on behalf of a ContinuousUDParser.
+ *
+ * Rejected rows are buffered rather than handed to the server one at a
+ * time: reject() copies the row and returns immediately, and the
+ * parser delivers the buffered rows the next time run() switches back
+ * to the server anyway (to get more input, or when it is done).  So
+ * rejecting a row doesn't cost a context switch.
+ *
+ * Reasons that are used over and over (typically one per column and
+ * kind of error) can be interned once with intern(), so that no
+ * message has to be built per rejected row.
+ *
+ * Optionally, a reject-rate circuit breaker (see addParameterType())
+ * fails the load as soon as too large a fraction of rows is rejected,
+ * rather than grinding through a bad file.
+ */
 class ContinuousRejecter {
 private:
     // Disable the copy constructor -- must pass by reference
     ContinuousRejecter(ContinuousRejecter &cs) : c(cs.c) { VAssert(false); }
 
 public:
+    /** Handle for a string registered with intern() */
+    typedef size_t InternedString;
+
     /**
      * CoroutineRejecter constructor
      * Capture a Coroutine instance to let us communicate with the server
      */
-    ContinuousRejecter(Coroutine &c) : haveRejectedRecord(false), c(c) {}
+    ContinuousRejecter(Coroutine &c)
+        : nextPending(0), maxRejectRate(1.0), minRowsForRejectRate(0), c(c) {}
+
+    /** Parameter names for the reject-rate circuit breaker */
+    static const char *maxRateParamName() { return "reject_max_rate"; }
+    static const char *minRowsParamName() { return "reject_min_rows"; }
+
+    /**
+     * Declare the circuit-breaker parameters on a parser factory:
+     * - reject_max_rate: fail the load once more than this fraction
+     *   (0.0 - 1.0) of the rows seen so far have been rejected
+     * - reject_min_rows: don't apply reject_max_rate until at least this
+     *   many rows have been seen (default 1000)
+     *
+     * Rows seen are the rows rejected plus the rows emitted with
+     * ContinuousUDParser::emitRow(); a parser that calls writer->next()
+     * itself looks as if it rejected everything, so it must not offer
+     * these parameters.
+     */
+    static void addParameterType(Vertica::SizedColumnTypes &parameterTypes) {
+        parameterTypes.addFloat(maxRateParamName());
+        parameterTypes.addInt(minRowsParamName());
+    }
+
+    /**
+     * Read the circuit-breaker parameters, and drop any rows still
+     * buffered from a previous use of this object
+     */
+    void configure(Vertica::ServerInterface &srvInterface) {
+        pending.clear();
+        arena.clear();
+        nextPending = 0;
+
+        Vertica::ParamReader &params = srvInterface.getParamReader();
+        maxRejectRate = params.containsParameter(maxRateParamName())
+                ? params.getFloatRef(maxRateParamName()) : 1.0;
+        minRowsForRejectRate = params.containsParameter(minRowsParamName())
+                ? params.getIntRef(minRowsParamName()) : 1000;
+    }
+
+    /**
+     * Register a reject reason (or record terminator) for use with the
+     * reject() overload below.  Interning the same string again returns
+     * the same handle.
+     */
+    InternedString intern(const std::string &str) {
+        std::map<std::string, InternedString>::iterator it = internIndex.find(str);
+        if (it != internIndex.end()) return it->second;
+
+        const InternedString handle = internedStrings.size();
+        internedStrings.push_back(str);
+        internIndex[str] = handle;
+        return handle;
+    }
+
+    /**
+     * Request that Vertica process `length` bytes at `data` as a
+     * rejected row, with the error message `reason`, delimited by
+     * `terminator`.  The row is copied, so `data` only needs to stay
+     * valid for the duration of this call.
+     */
+    void reject(InternedString reason, const void *data, size_t length, InternedString terminator) {
+        PendingReject p;
+        p.reason = reason;
+        p.reasonOffset = p.reasonLength = 0;
+        p.terminator = terminator;
+        p.dataOffset = append(data, length);
+        p.dataLength = length;
+        queue(p);
+    }
 
     /**
      * Request that Vertica process the current raw data as a rejected row.
      * Emit the rejected row via the rejected-rows mechanism specified in
      * the COPY statement, with the error message specified by `reason`,
      * and delimited by the record terminator specified by `recordTerminator`.
+     *
+     * The message is copied for every row; prefer intern() and the other
+     * overload for reasons that repeat.
      */
     void reject(const Vertica::RejectedRecord &rr) {
-        rejectedRecord = rr;
-        haveRejectedRecord = true;
-        c.switchBack();
+        PendingReject p;
+        p.reason = NOT_INTERNED;
+        p.terminator = intern(rr.terminator);
+        p.dataOffset = append(rr.data, rr.length);
+        p.dataLength = rr.length;
+        p.reasonOffset = append(rr.reason.data(), rr.reason.size());
+        p.reasonLength = rr.reason.size();
+        queue(p);
+    }
+
+    /// @cond INTERNAL
+    bool hasPendingRejects() const {
+        return nextPending < pending.size();
+    }
+
+    /// @cond INTERNAL
+    /**
+     * Make the next buffered row the one returned by getRejectedRecord().
+     * Its data stays valid until run() is resumed.
+     */
+    void deliverNextReject() {
+        const PendingReject &p = pending[nextPending++];
+        rejectedRecord.reason = (p.reason == NOT_INTERNED)
+                ? std::string(&arena[p.reasonOffset], p.reasonLength)
+                : internedStrings[p.reason];
+        rejectedRecord.data = p.dataLength ? &arena[p.dataOffset] : NULL;
+        rejectedRecord.length = p.dataLength;
+        rejectedRecord.terminator = internedStrings[p.terminator];
     }
 
 protected:
+    static const InternedString NOT_INTERNED = (InternedString)-1;
+
+    // Hand buffered rows to the server once there are this many of them,
+    // or once they take up this much memory, whichever comes first
+    static const size_t MAX_PENDING_REJECTS = 1024;
+    static const size_t MAX_PENDING_BYTES = 1024 * 1024;
+
+    /** A buffered rejected row; offsets are into `arena` */
+    struct PendingReject {
+        InternedString reason;
+        size_t reasonOffset, reasonLength;
+        size_t dataOffset, dataLength;
+        InternedString terminator;
+    };
+
+    size_t append(const void *data, size_t length) {
+        // Everything delivered so far has been consumed by the server by
+        // the time run() is rejecting rows again, so start over
+        if (nextPending > 0 && !hasPendingRejects()) {
+            pending.clear();
+            arena.clear();
+            nextPending = 0;
+        }
+        const size_t offset = arena.size();
+        arena.insert(arena.end(), (const char *)data, (const char *)data + length);
+        return offset;
+    }
+
+    void queue(const PendingReject &p) {
+        pending.push_back(p);
+        c.counters.rowsRejected++;
+        c.tracer.record(TRACE_REJECT);
+
+        checkRejectRate();
+
+        // Don't let the buffer grow without bound; switch out to
+        // deliver what we have
+        if (pending.size() >= MAX_PENDING_REJECTS || arena.size() >= MAX_PENDING_BYTES) {
+            c.switchBack();
+        }
+    }
+
+    void checkRejectRate() {
+        const uint64_t rejected = c.counters.rowsRejected;
+        const uint64_t seen = rejected + c.counters.rowsEmitted;
+        if (maxRejectRate < 1.0 && seen >= (uint64_t)minRowsForRejectRate
+                && rejected > maxRejectRate * seen) {
+            char msg[256];
+            snprintf(msg, sizeof(msg),
+                     "Rejected %llu of the first %llu rows, more than %s=%g allows; aborting load",
+                     (unsigned long long)rejected, (unsigned long long)seen,
+                     maxRateParamName(), maxRejectRate);
+            throw udf_exception(0, msg, __FILE__, __LINE__);
+        }
+    }
+
     Vertica::RejectedRecord rejectedRecord;
-    bool haveRejectedRecord;
+
+    std::vector<PendingReject> pending;
+    size_t nextPending;     // Index of the next row in `pending` to deliver
+    std::vector<char> arena;
+
+    std::vector<std::string> internedStrings;
+    std::map<std::string, InternedString> internIndex;
+
+    Vertica::vfloat maxRejectRate;
+    Vertica::vint minRowsForRejectRate;
 
     Coroutine &c;
 
@@ -0,0 +1,91 @@
+/* Copyright (c) 2005 - 2016 Hewlett Packard Enterprise Development LP  -*- C++ -*-*/
+/****************************
+ * Vertica Analytic Database
+ *
+ * UDL helper; sharing a set of files of different sizes out between
+ * nodes, so that each node gets about the same number of bytes.
+ *
+ ****************************/
+
+#include <stdint.h>
+#include <vector>
+#include <queue>
+#include <functional>
+#include <algorithm>
+
+#ifndef FILE_ASSIGNMENT_H_
+#define FILE_ASSIGNMENT_H_
+
+/** Bytes [offset, offset + size) of file number `file`, to be loaded by node number `node` */
+struct FileAssignment {
+    size_t file;
+    uint64_t offset;
+    uint64_t size;
+    size_t node;
+};
+
+struct FileAssignmentsBySize {
+    bool operator()(const FileAssignment &a, const FileAssignment &b) const {
+        if (a.size != b.size) return a.size > b.size;
+        if (a.file != b.file) return a.file < b.file;
+        return a.offset < b.offset;
+    }
+};
+
+struct FileAssignmentsByFile {
+    bool operator()(const FileAssignment &a, const FileAssignment &b) const {
+        return a.file != b.file ? a.file < b.file : a.offset < b.offset;
+    }
+};
+
+/**
+ * Assign files with the given sizes to `numNodes` nodes, largest first,
+ * each to the node with the fewest bytes so far ("longest processing
+ * time first").  This keeps the nodes much closer to even than handing
+ * the files out in turn, when a few files are much bigger than the rest.
+ *
+ * With `splitLargeFiles`, a file bigger than a node's fair share of the
+ * total is first cut into pieces of that size (plus what's left over),
+ * which are then assigned like files; smaller files are never split.
+ *
+ * The result depends only on the arguments, so every node can work out
+ * the same assignment for itself.  It is ordered by file, then offset.
+ */
+inline std::vector<FileAssignment> assignFilesBySize(const std::vector<uint64_t> &sizes,
+        size_t numNodes, bool splitLargeFiles) {
+    numNodes = std::max(numNodes, (size_t)1);
+    uint64_t total = 0;
+    for (size_t i = 0; i < sizes.size(); i++) total += sizes[i];
+    const uint64_t target = std::max((uint64_t)1, (total + numNodes - 1) / numNodes);
+
+    std::vector<FileAssignment> pieces;
+    for (size_t i = 0; i < sizes.size(); i++) {
+        uint64_t offset = 0;
+        do {
+            const uint64_t left = sizes[i] - offset;
+            FileAssignment piece = { i, offset, (splitLargeFiles && left > target) ? target : left, 0 };
+            pieces.push_back(piece);
+            offset += piece.size;
+        } while (offset < sizes[i]);
+    }
+    std::sort(pieces.begin(), pieces.end(), FileAssignmentsBySize());
+
+    // Nodes by (bytes so far, node number), fewest bytes first
+    typedef std::pair<uint64_t, size_t> NodeLoad;
+    std::priority_queue<NodeLoad, std::vector<NodeLoad>, std::greater<NodeLoad> > nodes;
+    for (size_t node = 0; node < numNodes; node++) {
+        nodes.push(NodeLoad(0, node));
+    }
+    for (size_t i = 0; i < pieces.size(); i++) {
+        NodeLoad least = nodes.top();
+        nodes.pop();
+        pieces[i].node = least.second;
+        least.first += pieces[i].size;
+        nodes.push(least);
+    }
+
+    std::sort(pieces.begin(), pieces.end(), FileAssignmentsByFile());
+    return pieces;
+}
+
+#endif // FILE_ASSIGNMENT_H_
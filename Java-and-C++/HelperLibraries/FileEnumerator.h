@@ -0,0 +1,701 @@
+/* Copyright (c) 2005 - 2016 Hewlett Packard Enterprise Development LP  -*- C++ -*-*/
+/****************************
+ * Vertica Analytic Database
+ *
+ * UDL helper; expanding file name patterns over very large directories,
+ * and remembering what was in them from one load to the next.
+ *
+ ****************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <fnmatch.h>
+#include <dirent.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/syscall.h>
+#include <string>
+#include <vector>
+#include <set>
+#include <algorithm>
+
+#include "Vertica.h"
+#include "WorkerPool.h"
+
+#ifndef FILE_ENUMERATOR_H_
+#define FILE_ENUMERATOR_H_
+
+/** A file found by FileEnumerator; size and mtime are only set if asked for */
+struct FileEntry {
+    std::string path;
+    uint64_t size;
+    uint64_t mtime;
+
+    bool operator<(const FileEntry &other) const { return path < other.path; }
+};
+
+/**
+ * FileEnumerator
+ *
+ * Expands a pattern the way glob() does (sorted, and with '*' and '?'
+ * not matching a leading '.'; but never matching "." or ".."), built
+ * for directories with millions of files:
+ *  - Directories are read with getdents64() into a large buffer, rather
+ *    than one readdir() entry at a time, and several directories are
+ *    read at once.
+ *  - When sizes are wanted, files are stat()ed on several threads.
+ *  - With a manifest directory, what was found in each directory is
+ *    saved there (one file per directory), along with the directory's
+ *    mtime.  Later expansions use the saved list as long as the
+ *    directory's mtime hasn't changed, without reading the directory
+ *    or stat()ing its files again.
+ *
+ * Adding, removing or renaming files changes a directory's mtime, but
+ * rewriting a file in place doesn't; so with a manifest, files are
+ * expected not to change once they are in the directory (as when they
+ * are written somewhere else and then moved in).
+ *
+ * The manifest directory is separate from the directories being read:
+ * writing a manifest into a directory would change its mtime.
+ */
+class FileEnumerator {
+public:
+    enum Result { FOUND, NO_MATCH, READ_ERROR };
+
+    static const size_t DEFAULT_THREADS = 8;
+
+    FileEnumerator(const std::string &manifestDir = "", size_t numThreads = DEFAULT_THREADS)
+        : manifestDir(manifestDir), numThreads(numThreads), poolStarted(false),
+          errorCode(0), manifestsUsed(0), manifestsSaved(0) {}
+
+    /**
+     * Find the files matching `pattern`, in sorted order, getting their
+     * sizes and mtimes if `wantSizes` is set.  On READ_ERROR,
+     * getErrorPath() is the directory that couldn't be read, and
+     * getErrorCode() the errno from reading it.
+     */
+    Result expand(const std::string &pattern, bool wantSizes, std::vector<FileEntry> &files) {
+        files.clear();
+        errorPath.clear();
+        errorCode = 0;
+
+        std::vector<std::string> components;
+        size_t start = 0;
+        while (start <= pattern.size()) {
+            size_t end = pattern.find('/', start);
+            if (end == std::string::npos) end = pattern.size();
+            if (end > start) components.push_back(pattern.substr(start, end - start));
+            start = end + 1;
+        }
+        if (components.empty()) return NO_MATCH;
+
+        // Directories that the next component is looked for in
+        std::vector<std::string> dirs(1, pattern[0] == '/' ? "/" : "");
+
+        for (size_t i = 0; i < components.size(); i++) {
+            const std::string &component = components[i];
+            const bool last = (i + 1 == components.size());
+
+            if (!hasWildcards(component)) {
+                for (size_t d = 0; d < dirs.size(); d++) dirs[d] = join(dirs[d], component);
+                if (last) {
+                    // Only names that exist are matches
+                    for (size_t d = 0; d < dirs.size(); d++) {
+                        FileEntry entry = { dirs[d], 0, 0 };
+                        files.push_back(entry);
+                    }
+                    statAll(files, true, "");
+                }
+                continue;
+            }
+
+            std::vector<Listing> listings(dirs.size());
+            for (size_t d = 0; d < dirs.size(); d++) listings[d].dir = dirs[d];
+            listAll(listings);
+
+            std::vector<std::string> nextDirs;
+            for (size_t d = 0; d < listings.size(); d++) {
+                Listing &listing = listings[d];
+                if (listing.error != 0) {
+                    // Like glob() with GLOB_ERR, even for a directory that isn't there
+                    errorPath = listing.dir.empty() ? "." : listing.dir;
+                    errorCode = listing.error;
+                    return READ_ERROR;
+                }
+
+                std::vector<size_t> matches;
+                for (size_t e = 0; e < listing.entries.size(); e++) {
+                    if (fnmatch(component.c_str(), listing.entries[e].name.c_str(), FNM_PERIOD) == 0) {
+                        matches.push_back(e);
+                    }
+                }
+
+                if (!last) {
+                    for (size_t m = 0; m < matches.size(); m++) {
+                        const DirEntry &entry = listing.entries[matches[m]];
+                        const std::string path = join(listing.dir, entry.name);
+                        if (isDirectory(entry, path)) nextDirs.push_back(path);
+                    }
+                    continue;
+                }
+
+                std::vector<FileEntry> found;
+                for (size_t m = 0; m < matches.size(); m++) {
+                    const DirEntry &entry = listing.entries[matches[m]];
+                    FileEntry file = { join(listing.dir, entry.name), entry.size, entry.mtime };
+                    found.push_back(file);
+                }
+                if (wantSizes) {
+                    // Only stat() what the manifest didn't already have
+                    std::vector<FileEntry> unknown;
+                    std::vector<size_t> unknownIndex;
+                    for (size_t m = 0; m < matches.size(); m++) {
+                        if (!listing.entries[matches[m]].statted) {
+                            unknown.push_back(found[m]);
+                            unknownIndex.push_back(m);
+                        }
+                    }
+                    statAll(unknown, false, listing.dir);
+                    for (size_t u = 0; u < unknown.size(); u++) {
+                        DirEntry &entry = listing.entries[matches[unknownIndex[u]]];
+                        found[unknownIndex[u]] = unknown[u];
+                        entry.size = unknown[u].size;
+                        entry.mtime = unknown[u].mtime;
+                        entry.statted = true;
+                        listing.changed = true;
+                    }
+                }
+                files.insert(files.end(), found.begin(), found.end());
+            }
+
+            if (!manifestDir.empty()) {
+                for (size_t d = 0; d < listings.size(); d++) {
+                    if (listings[d].error == 0 && listings[d].changed && saveManifest(listings[d])) {
+                        manifestsSaved++;
+                    }
+                }
+            }
+            if (last) break;
+            dirs.swap(nextDirs);
+        }
+
+        std::sort(files.begin(), files.end());
+        return files.empty() ? NO_MATCH : FOUND;
+    }
+
+    const std::string &getErrorPath() const { return errorPath; }
+    int getErrorCode() const { return errorCode; }
+
+    /** Directories whose manifests were used, and saved, so far */
+    size_t getManifestsUsed() const { return manifestsUsed; }
+    size_t getManifestsSaved() const { return manifestsSaved; }
+
+private:
+    static const size_t DENTS_BUFFER_SIZE = 1024 * 1024;
+    static const size_t STATS_PER_JOB = 256;
+
+    // Manifest file format version marker, including the '\0'
+    static const size_t MAGIC_SIZE = 8;
+    static const char *getMagic() { return "VFMANI1"; }
+
+    struct DirEntry {
+        std::string name;
+        unsigned char type;     // DT_* from getdents64
+        bool statted;           // size and mtime are known
+        uint64_t size;
+        uint64_t mtime;
+    };
+
+    struct Listing {
+        Listing() : error(0), changed(false), mtimeSec(0), mtimeNsec(0), fromManifest(false) {}
+        std::string dir;
+        std::vector<DirEntry> entries;
+        int error;              // errno from reading the directory
+        bool changed;           // Differs from the manifest
+        uint64_t mtimeSec, mtimeNsec;
+        bool fromManifest;
+    };
+
+    // The kernel's record layout; glibc doesn't declare it
+    struct Dirent64 {
+        uint64_t d_ino;
+        int64_t d_off;
+        unsigned short d_reclen;
+        unsigned char d_type;
+        char d_name[1];
+    };
+
+    static bool hasWildcards(const std::string &component) {
+        return component.find_first_of("*?[\\") != std::string::npos;
+    }
+
+    static std::string join(const std::string &dir, const std::string &name) {
+        if (dir.empty()) return name;
+        return dir[dir.size() - 1] == '/' ? dir + name : dir + "/" + name;
+    }
+
+    static bool isDirectory(const DirEntry &entry, const std::string &path) {
+        if (entry.type == DT_DIR) return true;
+        if (entry.type != DT_LNK && entry.type != DT_UNKNOWN) return false;
+        struct stat st;
+        return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+    }
+
+    /** Read a directory: from its manifest if that's up to date, or else with getdents64() */
+    class ListJob : public PoolJob {
+    public:
+        ListJob(FileEnumerator &enumerator, Listing &listing) : enumerator(enumerator), listing(listing) {}
+
+        void run() {
+            const std::string dir = listing.dir.empty() ? "." : listing.dir;
+            const int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+            if (fd < 0) {
+                listing.error = errno;
+                return;
+            }
+            // Before reading, so that anything added meanwhile shows up as a change next time
+            struct stat st;
+            if (fstat(fd, &st) == 0) {
+                listing.mtimeSec = st.st_mtim.tv_sec;
+                listing.mtimeNsec = st.st_mtim.tv_nsec;
+            }
+            if (!enumerator.manifestDir.empty() && enumerator.loadManifest(listing)) {
+                ::close(fd);
+                return;
+            }
+
+            std::vector<char> buf(DENTS_BUFFER_SIZE);
+            while (true) {
+                const long n = syscall(SYS_getdents64, fd, &buf[0], buf.size());
+                if (n < 0) {
+                    if (errno == EINTR) continue;
+                    listing.error = errno;
+                    break;
+                }
+                if (n == 0) break;
+                for (long pos = 0; pos < n; ) {
+                    const Dirent64 *d = (const Dirent64 *)&buf[pos];
+                    pos += d->d_reclen;
+                    if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0) continue;
+                    DirEntry entry = { d->d_name, d->d_type, false, 0, 0 };
+                    listing.entries.push_back(entry);
+                }
+            }
+            ::close(fd);
+            listing.changed = true;
+        }
+
+    private:
+        FileEnumerator &enumerator;
+        Listing &listing;
+    };
+
+    /**
+     * stat() some files; with `dirFd`, they are all in that directory,
+     * and are looked up in it by name (from `nameStart` in their paths)
+     */
+    class StatJob : public PoolJob {
+    public:
+        StatJob(FileEntry *files, size_t count, int dirFd, size_t nameStart)
+            : files(files), count(count), dirFd(dirFd), nameStart(nameStart) {}
+
+        void run() {
+            for (size_t i = 0; i < count; i++) {
+                struct stat st;
+                const int ret = (dirFd >= 0)
+                    ? fstatat(dirFd, files[i].path.c_str() + nameStart, &st, 0)
+                    : stat(files[i].path.c_str(), &st);
+                if (ret == 0) {
+                    files[i].size = st.st_size;
+                    files[i].mtime = st.st_mtime;
+                } else {
+                    files[i].mtime = (uint64_t)-1;  // Marks it missing
+                }
+            }
+        }
+
+    private:
+        FileEntry *files;
+        size_t count;
+        int dirFd;
+        size_t nameStart;
+    };
+
+    void runJobs(std::vector<PoolJob *> &jobs) {
+        if (jobs.size() > 1 && !poolStarted) {
+            pool.start(numThreads > 1 ? numThreads - 1 : 0);
+            poolStarted = true;
+        }
+        pool.runAll(jobs);
+        for (size_t i = 0; i < jobs.size(); i++) delete jobs[i];
+        jobs.clear();
+    }
+
+    void listAll(std::vector<Listing> &listings) {
+        std::vector<PoolJob *> jobs;
+        for (size_t i = 0; i < listings.size(); i++) jobs.push_back(new ListJob(*this, listings[i]));
+        runJobs(jobs);
+        for (size_t i = 0; i < listings.size(); i++) {
+            if (listings[i].fromManifest) manifestsUsed++;
+        }
+    }
+
+    /**
+     * stat() files, in parallel; if they are all in `dir`, relative to
+     * it, which saves looking up the directory again for each one.
+     * Missing files are dropped if `dropMissing`, or left with size 0.
+     */
+    void statAll(std::vector<FileEntry> &files, bool dropMissing, const std::string &dir) {
+        const int dirFd = dir.empty() ? -1 : ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+        const size_t nameStart = join(dir, "").size();
+        std::vector<PoolJob *> jobs;
+        for (size_t i = 0; i < files.size(); i += STATS_PER_JOB) {
+            jobs.push_back(new StatJob(&files[i], std::min((size_t)STATS_PER_JOB, files.size() - i),
+                                       dirFd, nameStart));
+        }
+        runJobs(jobs);
+        if (dirFd >= 0) ::close(dirFd);
+
+        if (dropMissing) {
+            std::vector<FileEntry> present;
+            for (size_t i = 0; i < files.size(); i++) {
+                if (files[i].mtime != (uint64_t)-1) present.push_back(files[i]);
+            }
+            files.swap(present);
+        } else {
+            for (size_t i = 0; i < files.size(); i++) {
+                if (files[i].mtime == (uint64_t)-1) files[i].mtime = 0;
+            }
+        }
+    }
+
+    /** Where the manifest for `dir` is kept; named after a hash of the path */
+    std::string manifestPath(const std::string &dir) const {
+        uint64_t hash = 14695981039346656037ULL;   // FNV-1a
+        for (size_t i = 0; i < dir.size(); i++) {
+            hash = (hash ^ (unsigned char)dir[i]) * 1099511628211ULL;
+        }
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.manifest", (unsigned long long)hash);
+        return manifestDir + "/" + name;
+    }
+
+    /** Fill in `listing` from its manifest; false if there isn't an up-to-date one */
+    bool loadManifest(Listing &listing) {
+        FILE *f = fopen(manifestPath(listing.dir).c_str(), "r");
+        if (f == NULL) return false;
+
+        char magic[MAGIC_SIZE];
+        uint64_t header[4];     // dir mtime (sec, nsec), entry count, dir name length
+        bool ok = fread(magic, MAGIC_SIZE, 1, f) == 1
+            && memcmp(magic, getMagic(), MAGIC_SIZE) == 0
+            && fread(header, sizeof(header), 1, f) == 1
+            && header[0] == listing.mtimeSec && header[1] == listing.mtimeNsec
+            && header[3] == listing.dir.size();
+        if (ok) {
+            std::string dir(header[3], '\0');
+            ok = (dir.empty() || fread(&dir[0], dir.size(), 1, f) == 1) && dir == listing.dir;
+        }
+        for (uint64_t i = 0; ok && i < header[2]; i++) {
+            uint64_t fields[4];     // size, mtime, type and statted, name length
+            ok = fread(fields, sizeof(fields), 1, f) == 1;
+            if (!ok) break;
+            DirEntry entry = { std::string(fields[3], '\0'), (unsigned char)(fields[2] & 0xff),
+                               (fields[2] >> 8) != 0, fields[0], fields[1] };
+            ok = fields[3] > 0 && fread(&entry.name[0], fields[3], 1, f) == 1;
+            listing.entries.push_back(entry);
+        }
+        fclose(f);
+
+        if (!ok) listing.entries.clear();
+        listing.fromManifest = ok;
+        return ok;
+    }
+
+    /** Save `listing` as the manifest for its directory; written to a temporary file and renamed */
+    bool saveManifest(const Listing &listing) {
+        char tmpSuffix[64];
+        snprintf(tmpSuffix, sizeof(tmpSuffix), ".tmp.%d", (int)getpid());
+        const std::string path = manifestPath(listing.dir);
+        const std::string tmpPath = path + tmpSuffix;
+
+        FILE *f = fopen(tmpPath.c_str(), "w");
+        if (f == NULL) return false;
+
+        uint64_t header[4] = { listing.mtimeSec, listing.mtimeNsec, listing.entries.size(), listing.dir.size() };
+        bool ok = fwrite(getMagic(), MAGIC_SIZE, 1, f) == 1
+            && fwrite(header, sizeof(header), 1, f) == 1
+            && (listing.dir.empty() || fwrite(listing.dir.data(), listing.dir.size(), 1, f) == 1);
+        for (size_t i = 0; ok && i < listing.entries.size(); i++) {
+            const DirEntry &entry = listing.entries[i];
+            uint64_t fields[4] = { entry.size, entry.mtime,
+                                   entry.type | ((uint64_t)entry.statted << 8), entry.name.size() };
+            ok = fwrite(fields, sizeof(fields), 1, f) == 1
+                && fwrite(entry.name.data(), entry.name.size(), 1, f) == 1;
+        }
+        ok = (fclose(f) == 0) && ok;
+
+        if (!ok || rename(tmpPath.c_str(), path.c_str()) != 0) {
+            unlink(tmpPath.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    const std::string manifestDir;
+    const size_t numThreads;
+    WorkerPool pool;
+    bool poolStarted;
+
+    std::string errorPath;
+    int errorCode;
+    size_t manifestsUsed;
+    size_t manifestsSaved;
+};
+
+/**
+ * LoadedFiles
+ *
+ * A record, kept in a manifest directory, of files that have been
+ * loaded; for loads that only pick up new files.  A file is identified
+ * by its path, size and mtime, so a file that is replaced counts as new.
+ *
+ * A source finishes reading a file before the load commits, and can't
+ * tell whether it will.  So the files that a load reads go in a pending
+ * record of its own, named for the load, and only count as loaded once
+ * commitPending() has moved them into the main record; after a load
+ * that failed, discardPending() throws them away, so that those files
+ * are loaded again.
+ */
+class LoadedFiles {
+public:
+    explicit LoadedFiles(const std::string &manifestDir)
+        : dir(manifestDir), path(manifestDir + "/loaded_files") {}
+
+    /** A name for a load's pending record; unique enough, if made on one node */
+    static std::string newLoadId() {
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        char id[64];
+        snprintf(id, sizeof(id), "%lld.%06ld.%d",
+                 (long long)now.tv_sec, (long)now.tv_usec, (int)getpid());
+        return id;
+    }
+
+    void load() {
+        FILE *f = fopen(path.c_str(), "r");
+        if (f == NULL) return;
+        char *line = NULL;
+        size_t capacity = 0;
+        ssize_t len;
+        while ((len = getline(&line, &capacity, f)) > 0) {
+            if (line[len - 1] == '\n') len--;
+            loaded.insert(std::string(line, len));
+        }
+        free(line);
+        fclose(f);
+    }
+
+    bool contains(const FileEntry &file) const {
+        return loaded.count(key(file)) > 0;
+    }
+
+    /**
+     * Add a file to the pending record of load `loadId`.  Several sources
+     * may do this at once; each call's lines go in with a single append.
+     */
+    bool addPending(const std::string &loadId, const FileEntry &file) const {
+        return addPending(loadId, std::vector<FileEntry>(1, file));
+    }
+
+    /** Add several files to the pending record of load `loadId`, with a single append */
+    bool addPending(const std::string &loadId, const std::vector<FileEntry> &files) const {
+        if (files.empty()) return true;
+        std::string lines;
+        for (size_t i = 0; i < files.size(); i++) lines += key(files[i]) + "\n";
+        return append(pendingPrefix() + loadId, lines);
+    }
+
+    /** The pending records of loads not yet committed or discarded */
+    bool listPending(std::vector<std::string> &pending) const {
+        DIR *d = opendir(dir.c_str());
+        if (d == NULL) return false;
+        const std::string prefix = "loaded_files.pending.";
+        while (struct dirent *e = readdir(d)) {
+            if (strncmp(e->d_name, prefix.c_str(), prefix.size()) == 0) {
+                pending.push_back(dir + "/" + e->d_name);
+            }
+        }
+        closedir(d);
+        std::sort(pending.begin(), pending.end());
+        return true;
+    }
+
+    /**
+     * Move every pending record into the main one; for once the loads
+     * that made them have committed.  A record is removed only after its
+     * lines are in, so this can be run again after a failure.
+     *
+     * With a manifest directory shared between nodes, every node does
+     * this at once: a record that has gone by the time it is read or
+     * removed was committed by another node, and a line that goes in
+     * twice does no harm.
+     */
+    bool commitPending(size_t &loads) const {
+        std::vector<std::string> pending;
+        if (!listPending(pending)) return false;
+        for (loads = 0; loads < pending.size(); loads++) {
+            std::string lines;
+            if (!slurp(pending[loads], lines)) {
+                if (errno == ENOENT) continue;
+                return false;
+            }
+            if (!append(path, lines)) return false;
+            if (unlink(pending[loads].c_str()) != 0 && errno != ENOENT) return false;
+        }
+        return true;
+    }
+
+    /** Throw away every pending record; for after the loads that made them failed */
+    bool discardPending(size_t &loads) const {
+        std::vector<std::string> pending;
+        if (!listPending(pending)) return false;
+        for (loads = 0; loads < pending.size(); loads++) {
+            if (unlink(pending[loads].c_str()) != 0 && errno != ENOENT) return false;
+        }
+        return true;
+    }
+
+    const std::string &getPath() const { return path; }
+
+    // The parameters of the sources that keep a record of loaded files
+
+    static std::string getManifestDir(Vertica::ServerInterface &srvInterface) {
+        Vertica::ParamReader args(srvInterface.getParamReader());
+        return args.containsParameter("manifest_dir") ? args.getStringRef("manifest_dir").str() : "";
+    }
+
+    static bool isIncremental(Vertica::ServerInterface &srvInterface) {
+        Vertica::ParamReader args(srvInterface.getParamReader());
+        return args.containsParameter("incremental") && args.getBoolRef("incremental");
+    }
+
+    static std::string getPendingFiles(Vertica::ServerInterface &srvInterface) {
+        Vertica::ParamReader args(srvInterface.getParamReader());
+        return args.containsParameter("pending_files") ? args.getStringRef("pending_files").str() : "";
+    }
+
+    static void addParameterType(Vertica::SizedColumnTypes &parameterTypes) {
+        parameterTypes.addVarchar(65000, "manifest_dir");
+        parameterTypes.addBool("incremental");
+        parameterTypes.addVarchar(16, "pending_files");
+    }
+
+    /**
+     * For the factory's plan(): check "incremental" and "pending_files",
+     * and give an incremental load one name for its pending records, on
+     * every node.
+     */
+    static void plan(Vertica::ServerInterface &srvInterface, Vertica::PlanContext &planCtxt) {
+        if (isIncremental(srvInterface) && getManifestDir(srvInterface).empty()) {
+            vt_report_error(0, "incremental=true needs a manifest_dir to record loaded files in");
+        }
+        const std::string pendingFiles = getPendingFiles(srvInterface);
+        if (!pendingFiles.empty()) {
+            if (pendingFiles != "commit" && pendingFiles != "discard") {
+                vt_report_error(0, "parameter \"pending_files\" must be 'commit' or 'discard'");
+            }
+            if (getManifestDir(srvInterface).empty()) {
+                vt_report_error(0, "pending_files needs the manifest_dir that the loads recorded files in");
+            }
+        }
+        if (isIncremental(srvInterface)) {
+            planCtxt.getWriter().getStringRef("load_id").copy(newLoadId());
+        }
+    }
+
+    /** The name that plan() gave this load */
+    static std::string getLoadId(Vertica::PlanContext &planCtxt) {
+        return planCtxt.getReader().getStringRef("load_id").str();
+    }
+
+    /**
+     * Move the files that earlier incremental loads read into the record
+     * of loaded files (pending_files='commit'), once those loads have
+     * committed; or forget them ('discard'), so that they are loaded
+     * again.  `udxName` is for the log.
+     */
+    static void settlePending(Vertica::ServerInterface &srvInterface, const char *udxName) {
+        const std::string manifestDir = getManifestDir(srvInterface);
+        const std::string action = getPendingFiles(srvInterface);
+        LoadedFiles loaded(manifestDir);
+        size_t loads = 0;
+        const bool ok = (action == "commit") ?
+            loaded.commitPending(loads) : loaded.discardPending(loads);
+        if (!ok) {
+            vt_report_error(0, "Could not %s pending loaded files in [%s]: %s",
+                            action.c_str(), manifestDir.c_str(), strerror(errno));
+        }
+        srvInterface.log("%s: %s files read by %zu incremental loads, in [%s]", udxName,
+                         action == "commit" ? "recorded as loaded the" : "discarded the",
+                         loads, manifestDir.c_str());
+    }
+
+    /**
+     * An incremental load can't tell whether files read by an earlier one
+     * that hasn't been settled were loaded; so rather than load them twice,
+     * or not at all, it fails.  The record of load `loadId` is its own,
+     * started by another node that shares the manifest directory.
+     */
+    static void checkNothingPending(const std::string &manifestDir, const std::string &loadId) {
+        LoadedFiles loaded(manifestDir);
+        std::vector<std::string> pending;
+        if (!loaded.listPending(pending)) return;
+        pending.erase(std::remove(pending.begin(), pending.end(), loaded.pendingPrefix() + loadId),
+                      pending.end());
+        if (!pending.empty()) {
+            vt_report_error(0, "Files read by %zu earlier incremental loads are pending in [%s]; "
+                            "settle them with pending_files='commit' if those loads committed, "
+                            "or pending_files='discard' if not",
+                            pending.size(), manifestDir.c_str());
+        }
+    }
+
+private:
+    static std::string key(const FileEntry &file) {
+        char prefix[64];
+        snprintf(prefix, sizeof(prefix), "%llu %llu ",
+                 (unsigned long long)file.size, (unsigned long long)file.mtime);
+        return prefix + file.path;
+    }
+
+    std::string pendingPrefix() const { return path + ".pending."; }
+
+    static bool append(const std::string &file, const std::string &lines) {
+        const int fd = ::open(file.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+        if (fd < 0) return false;
+        const bool ok = write(fd, lines.data(), lines.size()) == (ssize_t)lines.size();
+        return (::close(fd) == 0) && ok;
+    }
+
+    static bool slurp(const std::string &file, std::string &contents) {
+        FILE *f = fopen(file.c_str(), "r");
+        if (f == NULL) return false;
+        char buf[64 * 1024];
+        size_t got;
+        while ((got = fread(buf, 1, sizeof(buf), f)) > 0) contents.append(buf, got);
+        const bool ok = !ferror(f);
+        fclose(f);
+        return ok;
+    }
+
+    const std::string dir;
+    const std::string path;
+    std::set<std::string> loaded;
+};
+
+#endif // FILE_ENUMERATOR_H_
@@ -0,0 +1,661 @@
+/* Copyright (c) 2005 - 2016 Hewlett Packard Enterprise Development LP  -*- C++ -*-*/
+/****************************
+ * Vertica Analytic Database
+ *
+ * UDL helper; different ways of reading a local file sequentially,
+ * for sources to choose between.
+ *
+ ****************************/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE     // O_DIRECT
+#endif
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <string>
+#include <algorithm>
+
+#include "Vertica.h"
+#include "AsyncReadEngine.h"
+
+#ifndef FILE_READERS_H_
+#define FILE_READERS_H_
+
+/**
+ * FileReader
+ *
+ * Reads a file sequentially, from some starting offset to the end.
+ * Errors are reported with vt_report_error().
+ */
+class FileReader {
+public:
+    virtual ~FileReader() {}
+
+    /**
+     * Open `filename`, positioned at byte `offset`.
+     * If the caller expects to stop reading at around byte `endHint`,
+     * readers avoid reading far ahead past it; -1 for no such limit.
+     */
+    virtual void open(const std::string &filename, off_t offset, off_t endHint) = 0;
+
+    /** Read up to `len` bytes into `buf`; returns the number read */
+    virtual size_t read(char *buf, size_t len) = 0;
+
+    /** Has the whole file been read? */
+    virtual bool atEnd() const = 0;
+
+    virtual void close() = 0;
+
+    static const size_t DEFAULT_BLOCK_SIZE = 4 * 1024 * 1024;
+    static const size_t DEFAULT_QUEUE_DEPTH = 4;
+
+    /**
+     * The reader for a `read_mode` argument:
+     *  - 'stdio':    fread(); reads whatever the caller asks for
+     *  - 'buffered': pread() of up to `blockSize` at a time, with
+     *                sequential-access and read-ahead hints to the kernel
+     *  - 'direct':   O_DIRECT pread() of `blockSize` at a time, bypassing
+     *                the page cache
+     *  - 'async':    `queueDepth` reads of `blockSize` in flight at once,
+     *                ahead of the caller
+     *  - 'mmap':     copies from a mapping of the file, for files that are
+     *                already in the page cache
+     * Returns NULL for an unknown mode.
+     */
+    static FileReader *create(const std::string &mode, size_t blockSize, size_t queueDepth);
+
+    /** Check `read_mode`, `block_size` and `queue_depth` arguments, as create() will use them */
+    static void validateArgs(const std::string &mode, Vertica::vint blockSize, Vertica::vint queueDepth);
+};
+
+/** The fread() reader */
+class StdioFileReader : public FileReader {
+public:
+    StdioFileReader() : handle(NULL) {}
+    ~StdioFileReader() { close(); }
+
+    void open(const std::string &filename, off_t offset, off_t endHint) {
+        this->filename = filename;
+        handle = fopen(filename.c_str(), "r");
+        if (handle == NULL) {
+            vt_report_error(0, "Error opening file [%s]", filename.c_str());
+        }
+        if (offset != 0 && fseeko(handle, offset, SEEK_SET) != 0) {
+            vt_report_error(0, "disk seek failed for file %s at offset %lld", filename.c_str(), (long long)offset);
+        }
+    }
+
+    size_t read(char *buf, size_t len) {
+        const size_t n = fread(buf, 1, len, handle);
+        if (n < len && ferror(handle)) {
+            vt_report_error(0, "Error reading file [%s]", filename.c_str());
+        }
+        return n;
+    }
+
+    bool atEnd() const { return feof(handle); }
+
+    void close() {
+        if (handle) fclose(handle);
+        handle = NULL;
+    }
+
+private:
+    std::string filename;
+    FILE *handle;
+};
+
+/**
+ * Shared plumbing for the readers that use pread() on a file descriptor
+ * and keep track of the position themselves.
+ */
+class PreadFileReader : public FileReader {
+public:
+    PreadFileReader() : fd(-1), pos(0), fileSize(0) {}
+    ~PreadFileReader() { close(); }
+
+    bool atEnd() const { return pos >= fileSize; }
+
+    void close() {
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+    }
+
+protected:
+    /** Open with `flags`; returns false (with errno set) on failure */
+    bool openFd(const std::string &filename, off_t offset, int flags) {
+        PreadFileReader::close();
+        this->filename = filename;
+        fd = ::open(filename.c_str(), O_RDONLY | flags);
+        if (fd < 0) return false;
+
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            vt_report_error(0, "Error reading file [%s]: %s", filename.c_str(), strerror(errno));
+        }
+        fileSize = st.st_size;
+        pos = offset;
+        return true;
+    }
+
+    /**
+     * pread() into buf, retrying on EINTR.  Returns -1 only for EINVAL
+     * (which O_DIRECT reads give on some filesystems); reports other
+     * errors.  A return of 0 means the file ended early (was truncated
+     * under us); treat it as the end.
+     */
+    ssize_t preadAll(char *buf, size_t len, off_t at) {
+        while (true) {
+            const ssize_t n = pread(fd, buf, len, at);
+            if (n >= 0) {
+                if (n == 0) fileSize = std::min(fileSize, at);
+                return n;
+            }
+            if (errno == EINTR) continue;
+            if (errno == EINVAL) return -1;
+            vt_report_error(0, "Error reading file [%s] at offset %lld: %s",
+                            filename.c_str(), (long long)at, strerror(errno));
+        }
+    }
+
+    std::string filename;
+    int fd;
+    off_t pos;          // Next byte to hand out
+    off_t fileSize;
+};
+
+/**
+ * Reads through the page cache, but tells the kernel up front that the
+ * file will be read sequentially (so it reads ahead aggressively) and
+ * asks for each next block before it's needed.
+ */
+class BufferedFileReader : public PreadFileReader {
+public:
+    BufferedFileReader(size_t blockSize) : blockSize(blockSize), hintedTo(0), hintLimit(0) {}
+
+    void open(const std::string &filename, off_t offset, off_t endHint) {
+        if (!openFd(filename, offset, 0)) {
+            vt_report_error(0, "Error opening file [%s]", filename.c_str());
+        }
+        posix_fadvise(fd, offset, endHint < 0 ? 0 : endHint - offset, POSIX_FADV_SEQUENTIAL);
+        hintedTo = offset;
+        hintLimit = endHint < 0 ? fileSize : std::min(fileSize, endHint);
+    }
+
+    size_t read(char *buf, size_t len) {
+        // Keep the kernel a block or two ahead of us
+        if (hintedTo < pos + (off_t)blockSize && hintedTo < hintLimit) {
+            const off_t from = std::max(hintedTo, pos);
+            posix_fadvise(fd, from, 2 * blockSize, POSIX_FADV_WILLNEED);
+            hintedTo = from + 2 * blockSize;
+        }
+
+        size_t done = 0;
+        while (done < len && !atEnd()) {
+            const ssize_t n = preadAll(buf + done, std::min(len - done, blockSize), pos);
+            if (n <= 0) break;
+            done += n;
+            pos += n;
+        }
+        return done;
+    }
+
+private:
+    const size_t blockSize;
+    off_t hintedTo;     // Read-ahead has been requested up to here
+    off_t hintLimit;    // ... and needn't be past here
+};
+
+/**
+ * Reads around the page cache with O_DIRECT, in large aligned blocks.
+ * Avoids the copy into the page cache, and evicting everything else from
+ * it, for files that will only be read once.
+ *
+ * O_DIRECT needs the buffer, offset and length aligned, so reads go into
+ * an aligned block buffer and are copied out from there -- except when
+ * the caller's buffer happens to be suitably aligned, in which case the
+ * data is read straight into it.  Falls back to BufferedFileReader if
+ * the filesystem doesn't support O_DIRECT.
+ */
+class DirectFileReader : public PreadFileReader {
+public:
+    static const size_t ALIGNMENT = 4096;
+
+    DirectFileReader(size_t blockSize)
+        : blockSize(blockSize < ALIGNMENT ? (size_t)ALIGNMENT : blockSize / ALIGNMENT * ALIGNMENT),
+          block(NULL), blockStart(0), blockLen(0), fallback(NULL) {}
+
+    ~DirectFileReader() {
+        close();
+        free(block);
+    }
+
+    void open(const std::string &filename, off_t offset, off_t endHint) {
+        this->endHint = endHint;
+        if (!openFd(filename, offset, O_DIRECT)) {
+            if (errno != EINVAL) {
+                vt_report_error(0, "Error opening file [%s]", filename.c_str());
+            }
+            useFallback(filename, offset);
+            return;
+        }
+        if (block == NULL && posix_memalign((void **)&block, ALIGNMENT, blockSize) != 0) {
+            block = NULL;
+            vt_report_error(0, "Out of memory allocating a %zu-byte read buffer", blockSize);
+        }
+        blockStart = offset / ALIGNMENT * ALIGNMENT;
+        blockLen = 0;
+    }
+
+    size_t read(char *buf, size_t len) {
+        if (fallback) return fallback->read(buf, len);
+
+        size_t done = 0;
+        while (done < len && !atEnd()) {
+            // Copy out what's left in the block buffer
+            const off_t blockEnd = blockStart + (off_t)blockLen;
+            if (pos < blockEnd) {
+                const size_t n = std::min(len - done, (size_t)(blockEnd - pos));
+                memcpy(buf + done, block + (pos - blockStart), n);
+                done += n;
+                pos += n;
+                continue;
+            }
+
+            // Read straight into the caller's buffer if we can
+            char *dest = buf + done;
+            const size_t room = (len - done) / ALIGNMENT * ALIGNMENT;
+            if (pos % ALIGNMENT == 0 && (uintptr_t)dest % ALIGNMENT == 0 && room > 0) {
+                const ssize_t n = preadAll(dest, std::min(room, blockSize), pos);
+                if (n < 0) return done + fallBackAfterEinval(buf + done, len - done);
+                if (n == 0) break;
+                done += n;
+                pos += n;
+                continue;
+            }
+
+            blockStart = pos / ALIGNMENT * ALIGNMENT;
+            blockLen = 0;
+            const ssize_t n = preadAll(block, blockSize, blockStart);
+            if (n < 0) return done + fallBackAfterEinval(buf + done, len - done);
+            if (n == 0) break;
+            blockLen = n;
+        }
+        return done;
+    }
+
+    bool atEnd() const { return fallback ? fallback->atEnd() : PreadFileReader::atEnd(); }
+
+    void close() {
+        PreadFileReader::close();
+        delete fallback;
+        fallback = NULL;
+    }
+
+private:
+    void useFallback(const std::string &filename, off_t offset) {
+        fallback = new BufferedFileReader(blockSize);
+        fallback->open(filename, offset, endHint);
+    }
+
+    size_t fallBackAfterEinval(char *buf, size_t len) {
+        const off_t at = pos;
+        PreadFileReader::close();
+        useFallback(filename, at);
+        return fallback->read(buf, len);
+    }
+
+    const size_t blockSize;
+    char *block;
+    off_t blockStart;   // File offset of block[0]
+    size_t blockLen;
+    off_t endHint;
+    BufferedFileReader *fallback;
+};
+
+/**
+ * Keeps up to `queueDepth` reads of `blockSize` in flight ahead of the
+ * caller, and hands back the blocks in file order as they complete.
+ * A single synchronous read at a time leaves a fast SSD idle most of
+ * the time; this keeps its queue full.
+ *
+ * Uses io_uring where it's available, and otherwise a pool of threads
+ * doing pread().  Reads with O_DIRECT where the filesystem allows it,
+ * since deep queues of large reads are what that's for.
+ */
+class AsyncFileReader : public PreadFileReader {
+public:
+    AsyncFileReader(size_t blockSize, size_t queueDepth)
+        : blockSize(blockSize < DirectFileReader::ALIGNMENT ? (size_t)DirectFileReader::ALIGNMENT
+                    : blockSize / DirectFileReader::ALIGNMENT * DirectFileReader::ALIGNMENT),
+          queueDepth(queueDepth), memory(NULL), engine(NULL), direct(false),
+          endHint(-1), nextRead(0), head(0), tail(0), inFlight(0) {}
+
+    ~AsyncFileReader() {
+        close();
+        if (engine) engine->stop();
+        delete engine;
+        free(memory);
+    }
+
+    void open(const std::string &filename, off_t offset, off_t endHint) {
+        this->endHint = endHint;
+        direct = openFd(filename, offset, O_DIRECT);
+        if (!direct) {
+            if (errno != EINVAL || !openFd(filename, offset, 0)) {
+                vt_report_error(0, "Error opening file [%s]", filename.c_str());
+            }
+            posix_fadvise(fd, offset, 0, POSIX_FADV_SEQUENTIAL);
+        }
+
+        if (memory == NULL && posix_memalign((void **)&memory, DirectFileReader::ALIGNMENT,
+                                             queueDepth * blockSize) != 0) {
+            memory = NULL;
+            vt_report_error(0, "Out of memory allocating %zu read buffers of %zu bytes", queueDepth, blockSize);
+        }
+        slots.resize(queueDepth);
+        for (size_t i = 0; i < queueDepth; i++) {
+            slots[i].buf = memory + i * blockSize;
+        }
+
+        startEngine();
+        restartAt(pos);
+    }
+
+    size_t read(char *buf, size_t len) {
+        size_t done = 0;
+        while (done < len && !atEnd()) {
+            if (head == tail) {
+                submitReads();
+                if (head == tail) break;
+            }
+            Slot &slot = slots[head % queueDepth];
+            if (!waitFor(slot)) continue;   // Started over without O_DIRECT
+
+            const off_t slotEnd = slot.offset + (off_t)slot.filled;
+            if (pos < slotEnd) {
+                const size_t n = std::min(len - done, (size_t)(slotEnd - pos));
+                memcpy(buf + done, slot.buf + (pos - slot.offset), n);
+                done += n;
+                pos += n;
+                continue;
+            }
+
+            if (slot.filled < slot.requested && slotEnd < fileSize) {
+                // Short read; read the rest of the block
+                issue(head % queueDepth, slot.filled);
+                flush();
+                continue;
+            }
+
+            // Used up this block; reuse its buffer for the next one
+            head++;
+            submitReads();
+        }
+        return done;
+    }
+
+    /**
+     * The engine is kept, so that a reader opened on one range after
+     * another (see FileRangeSource) only starts it once
+     */
+    void close() {
+        drain();
+        PreadFileReader::close();
+    }
+
+    /** "io_uring" or "thread pool" */
+    const char *getEngineName() const { return engine ? engine->getName() : ""; }
+
+private:
+    struct Slot {
+        char *buf;
+        off_t offset;       // File offset of buf[0]
+        size_t requested;
+        size_t filled;
+        bool inFlight;
+    };
+
+    void startEngine() {
+        if (engine) return;
+#ifdef HAVE_IO_URING
+        engine = new IoUringReadEngine();
+        if (engine->start(queueDepth)) return;
+        delete engine;
+#endif
+        engine = new ThreadPoolReadEngine();
+        if (!engine->start(queueDepth)) {
+            delete engine;
+            engine = NULL;
+            vt_report_error(0, "Could not start any read threads");
+        }
+    }
+
+    /** Discard all read blocks, and start reading again from `offset` */
+    void restartAt(off_t offset) {
+        head = tail = 0;
+        nextRead = offset / DirectFileReader::ALIGNMENT * DirectFileReader::ALIGNMENT;
+        submitReads();
+    }
+
+    /** Fill the queue with reads of the next blocks */
+    void submitReads() {
+        while (tail - head < queueDepth && nextRead < fileSize) {
+            // Past endHint, just keep one block in flight
+            if (tail > head && endHint >= 0 && nextRead >= endHint) break;
+
+            Slot &slot = slots[tail % queueDepth];
+            slot.offset = nextRead;
+            slot.requested = blockSize;
+            slot.filled = 0;
+            issue(tail % queueDepth, 0);
+            tail++;
+            nextRead += blockSize;
+        }
+        flush();
+    }
+
+    /** Read into slots[index], starting `from` bytes into its block */
+    void issue(size_t index, size_t from) {
+        Slot &slot = slots[index];
+        slot.inFlight = true;
+        inFlight++;
+        engine->read(fd, slot.buf + from, slot.requested - from, slot.offset + from, index);
+    }
+
+    void flush() {
+        if (!engine->flush()) {
+            vt_report_error(0, "Error reading file [%s]: %s", filename.c_str(), strerror(errno));
+        }
+    }
+
+    /**
+     * Wait for the read into `slot` to finish.
+     * Returns false if reading had to start over instead.
+     */
+    bool waitFor(Slot &slot) {
+        while (slot.inFlight) {
+            size_t index;
+            ssize_t result;
+            if (!engine->wait(index, result)) {
+                vt_report_error(0, "Error reading file [%s]: %s", filename.c_str(), strerror(errno));
+            }
+            Slot &done = slots[index];
+            done.inFlight = false;
+            inFlight--;
+
+            if (result == -EINVAL && direct) {
+                // This filesystem doesn't do O_DIRECT after all
+                reopenWithoutDirect();
+                return false;
+            }
+            if (result < 0) {
+                vt_report_error(0, "Error reading file [%s] at offset %lld: %s",
+                                filename.c_str(), (long long)(done.offset + done.filled), strerror(-result));
+            }
+            if (result == 0) {
+                // The file is shorter than it was
+                fileSize = std::min(fileSize, done.offset + (off_t)done.filled);
+            }
+            done.filled += result;
+        }
+        return true;
+    }
+
+    void reopenWithoutDirect() {
+        const off_t at = pos;
+        drain();
+        if (!openFd(filename, at, 0)) {
+            vt_report_error(0, "Error opening file [%s]", filename.c_str());
+        }
+        direct = false;
+        posix_fadvise(fd, at, 0, POSIX_FADV_SEQUENTIAL);
+        restartAt(at);
+    }
+
+    /** Wait for every read in flight, ignoring the results */
+    void drain() {
+        size_t index;
+        ssize_t result;
+        while (inFlight > 0 && engine && engine->wait(index, result)) {
+            slots[index].inFlight = false;
+            inFlight--;
+        }
+        inFlight = 0;
+        for (size_t i = 0; i < slots.size(); i++) {
+            slots[i].inFlight = false;
+        }
+    }
+
+    const size_t blockSize;
+    const size_t queueDepth;
+    char *memory;               // queueDepth blocks
+    std::vector<Slot> slots;    // Used round-robin, in file order
+    AsyncReadEngine *engine;
+    bool direct;
+    off_t endHint;
+
+    off_t nextRead;     // File offset of the next block to read
+    size_t head;        // Next slot to hand out data from
+    size_t tail;        // Next slot to read into
+    size_t inFlight;
+};
+
+/**
+ * Copies out of a mapping of the file, rather than read()ing it.  For
+ * files that are already in the page cache (e.g. ones loaded over and
+ * over), this skips the system calls and the kernel's copy.
+ *
+ * The whole rest of the file is mapped at once -- address space is
+ * cheap -- but only a couple of blocks ahead of the cursor are asked for
+ * (MADV_WILLNEED) at a time, and the mapping is unmapped behind the
+ * cursor as it goes, so that resident memory stays bounded.
+ *
+ * If the file is truncated while it's mapped, reading past its new end
+ * gets SIGBUS; don't use this for files that may be changing.
+ */
+class MmapFileReader : public PreadFileReader {
+public:
+    MmapFileReader(size_t blockSize)
+        : blockSize(blockSize), pageSize(sysconf(_SC_PAGESIZE)),
+          map(NULL), mapStart(0), mapEnd(0), unmappedTo(0), adviseTo(0) {}
+
+    ~MmapFileReader() { close(); }
+
+    void open(const std::string &filename, off_t offset, off_t endHint) {
+        if (!openFd(filename, offset, 0)) {
+            vt_report_error(0, "Error opening file [%s]", filename.c_str());
+        }
+        mapStart = unmappedTo = adviseTo = offset / pageSize * pageSize;
+        mapEnd = fileSize;
+        if (mapEnd <= mapStart) return;     // Nothing to map
+
+        void *p = mmap(NULL, mapEnd - mapStart, PROT_READ, MAP_SHARED, fd, mapStart);
+        if (p == MAP_FAILED) {
+            vt_report_error(0, "Error mapping file [%s]: %s", filename.c_str(), strerror(errno));
+        }
+        map = (char *)p;
+        madvise(map, mapEnd - mapStart, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+        // Only takes effect where the kernel supports huge pages for
+        // file mappings; harmless elsewhere
+        madvise(map, mapEnd - mapStart, MADV_HUGEPAGE);
+#endif
+    }
+
+    size_t read(char *buf, size_t len) {
+        const size_t n = std::min(len, (size_t)(fileSize - std::min(pos, fileSize)));
+        if (n == 0) return 0;
+
+        // Ask for the next couple of blocks
+        if (adviseTo < pos + (off_t)blockSize && adviseTo < mapEnd) {
+            const off_t from = std::max(adviseTo, pos);
+            const off_t to = std::min(mapEnd, from + 2 * (off_t)blockSize);
+            const off_t alignedFrom = from / pageSize * pageSize;
+            madvise(map + (alignedFrom - mapStart), to - alignedFrom, MADV_WILLNEED);
+            adviseTo = to;
+        }
+
+        memcpy(buf, map + (pos - mapStart), n);
+        pos += n;
+
+        // Give back what's behind us, a block at a time
+        if (pos - unmappedTo >= (off_t)blockSize) {
+            const off_t to = pos / pageSize * pageSize;
+            munmap(map + (unmappedTo - mapStart), to - unmappedTo);
+            unmappedTo = to;
+        }
+        return n;
+    }
+
+    void close() {
+        if (map && mapEnd > unmappedTo) {
+            munmap(map + (unmappedTo - mapStart), mapEnd - unmappedTo);
+        }
+        map = NULL;
+        PreadFileReader::close();
+    }
+
+private:
+    const size_t blockSize;
+    const off_t pageSize;
+    char *map;          // File offset mapStart is at map[0]
+    off_t mapStart;
+    off_t mapEnd;
+    off_t unmappedTo;   // [mapStart, unmappedTo) has been unmapped
+    off_t adviseTo;     // MADV_WILLNEED has been given up to here
+};
+
+inline FileReader *FileReader::create(const std::string &mode, size_t blockSize, size_t queueDepth) {
+    if (mode == "stdio") return new StdioFileReader();
+    if (mode == "buffered") return new BufferedFileReader(blockSize);
+    if (mode == "direct") return new DirectFileReader(blockSize);
+    if (mode == "async") return new AsyncFileReader(blockSize, queueDepth);
+    if (mode == "mmap") return new MmapFileReader(blockSize);
+    return NULL;
+}
+
+inline void FileReader::validateArgs(const std::string &mode, Vertica::vint blockSize, Vertica::vint queueDepth) {
+    if (mode != "stdio" && mode != "buffered" && mode != "direct" && mode != "async" && mode != "mmap") {
+        vt_report_error(0, "Invalid read_mode '%s': must be 'stdio', 'buffered', 'direct', 'async' or 'mmap'",
+                        mode.c_str());
+    }
+    if (blockSize < (Vertica::vint)DirectFileReader::ALIGNMENT || blockSize > (1LL << 30)) {
+        vt_report_error(0, "block_size must be between %zu and %lld bytes",
+                        DirectFileReader::ALIGNMENT, 1LL << 30);
+    }
+    if (queueDepth < 1 || queueDepth > 256) {
+        vt_report_error(0, "queue_depth must be between 1 and 256");
+    }
+}
+
+#endif // FILE_READERS_H_
@@ -0,0 +1,545 @@
+/* Copyright (c) 2005 - 2016 Hewlett Packard Enterprise Development LP  -*- C++ -*-*/
+/****************************
+ * Vertica Analytic Database
+ *
+ * UDL helper; random access into gzip files, using an index of inflate
+ * checkpoints (in the style of zlib's examples/zran.c).
+ *
+ ****************************/
+
+#include <zlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "Vertica.h"
+
+#ifndef GZIP_INDEX_H_
+#define GZIP_INDEX_H_
+
+/**
+ * A place in a gzip file that decompression can be started from.
+ *
+ * MEMBER_START checkpoints are the start of a gzip member; inflating
+ * can simply begin there.  MID_STREAM checkpoints are deflate block
+ * boundaries inside a member; starting there needs the bit offset
+ * within the starting byte and the 32KB of output preceding it, which
+ * is stored in the index.
+ */
+struct GZipCheckpoint {
+    enum Kind { MEMBER_START = 0, MID_STREAM = 1 };
+
+    uint64_t out;   // Offset in the uncompressed data
+    uint64_t in;    // Offset in the compressed file (of the first full byte)
+    int32_t bits;   // Bits of the byte before `in` that belong to this block
+    int32_t kind;
+};
+
+/**
+ * GZipIndex
+ *
+ * An index of checkpoints for one gzip file, kept in a sidecar file
+ * next to it (<file>.gzidx).  Building the index takes one full pass of
+ * decompression; after that, any range of the uncompressed data can be
+ * decompressed starting from the nearest checkpoint, so a large .gz
+ * file can be split up and loaded in parallel.
+ *
+ * The sidecar records the size and mtime of the file it was built from,
+ * and is rebuilt if they change.
+ */
+class GZipIndex {
+public:
+    static const size_t WINDOW_SIZE = 32768;
+
+    GZipIndex() : fileSize(0), fileMtime(0), totalOut(0), span(0) {}
+
+    static std::string sidecarPath(const std::string &path) {
+        return path + ".gzidx";
+    }
+
+    /** Is `path` a sidecar file (or one being written), rather than data? */
+    static bool isSidecarPath(const std::string &path) {
+        const std::string suffix = ".gzidx";
+        return (path.size() >= suffix.size()
+                && path.compare(path.size() - suffix.size(), suffix.size(), suffix) == 0)
+            || path.find(suffix + ".tmp.") != std::string::npos;
+    }
+
+    /**
+     * Load the sidecar index for `path`, building (and saving) it first
+     * if it is missing, out of date, or was built with a different
+     * `span` (the amount of uncompressed data between checkpoints).
+     *
+     * The sidecar is only a cache: if it can't be written, the index
+     * keeps its windows in memory, thinned out to at most
+     * MAX_MEMORY_WINDOW_BYTES, and works just the same.
+     */
+    void loadOrBuild(Vertica::ServerInterface &srvInterface, const std::string &path, size_t span) {
+        if (load(path)) {
+            if (this->span == span) return;
+            srvInterface.log("GZipIndex: index file [%s] has a span of %llu bytes, not %llu; rebuilding it",
+                             sidecarPath(path).c_str(), (unsigned long long)this->span,
+                             (unsigned long long)span);
+        }
+
+        srvInterface.log("GZipIndex: building index for [%s]", path.c_str());
+        build(path, span);
+        if (save(path)) {
+            // readWindow() reads them back from the sidecar as needed
+            std::vector<unsigned char>().swap(windows);
+        } else {
+            srvInterface.log("GZipIndex: could not write index file [%s]; keeping the index in memory",
+                             sidecarPath(path).c_str());
+            thinWindows(srvInterface);
+        }
+    }
+
+    /**
+     * Just the start of `path`; enough to read it from the beginning,
+     * without the pass over the file that build() takes.
+     */
+    void initStartOnly() {
+        span = 0;
+        checkpoints.clear();
+        windows.clear();
+        addCheckpoint(0, 0, 0, GZipCheckpoint::MEMBER_START, NULL);
+    }
+
+    /**
+     * Load the sidecar index for `path`, without the windows (see
+     * readWindow()).  Returns false if there is no usable index.
+     */
+    bool load(const std::string &path) {
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0) return false;
+
+        FILE *f = fopen(sidecarPath(path).c_str(), "r");
+        if (f == NULL) return false;
+
+        char magic[MAGIC_SIZE];
+        uint64_t header[5];
+        bool ok = fread(magic, MAGIC_SIZE, 1, f) == 1
+            && memcmp(magic, getMagic(), MAGIC_SIZE) == 0
+            && fread(header, sizeof(header), 1, f) == 1
+            && header[0] == (uint64_t)st.st_size
+            && header[1] == (uint64_t)st.st_mtime;
+        if (ok) {
+            fileSize = header[0];
+            fileMtime = header[1];
+            totalOut = header[2];
+            span = header[3];
+            checkpoints.resize(header[4]);
+            ok = checkpoints.empty()
+                || fread(&checkpoints[0], sizeof(GZipCheckpoint), checkpoints.size(), f) == checkpoints.size();
+        }
+        fclose(f);
+        return ok;
+    }
+
+    /**
+     * Decompress all of `path`, recording a checkpoint roughly every
+     * `span` bytes of output.
+     */
+    void build(const std::string &path, size_t span) {
+        this->span = span;
+        checkpoints.clear();
+        windows.clear();
+
+        FILE *in = fopen(path.c_str(), "r");
+        if (in == NULL) {
+            vt_report_error(0, "Error opening file [%s]", path.c_str());
+        }
+        struct stat st;
+        fstat(fileno(in), &st);
+        fileSize = st.st_size;
+        fileMtime = st.st_mtime;
+
+        z_stream strm;
+        memset(&strm, 0, sizeof(strm));
+        if (inflateInit2(&strm, 16 + MAX_WBITS) != Z_OK) {
+            fclose(in);
+            vt_report_error(0, "Error occurred during ZLIB initialization");
+        }
+
+        std::vector<unsigned char> input(CHUNK_SIZE);
+        std::vector<unsigned char> window(WINDOW_SIZE);
+        uint64_t totalIn = 0, lastCheckpoint = 0;
+        totalOut = 0;
+        addCheckpoint(0, 0, 0, GZipCheckpoint::MEMBER_START, NULL);
+
+        int ret = Z_OK;
+        strm.avail_out = 0;
+        bool inMember = true;
+        while (true) {
+            if (strm.avail_in == 0) {
+                strm.avail_in = fread(&input[0], 1, CHUNK_SIZE, in);
+                strm.next_in = &input[0];
+                if (strm.avail_in == 0) break;
+            }
+
+            // A new member following the previous one?
+            if (!inMember) {
+                if (strm.next_in[0] != 0x1f) break;  // Trailing garbage; ignore it like gzip does
+                inflateReset(&strm);
+                inMember = true;
+                if (totalOut - lastCheckpoint >= span) {
+                    addCheckpoint(totalOut, totalIn, 0, GZipCheckpoint::MEMBER_START, NULL);
+                    lastCheckpoint = totalOut;
+                }
+            }
+
+            if (strm.avail_out == 0) {
+                strm.avail_out = WINDOW_SIZE;
+                strm.next_out = &window[0];
+            }
+            totalIn += strm.avail_in;
+            totalOut += strm.avail_out;
+            ret = inflate(&strm, Z_BLOCK);  // Stop at the end of each deflate block
+            totalIn -= strm.avail_in;
+            totalOut -= strm.avail_out;
+
+            if (ret == Z_STREAM_END) {
+                inMember = false;
+                continue;
+            }
+            if (ret != Z_OK && ret != Z_BUF_ERROR) {
+                const std::string msg = strm.msg ? strm.msg : "invalid data";
+                inflateEnd(&strm);
+                fclose(in);
+                vt_report_error(0, "Error decompressing [%s] at offset %llu: %s", path.c_str(),
+                                (unsigned long long)totalIn, msg.c_str());
+            }
+
+            // At the end of a block (but not the last one)?
+            if ((strm.data_type & 128) && !(strm.data_type & 64)
+                    && totalOut - lastCheckpoint >= span) {
+                // The window is circular; the last 32KB of output ends at next_out
+                std::vector<unsigned char> lastWindow(WINDOW_SIZE);
+                const size_t left = strm.avail_out;
+                memcpy(&lastWindow[0], &window[0] + WINDOW_SIZE - left, left);
+                memcpy(&lastWindow[0] + left, &window[0], WINDOW_SIZE - left);
+
+                addCheckpoint(totalOut, totalIn, strm.data_type & 7, GZipCheckpoint::MID_STREAM,
+                              &lastWindow[0]);
+                lastCheckpoint = totalOut;
+            }
+        }
+
+        inflateEnd(&strm);
+        fclose(in);
+        if (inMember) {
+            vt_report_error(0, "Unexpected end of file in [%s]", path.c_str());
+        }
+    }
+
+    /**
+     * Write the index built by build() to the sidecar file.
+     * Written to a temporary file and renamed, so that concurrent
+     * readers never see a partial index.
+     */
+    bool save(const std::string &path) {
+        char tmpSuffix[64];
+        snprintf(tmpSuffix, sizeof(tmpSuffix), ".tmp.%d", (int)getpid());
+        const std::string tmpPath = sidecarPath(path) + tmpSuffix;
+
+        FILE *f = fopen(tmpPath.c_str(), "w");
+        if (f == NULL) return false;
+
+        uint64_t header[5] = { fileSize, fileMtime, totalOut, span, checkpoints.size() };
+        bool ok = fwrite(getMagic(), MAGIC_SIZE, 1, f) == 1
+            && fwrite(header, sizeof(header), 1, f) == 1
+            && (checkpoints.empty()
+                || fwrite(&checkpoints[0], sizeof(GZipCheckpoint), checkpoints.size(), f) == checkpoints.size())
+            && (windows.empty() || fwrite(&windows[0], 1, windows.size(), f) == windows.size());
+        ok = (fclose(f) == 0) && ok;
+
+        if (!ok || rename(tmpPath.c_str(), sidecarPath(path).c_str()) != 0) {
+            unlink(tmpPath.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Index of the last checkpoint at or before uncompressed offset `out`
+     */
+    size_t findCheckpoint(uint64_t out) const {
+        size_t lo = 0, hi = checkpoints.size();
+        while (hi - lo > 1) {
+            const size_t mid = (lo + hi) / 2;
+            if (checkpoints[mid].out <= out) lo = mid; else hi = mid;
+        }
+        return lo;
+    }
+
+    /**
+     * Read the 32KB window for MID_STREAM checkpoint `i`, from memory if
+     * the index was built here and not saved, otherwise from the sidecar
+     */
+    bool readWindow(const std::string &path, size_t i, unsigned char *window) const {
+        // Windows are stored in checkpoint order, for MID_STREAM checkpoints only
+        size_t windowIndex = 0;
+        for (size_t j = 0; j < i; j++) {
+            if (checkpoints[j].kind == GZipCheckpoint::MID_STREAM) windowIndex++;
+        }
+        if (!windows.empty()) {
+            if ((windowIndex + 1) * WINDOW_SIZE > windows.size()) return false;
+            memcpy(window, &windows[windowIndex * WINDOW_SIZE], WINDOW_SIZE);
+            return true;
+        }
+        FILE *f = fopen(sidecarPath(path).c_str(), "r");
+        if (f == NULL) return false;
+        const long offset = MAGIC_SIZE + 5 * sizeof(uint64_t)
+            + checkpoints.size() * sizeof(GZipCheckpoint) + windowIndex * WINDOW_SIZE;
+        bool ok = fseek(f, offset, SEEK_SET) == 0 && fread(window, WINDOW_SIZE, 1, f) == 1;
+        fclose(f);
+        return ok;
+    }
+
+    uint64_t getUncompressedSize() const { return totalOut; }
+    const std::vector<GZipCheckpoint> &getCheckpoints() const { return checkpoints; }
+
+private:
+    static const size_t CHUNK_SIZE = 256 * 1024;
+
+    // Most window data an unsaved index keeps in memory
+    static const size_t MAX_MEMORY_WINDOW_BYTES = 64 * 1024 * 1024;
+
+    // Sidecar file format version marker, including the '\0'
+    static const size_t MAGIC_SIZE = 8;
+    static const char *getMagic() { return "VGZIDX1"; }
+
+    /**
+     * Drop MID_STREAM checkpoints, keeping every n-th, until their
+     * windows fit in MAX_MEMORY_WINDOW_BYTES.  Portions get coarser,
+     * but the index stays correct.
+     */
+    void thinWindows(Vertica::ServerInterface &srvInterface) {
+        const size_t maxWindows = MAX_MEMORY_WINDOW_BYTES / WINDOW_SIZE;
+        const size_t nWindows = windows.size() / WINDOW_SIZE;
+        if (nWindows <= maxWindows) return;
+
+        const size_t keepEvery = (nWindows + maxWindows - 1) / maxWindows;
+        std::vector<GZipCheckpoint> keptCheckpoints;
+        std::vector<unsigned char> keptWindows;
+        size_t windowIndex = 0;
+        for (size_t i = 0; i < checkpoints.size(); i++) {
+            if (checkpoints[i].kind == GZipCheckpoint::MID_STREAM) {
+                if (windowIndex % keepEvery == 0) {
+                    keptCheckpoints.push_back(checkpoints[i]);
+                    keptWindows.insert(keptWindows.end(), &windows[windowIndex * WINDOW_SIZE],
+                                       &windows[windowIndex * WINDOW_SIZE] + WINDOW_SIZE);
+                }
+                windowIndex++;
+            } else {
+                keptCheckpoints.push_back(checkpoints[i]);
+            }
+        }
+        srvInterface.log("GZipIndex: keeping %llu of %llu checkpoints in memory; "
+                         "make the directory writable, or raise index_span_mb, to keep them all",
+                         (unsigned long long)(keptWindows.size() / WINDOW_SIZE),
+                         (unsigned long long)nWindows);
+        checkpoints.swap(keptCheckpoints);
+        windows.swap(keptWindows);
+        span *= keepEvery;
+    }
+
+    void addCheckpoint(uint64_t out, uint64_t in, int bits, GZipCheckpoint::Kind kind,
+                       const unsigned char *window) {
+        GZipCheckpoint cp;
+        cp.out = out;
+        cp.in = in;
+        cp.bits = bits;
+        cp.kind = kind;
+        checkpoints.push_back(cp);
+        if (window) windows.insert(windows.end(), window, window + WINDOW_SIZE);
+    }
+
+    uint64_t fileSize;
+    uint64_t fileMtime;
+    uint64_t totalOut;
+    uint64_t span;
+    std::vector<GZipCheckpoint> checkpoints;
+    std::vector<unsigned char> windows;  // Only kept if built here and not saved
+};
+
+/**
+ * GZipIndexReader
+ *
+ * Decompresses a gzip file starting at an arbitrary uncompressed
+ * offset, by starting from the nearest preceding checkpoint in a
+ * GZipIndex and discarding output up to that offset.
+ */
+class GZipIndexReader {
+public:
+    GZipIndexReader() : in(NULL), zInitialized(false), inMember(false), rawMode(false),
+                        skip(0), eof(false) {}
+
+    ~GZipIndexReader() { close(); }
+
+    /** Open `path` for reading from uncompressed offset `start` */
+    void open(const std::string &path, const GZipIndex &index, uint64_t start) {
+        close();
+        this->path = path;
+        in = fopen(path.c_str(), "r");
+        if (in == NULL) {
+            vt_report_error(0, "Error opening file [%s]", path.c_str());
+        }
+
+        memset(&strm, 0, sizeof(strm));
+        input.resize(CHUNK_SIZE);
+        eof = false;
+
+        const size_t i = index.findCheckpoint(start);
+        const GZipCheckpoint &cp = index.getCheckpoints()[i];
+        skip = start - cp.out;
+
+        if (cp.kind == GZipCheckpoint::MEMBER_START) {
+            seek(cp.in);
+            initInflate(16 + MAX_WBITS);
+            rawMode = false;
+        } else {
+            // Mid-member: raw deflate, primed with the partial byte and
+            // the preceding 32KB of output
+            unsigned char window[GZipIndex::WINDOW_SIZE];
+            if (!index.readWindow(path, i, window)) {
+                vt_report_error(0, "Could not read index file [%s]", GZipIndex::sidecarPath(path).c_str());
+            }
+            seek(cp.in - (cp.bits ? 1 : 0));
+            initInflate(-MAX_WBITS);
+            rawMode = true;
+            if (cp.bits) {
+                const int ch = fgetc(in);
+                if (ch == EOF) {
+                    vt_report_error(0, "Unexpected end of file in [%s]", path.c_str());
+                }
+                inflatePrime(&strm, cp.bits, ch >> (8 - cp.bits));
+            }
+            inflateSetDictionary(&strm, window, GZipIndex::WINDOW_SIZE);
+        }
+        inMember = true;
+    }
+
+    /**
+     * Decompress up to `len` bytes into `buf`.
+     * Returns the number of bytes written; 0 only at end of file.
+     */
+    size_t read(char *buf, size_t len) {
+        size_t produced = 0;
+        while (produced < len && !eof) {
+            // Discard output preceding the requested start offset
+            char discard[16384];
+            const bool skipping = skip > 0;
+            strm.next_out = skipping ? (Bytef*)discard : (Bytef*)(buf + produced);
+            strm.avail_out = skipping ? std::min((uint64_t)sizeof(discard), skip) : len - produced;
+            const size_t availOut = strm.avail_out;
+
+            if (strm.avail_in == 0 && !fill()) {
+                if (inMember) {
+                    vt_report_error(0, "Unexpected end of file in [%s]", path.c_str());
+                }
+                eof = true;
+                break;
+            }
+
+            if (!inMember) {
+                // Start of the next member, or trailing garbage (ignored, like gzip does)
+                if (strm.next_in[0] != 0x1f) {
+                    eof = true;
+                    break;
+                }
+                if (rawMode) {
+                    inflateReset2(&strm, 16 + MAX_WBITS);
+                    rawMode = false;
+                } else {
+                    inflateReset(&strm);
+                }
+                inMember = true;
+            }
+
+            const int ret = inflate(&strm, Z_NO_FLUSH);
+            const size_t got = availOut - strm.avail_out;
+            if (skipping) {
+                skip -= got;
+            } else {
+                produced += got;
+            }
+
+            if (ret == Z_STREAM_END) {
+                inMember = false;
+                // Raw deflate stops before the member's 8-byte gzip trailer
+                if (rawMode && !skipTrailer()) {
+                    vt_report_error(0, "Unexpected end of file in [%s]", path.c_str());
+                }
+            } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+                vt_report_error(0, "Error decompressing [%s]: %s", path.c_str(),
+                                strm.msg ? strm.msg : "invalid data");
+            }
+        }
+        return produced;
+    }
+
+    bool isEof() const { return eof; }
+
+    void close() {
+        if (zInitialized) inflateEnd(&strm);
+        zInitialized = false;
+        if (in) fclose(in);
+        in = NULL;
+    }
+
+private:
+    static const size_t CHUNK_SIZE = 256 * 1024;
+
+    // Most window data an unsaved index keeps in memory
+    static const size_t MAX_MEMORY_WINDOW_BYTES = 64 * 1024 * 1024;
+
+    void seek(uint64_t offset) {
+        if (fseeko(in, offset, SEEK_SET) != 0) {
+            vt_report_error(0, "disk seek failed for file %s at offset %llu", path.c_str(),
+                            (unsigned long long)offset);
+        }
+    }
+
+    void initInflate(int windowBits) {
+        if (inflateInit2(&strm, windowBits) != Z_OK) {
+            vt_report_error(0, "Error occurred during ZLIB initialization");
+        }
+        zInitialized = true;
+    }
+
+    bool fill() {
+        strm.avail_in = fread(&input[0], 1, CHUNK_SIZE, in);
+        strm.next_in = &input[0];
+        return strm.avail_in > 0;
+    }
+
+    bool skipTrailer() {
+        size_t trailer = 8;
+        while (trailer > 0) {
+            if (strm.avail_in == 0 && !fill()) return false;
+            const size_t n = std::min((size_t)strm.avail_in, trailer);
+            strm.next_in += n;
+            strm.avail_in -= n;
+            trailer -= n;
+        }
+        return true;
+    }
+
+    std::string path;
+    FILE *in;
+    std::vector<unsigned char> input;
+    z_stream strm;
+    bool zInitialized;
+    bool inMember;
+    bool rawMode;
+    uint64_t skip;
+    bool eof;
+};
+
+#endif // GZIP_INDEX_H_
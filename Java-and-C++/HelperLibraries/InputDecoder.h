@@ -0,0 +1,235 @@
+/* Copyright (c) 2005 - 2016 Hewlett Packard Enterprise Development LP  -*- C++ -*-*/
+/****************************
+ * Vertica Analytic Database
+ *
+ * UDL helper; decompressing and transcoding input inside a parser,
+ * rather than in filters ahead of it.
+ *
+ ****************************/
+
+#include <zlib.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+
+#include "Vertica.h"
+#include "Transcoders.h"
+
+#ifndef INPUT_DECODER_H_
+#define INPUT_DECODER_H_
+
+/**
+ * InputDecoder
+ *
+ * Gunzips and/or converts to UTF-8 (see Utf8Transcoder), from one
+ * buffer into another.  Either step may be left out.  When there are
+ * both, the inflated data goes through a small staging buffer.
+ *
+ * Gzip input may consist of several members (e.g. concatenated .gz
+ * files), as with the GZip filter.
+ */
+class InputDecoder {
+public:
+    InputDecoder() : gzip(false), zInitialized(false), inMember(false),
+                     encoding(Utf8Transcoder::NONE), transcodedBytes(0), stagePos(0), stageLen(0) {}
+
+    ~InputDecoder() { close(); }
+
+    static const size_t STAGING_SIZE = 65536;
+
+    void init(bool gzip, Utf8Transcoder::Encoding encoding) {
+        close();
+        this->gzip = gzip;
+        this->encoding = encoding;
+        transcoder = Utf8Transcoder(encoding);
+        inMember = false;
+        transcodedBytes = 0;
+        stagePos = stageLen = 0;
+
+        if (gzip) {
+            memset(&zstrm, 0, sizeof(zstrm));
+            // 32 + MAX_WBITS: detect gzip or zlib headers
+            if (inflateInit2(&zstrm, 32 + MAX_WBITS) != Z_OK) {
+                vt_report_error(0, "Error occurred during ZLIB initialization");
+            }
+            zInitialized = true;
+            if (encoding != Utf8Transcoder::NONE) staging.resize(STAGING_SIZE);
+        }
+    }
+
+    void close() {
+        if (zInitialized) inflateEnd(&zstrm);
+        zInitialized = false;
+    }
+
+    /**
+     * Decode as much of in[in.offset, in.size) as fits into
+     * out[0, outLen), advancing in.offset past what was used.
+     * `atEnd` says whether the input ends there.
+     *
+     * Returns the number of bytes written to `out`, and sets `finished`
+     * once everything has been decoded and written.
+     */
+    size_t decode(Vertica::DataBuffer &in, bool atEnd, char *out, size_t outLen, bool &finished) {
+        size_t produced = 0;
+        if (!gzip) {
+            produced = transcode((const unsigned char *)in.buf, in.size, in.offset, out, outLen, atEnd);
+            finished = atEnd && in.offset == in.size;
+            return produced;
+        }
+
+        if (encoding == Utf8Transcoder::NONE) {
+            produced = inflateSome(in, out, outLen);
+        } else {
+            while (produced < outLen) {
+                // Convert what's staged
+                produced += transcode(&staging[0], stageLen, stagePos, out + produced, outLen - produced,
+                                      atEnd && in.offset == in.size && !inMember);
+                if (produced == outLen) break;
+
+                // Stage more; keeping any incomplete character at the end
+                memmove(&staging[0], &staging[stagePos], stageLen - stagePos);
+                stageLen -= stagePos;
+                stagePos = 0;
+                const size_t inflated = inflateSome(in, (char *)&staging[stageLen], staging.size() - stageLen);
+                stageLen += inflated;
+                if (inflated == 0) break;
+            }
+        }
+
+        // Stopped short of filling the output, with nothing left to feed
+        // inflate, but partway through a member?
+        if (atEnd && in.offset == in.size && inMember && produced < outLen) {
+            vt_report_error(0, "Error occurred during ZLIB decompression.  Message: Truncated input");
+        }
+        finished = atEnd && in.offset == in.size && !inMember && stagePos == stageLen;
+        return produced;
+    }
+
+private:
+    /** Inflate into out[0, outLen); returns the number of bytes inflated */
+    size_t inflateSome(Vertica::DataBuffer &in, char *out, size_t outLen) {
+        size_t produced = 0;
+        while (produced < outLen && (in.offset < in.size || inMember)) {
+            zstrm.next_in = (Bytef *)(in.buf + in.offset);
+            zstrm.avail_in = in.size - in.offset;
+            zstrm.next_out = (Bytef *)(out + produced);
+            zstrm.avail_out = outLen - produced;
+
+            const int zReturn = inflate(&zstrm, Z_SYNC_FLUSH);
+            const size_t used = (in.size - in.offset) - zstrm.avail_in;
+            const size_t made = (outLen - produced) - zstrm.avail_out;
+            in.offset += used;
+            produced += made;
+
+            if (zReturn == Z_STREAM_END) {
+                // End of a member; the next one (if any) starts after it
+                inMember = false;
+                inflateReset2(&zstrm, 32 + MAX_WBITS);
+                continue;
+            }
+            if (zReturn != Z_OK && zReturn != Z_BUF_ERROR) {
+                vt_report_error(0, "Error occurred during ZLIB decompression.  Message: %s",
+                                zstrm.msg ? zstrm.msg : "(unknown)");
+            }
+            if (used > 0) inMember = true;
+            if (used == 0 && made == 0) break;  // Needs more input
+        }
+        return produced;
+    }
+
+    /** Convert from in[inPos, inLen) into out[0, outLen), or copy if there's no conversion */
+    size_t transcode(const unsigned char *in, size_t inLen, size_t &inPos,
+                     char *out, size_t outLen, bool atEnd) {
+        if (encoding == Utf8Transcoder::NONE) {
+            const size_t n = std::min(inLen - inPos, outLen);
+            memcpy(out, in + inPos, n);
+            inPos += n;
+            return n;
+        }
+
+        size_t produced = 0;
+        const size_t start = inPos;
+        const Utf8Transcoder::Result result = transcoder.transcode(in, inLen, inPos,
+                (unsigned char *)out, outLen, produced);
+        transcodedBytes += inPos - start;
+        if (result == Utf8Transcoder::INVALID) {
+            vt_report_error(1, "Invalid byte sequence at byte offset %llu of the decompressed input",
+                            (unsigned long long)transcodedBytes);
+        }
+        if (result == Utf8Transcoder::INCOMPLETE && atEnd) {
+            vt_report_error(1, "Incomplete character at byte offset %llu, at the end of the input",
+                            (unsigned long long)transcodedBytes);
+        }
+        return produced;
+    }
+
+    bool gzip;
+    z_stream zstrm;
+    bool zInitialized;
+    bool inMember;      // Partway through a gzip member
+
+    Utf8Transcoder::Encoding encoding;
+    Utf8Transcoder transcoder;
+    uint64_t transcodedBytes;
+
+    // Inflated data waiting to be transcoded
+    std::vector<unsigned char> staging;
+    size_t stagePos;
+    size_t stageLen;
+};
+
+/**
+ * DecodedWindow
+ *
+ * The buffer that a parser with a built-in InputDecoder hands to its
+ * parsing code in place of the server's input buffer.
+ *
+ * It plays the part of the server: when the parser asks for more input,
+ * the unconsumed data is moved to the front and more is decoded after
+ * it; and the window grows if the parser needs more than it can hold.
+ * Kept small, the window stays in cache between decoding and parsing.
+ */
+class DecodedWindow {
+public:
+    DecodedWindow() : finished(false) {
+        buffer.buf = NULL;
+        buffer.size = buffer.offset = 0;
+    }
+
+    void init(size_t size) {
+        storage.resize(size);
+        buffer.buf = &storage[0];
+        buffer.size = buffer.offset = 0;
+        finished = false;
+    }
+
+    /**
+     * Decode more input into the window.
+     * Returns false if no more can be decoded until there is more input.
+     */
+    bool fill(InputDecoder &decoder, Vertica::DataBuffer &input, bool atEnd) {
+        // Keep what hasn't been consumed
+        const size_t kept = buffer.size - buffer.offset;
+        memmove(&storage[0], &storage[buffer.offset], kept);
+        if (kept == storage.size()) storage.resize(storage.size() * 2);
+        buffer.buf = &storage[0];
+        buffer.offset = 0;
+        buffer.size = kept;
+
+        const size_t produced = decoder.decode(input, atEnd, &storage[kept], storage.size() - kept, finished);
+        buffer.size += produced;
+        return produced > 0 || finished;
+    }
+
+    Vertica::DataBuffer &getBuffer() { return buffer; }
+
+    Vertica::InputState getState() const { return finished ? Vertica::END_OF_FILE : Vertica::OK; }
+
+private:
+    std::vector<char> storage;
+    Vertica::DataBuffer buffer;
+    bool finished;
+};
+
+#endif // INPUT_DECODER_H_
@@ -4,6 +4,8 @@
 #include <vector>
 #include <set>
 #include <utility>
+#include <stdlib.h>
+#include <ctype.h>
 
 #include "Vertica.h"
 
@@ -184,6 +186,52 @@ inline void validatePerColumnArgs(std::string fnName, std::vector<ColArgEntry> &
     }
 }
 
+/**
+ * Split a list-valued argument on unescaped `separator`.  A backslash
+ * escapes the separator or itself, and \n, \t, \r and \xHH give control
+ * and binary bytes.
+ *
+ * Calls vt_report_error() on a malformed escape.
+ */
+inline std::vector<std::string> splitEscapedList(const std::string &list, char separator, const std::string &argName) {
+    std::vector<std::string> items(1);
+    for (size_t i = 0; i < list.size(); i++) {
+        const char c = list[i];
+        if (c == separator) {
+            items.push_back(std::string());
+            continue;
+        }
+        if (c != '\\') {
+            items.back() += c;
+            continue;
+        }
+
+        if (++i == list.size()) {
+            vt_report_error(0, "Dangling backslash at the end of '%s'", argName.c_str());
+        }
+        switch (list[i]) {
+        case 'n': items.back() += '\n'; break;
+        case 't': items.back() += '\t'; break;
+        case 'r': items.back() += '\r'; break;
+        case 'x': {
+            if (i + 2 >= list.size() || !isxdigit((unsigned char)list[i + 1])
+                    || !isxdigit((unsigned char)list[i + 2])) {
+                vt_report_error(0, "Bad \\x escape in '%s'; expected two hex digits", argName.c_str());
+            }
+            items.back() += (char)strtol(list.substr(i + 1, 2).c_str(), NULL, 16);
+            i += 2;
+            break;
+        }
+        default:
+            if (list[i] != separator && list[i] != '\\') {
+                vt_report_error(0, "Unknown escape '\\%c' in '%s'", list[i], argName.c_str());
+            }
+            items.back() += list[i];
+        }
+    }
+    return items;
+}
+
 // @INTERNAL helper function
 inline std::string _nodeNames(const std::vector<std::string> &executionNodes) {
     // Helper for error-reporting.  Not for external use.
@@ -0,0 +1,228 @@
+/* Copyright (c) 2005 - 2016 Hewlett Packard Enterprise Development LP  -*- C++ -*-*/
+/****************************
+ * Vertica Analytic Database
+ *
+ * UDL helper; finding any of a set of byte strings in one pass over the
+ * data, with an Aho-Corasick automaton.
+ *
+ ****************************/
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <deque>
+
+#ifndef MULTI_PATTERN_MATCHER_H_
+#define MULTI_PATTERN_MATCHER_H_
+
+/**
+ * MultiPatternMatcher
+ *
+ * Finds occurrences of any of a set of patterns.  When several patterns
+ * match, the one starting first wins, and of those starting at the same
+ * place, the longest.
+ *
+ * The automaton is a DFA over byte classes: bytes that play the same
+ * role in every pattern (in particular, all bytes that occur in no
+ * pattern) share a column of the transition table, which keeps the
+ * table small.
+ *
+ * Usage: addPattern() each pattern, then compile(), then find().
+ */
+class MultiPatternMatcher {
+public:
+    MultiPatternMatcher() : numClasses(0), maxLength(0) {}
+
+    /** Add a pattern; patterns are numbered in the order they are added */
+    void addPattern(const std::string &pattern) {
+        patterns.push_back(pattern);
+        if (pattern.size() > maxLength) maxLength = pattern.size();
+    }
+
+    size_t numPatterns() const { return patterns.size(); }
+    size_t maxPatternLength() const { return maxLength; }
+    const std::string &getPattern(size_t i) const { return patterns[i]; }
+
+    /** Build the automaton.  Patterns must be non-empty. */
+    void compile() {
+        buildByteClasses();
+
+        // The trie; state 0 is the root
+        delta.assign(numClasses, -1);
+        depth.assign(1, 0);
+        terminal.assign(1, -1);
+        for (size_t p = 0; p < patterns.size(); p++) {
+            int32_t state = 0;
+            for (size_t i = 0; i < patterns[p].size(); i++) {
+                const int32_t c = byteClass[(unsigned char)patterns[p][i]];
+                if (delta[state * numClasses + c] < 0) {
+                    delta[state * numClasses + c] = depth.size();
+                    delta.resize(delta.size() + numClasses, -1);
+                    depth.push_back(depth[state] + 1);
+                    terminal.push_back(-1);
+                }
+                state = delta[state * numClasses + c];
+            }
+            if (terminal[state] < 0) terminal[state] = p;  // First of any duplicates wins
+        }
+
+        // Failure links, breadth first, turning the trie into a DFA
+        const size_t numStates = depth.size();
+        std::vector<int32_t> fail(numStates, 0);
+        matchLength.assign(numStates, 0);
+        std::deque<int32_t> queue;
+        for (size_t c = 0; c < numClasses; c++) {
+            int32_t &next = delta[c];
+            if (next < 0) {
+                next = 0;
+            } else {
+                queue.push_back(next);
+            }
+        }
+        while (!queue.empty()) {
+            const int32_t state = queue.front();
+            queue.pop_front();
+            matchLength[state] = (terminal[state] >= 0) ?
+                depth[state] : matchLength[fail[state]];
+            for (size_t c = 0; c < numClasses; c++) {
+                int32_t &next = delta[state * numClasses + c];
+                if (next < 0) {
+                    next = delta[fail[state] * numClasses + c];
+                } else {
+                    fail[next] = delta[fail[state] * numClasses + c];
+                    queue.push_back(next);
+                }
+            }
+        }
+
+        hasChildren.assign(numStates, false);
+        for (size_t s = 0; s < numStates; s++) {
+            for (size_t c = 0; c < numClasses; c++) {
+                if (isChild(s, delta[s * numClasses + c])) hasChildren[s] = true;
+            }
+        }
+    }
+
+    /**
+     * Look for the first match in buf[0, len).  `atEnd` says whether
+     * the data ends at `len`, or more may follow.
+     *
+     * Returns true and sets `start` and `pattern` if a match was found.
+     * Otherwise returns false, and sets `start` to the number of bytes
+     * at the front of buf in which no match can start; any match that
+     * may start after that needs more data to be decided.
+     */
+    bool find(const char *buf, size_t len, bool atEnd, size_t &start, size_t &pattern) const {
+        const unsigned char *data = (const unsigned char *)buf;
+
+        // Run the DFA until the first position where a match ends
+        int32_t state = 0;
+        size_t i = 0;
+        for (; i < len; i++) {
+            if (state == 0) {
+                // Skip quickly over bytes that can't start a match
+                while (i < len && !isFirstByte[data[i]]) i++;
+                if (i == len) break;
+            }
+            state = delta[state * numClasses + byteClass[data[i]]];
+            if (matchLength[state]) break;
+        }
+        if (i == len) {
+            // The last depth[state] bytes might be the start of a match
+            start = atEnd ? len : len - depth[state];
+            return false;
+        }
+
+        // The earliest-ending match ends at i.  A longer match starting
+        // before it would also end at or after i, so it starts no earlier
+        // than maxLength bytes back.
+        const size_t end = i + 1;
+        const size_t earliestStart = end - matchLength[state];
+        for (size_t s = (end > maxLength) ? end - maxLength : 0; s <= earliestStart; s++) {
+            if (!isFirstByte[data[s]]) continue;
+            switch (longestAt(data, len, s, atEnd, pattern)) {
+            case FOUND:
+                start = s;
+                return true;
+            case UNDECIDED:
+                start = s;
+                return false;
+            case NONE:
+                break;
+            }
+        }
+        // Not reached: the match ending at i starts at earliestStart
+        start = earliestStart;
+        return false;
+    }
+
+private:
+    enum LongestResult { FOUND, NONE, UNDECIDED };
+
+    /** Is `next` a child of `state` in the trie (rather than a failure transition)? */
+    bool isChild(size_t state, int32_t next) const {
+        return depth[next] == depth[state] + 1;
+    }
+
+    /** Find the longest pattern starting at data[s] */
+    LongestResult longestAt(const unsigned char *data, size_t len, size_t s, bool atEnd, size_t &pattern) const {
+        int32_t state = 0;
+        int32_t best = -1;
+        size_t j = s;
+        for (; j < len; j++) {
+            const int32_t next = delta[state * numClasses + byteClass[data[j]]];
+            if (!isChild(state, next)) break;
+            state = next;
+            if (terminal[state] >= 0) best = terminal[state];
+            if (!hasChildren[state]) break;
+        }
+        // Ran out of data while a longer pattern could still match?
+        if (j == len && !atEnd && hasChildren[state]) return UNDECIDED;
+        if (best < 0) return NONE;
+        pattern = best;
+        return FOUND;
+    }
+
+    void buildByteClasses() {
+        // Two bytes share a class if they occur at exactly the same
+        // pattern positions; signatures are built up pattern by pattern
+        std::vector<std::vector<uint32_t> > signature(256);
+        uint32_t position = 0;
+        for (size_t p = 0; p < patterns.size(); p++) {
+            for (size_t i = 0; i < patterns[p].size(); i++, position++) {
+                signature[(unsigned char)patterns[p][i]].push_back(position);
+            }
+        }
+
+        byteClass.assign(256, 0);
+        std::vector<std::vector<uint32_t> > classSignatures;
+        for (size_t b = 0; b < 256; b++) {
+            size_t c = 0;
+            while (c < classSignatures.size() && classSignatures[c] != signature[b]) c++;
+            if (c == classSignatures.size()) classSignatures.push_back(signature[b]);
+            byteClass[b] = c;
+        }
+        numClasses = classSignatures.size();
+
+        isFirstByte.assign(256, false);
+        for (size_t p = 0; p < patterns.size(); p++) {
+            isFirstByte[(unsigned char)patterns[p][0]] = true;
+        }
+    }
+
+    std::vector<std::string> patterns;
+
+    std::vector<int32_t> byteClass;     // 256 entries
+    std::vector<bool> isFirstByte;      // 256 entries
+    size_t numClasses;
+    size_t maxLength;
+
+    // Per state
+    std::vector<int32_t> delta;         // numClasses entries per state
+    std::vector<int32_t> depth;
+    std::vector<int32_t> terminal;      // Pattern ending at this state, or -1
+    std::vector<size_t> matchLength;    // Longest pattern that is a suffix of this state, or 0
+    std::vector<bool> hasChildren;
+};
+
+#endif // MULTI_PATTERN_MATCHER_H_
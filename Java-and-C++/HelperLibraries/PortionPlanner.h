@@ -0,0 +1,164 @@
+/* Copyright (c) 2005 - 2016 Hewlett Packard Enterprise Development LP  -*- C++ -*-*/
+/****************************
+ * Vertica Analytic Database
+ *
+ * UDL helper; splitting a file into portions for apportioned load,
+ * anywhere or only at certain offsets (e.g. the checkpoints of a
+ * compressed file), and the planning that the portion sources share.
+ *
+ ****************************/
+
+#include <stdint.h>
+#include <glob.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "Vertica.h"
+#include "LoadArgParsers.h"
+
+#ifndef PORTION_PLANNER_H_
+#define PORTION_PLANNER_H_
+
+/** Moves an offset back to the nearest of a sorted list of cuts */
+class SnapToCuts {
+public:
+    explicit SnapToCuts(const std::vector<uint64_t> &cuts) : cuts(cuts) {}
+    uint64_t operator()(uint64_t offset) const {
+        std::vector<uint64_t>::const_iterator it = std::upper_bound(cuts.begin(), cuts.end(), offset);
+        return (it == cuts.begin()) ? 0 : *(it - 1);
+    }
+private:
+    const std::vector<uint64_t> &cuts;
+};
+
+/** Leaves an offset where it is, for data that can be cut anywhere */
+class SnapNowhere {
+public:
+    uint64_t operator()(uint64_t offset) const { return offset; }
+};
+
+/**
+ * Plan this node's portions of a file of `total` bytes, cutting it only
+ * where `snap` allows.
+ *
+ * The file is first split evenly between the `numNodes` nodes, and then
+ * this node's share is split into at most `maxPieces` portions of at
+ * least `minPortionSize` bytes each.  Every split point is moved back
+ * by `snap`, so portions may end up uneven, or empty (empty portions
+ * are dropped).  Every node computes the same cuts, so the nodes'
+ * shares line up exactly.
+ */
+template <class Snap>
+inline std::vector<Vertica::Portion> planPortionsWith(const Snap &snap,
+        uint64_t total, size_t nodeId, size_t numNodes, size_t maxPieces, uint64_t minPortionSize) {
+    std::vector<Vertica::Portion> portions;
+
+    const uint64_t nodeStart = snap(total / numNodes * nodeId);
+    const uint64_t nodeEnd = (nodeId == numNodes - 1) ?
+        total : snap(total / numNodes * (nodeId + 1));
+
+    const size_t pieces = std::max((size_t)1,
+            std::min(maxPieces, (size_t)((nodeEnd - nodeStart) / std::max(minPortionSize, (uint64_t)1))));
+    uint64_t start = nodeStart;
+    for (size_t piece = 1; piece <= pieces; piece++) {
+        const uint64_t end = (piece == pieces) ? nodeEnd :
+            snap(nodeStart + (nodeEnd - nodeStart) / pieces * piece);
+        // An empty file still needs one (empty) portion, on one node
+        if (end > start || (total == 0 && nodeId == 0)) {
+            Vertica::Portion p(start);
+            p.size = end - start;
+            p.is_first_portion = (start == 0);
+            portions.push_back(p);
+        }
+        start = std::max(start, end);
+    }
+    return portions;
+}
+
+/**
+ * Plan this node's portions of a file that may only be cut at the
+ * offsets in `cuts` (sorted, starting with 0), e.g. the checkpoints of a
+ * compressed file.
+ */
+inline std::vector<Vertica::Portion> planPortionsAtCuts(const std::vector<uint64_t> &cuts,
+        uint64_t total, size_t nodeId, size_t numNodes, size_t maxPieces, uint64_t minPortionSize) {
+    return planPortionsWith(SnapToCuts(cuts), total, nodeId, numNodes, maxPieces, minPortionSize);
+}
+
+/**
+ * Plan this node's portions of a file that may be cut anywhere; the
+ * parser finds the record boundaries, as with FilePortionSource.
+ */
+inline std::vector<Vertica::Portion> planPortions(uint64_t total, size_t nodeId, size_t numNodes,
+        size_t maxPieces, uint64_t minPortionSize) {
+    return planPortionsWith(SnapNowhere(), total, nodeId, numNodes, maxPieces, minPortionSize);
+}
+
+/**
+ * Pick the nodes to run on from the "nodes" argument (by default, just
+ * this node), keeping at most `maxNodes` of them, and give each one an
+ * id: its place in the list, written to the plan context under its
+ * name.  The sources on each node use it to find their share.
+ */
+inline void planPortionNodes(Vertica::ServerInterface &srvInterface,
+                             Vertica::NodeSpecifyingPlanContext &planCtxt,
+                             size_t maxNodes = (size_t)-1) {
+    Vertica::ParamReader args = srvInterface.getParamReader();
+    const std::string nodes_arg = args.containsParameter("nodes") ?
+        args.getStringRef("nodes").str() : srvInterface.getCurrentNodeName();
+    findExecutionNodes(args, planCtxt, nodes_arg);
+
+    std::vector<std::string> nodes = planCtxt.getTargetNodes();
+    if (nodes.size() > maxNodes) {
+        nodes.resize(maxNodes);
+        planCtxt.setTargetNodes(nodes);
+    }
+    Vertica::ParamWriter &pwriter = planCtxt.getWriter();
+    for (size_t i = 0; i < nodes.size(); i++) {
+        pwriter.setInt(nodes[i], i);
+    }
+}
+
+/** The "local_min_portion_size" argument; 1MB by default */
+inline Vertica::vint getLocalMinPortionSize(Vertica::ServerInterface &srvInterface) {
+    Vertica::ParamReader args = srvInterface.getParamReader();
+    const Vertica::vint size = args.containsParameter("local_min_portion_size") ?
+        args.getIntRef("local_min_portion_size") : 1024 * 1024;
+    if (size <= 0) {
+        vt_report_error(0, "parameter \"local_min_portion_size\" must be positive");
+    }
+    return size;
+}
+
+/**
+ * The files matching the glob `pattern`, leaving out any that
+ * `isOwnFile` (if given) says we wrote ourselves, like index files.
+ * It is an error for no files to be left.
+ */
+inline std::vector<std::string> expandPortionGlob(const std::string &pattern,
+                                                  bool (*isOwnFile)(const std::string &) = NULL) {
+    std::vector<std::string> paths;
+
+    glob_t globbuf;
+    globbuf.gl_offs = 0;
+    int globres = glob(pattern.c_str(), GLOB_ERR, NULL, &globbuf);
+    if (globres == GLOB_NOSPACE) {
+        vt_report_error(0, "Out of memory when expanding glob: %s", pattern.c_str());
+    } else if (globres == GLOB_ABORTED) {
+        vt_report_error(0, "Read error when expanding glob: %s", pattern.c_str());
+    } else if (globres == 0) {
+        for (size_t count = 0; count < globbuf.gl_pathc; count++) {
+            if (isOwnFile == NULL || !isOwnFile(globbuf.gl_pathv[count])) {
+                paths.push_back(globbuf.gl_pathv[count]);
+            }
+        }
+    }
+    globfree(&globbuf);
+    if (paths.empty()) {
+        vt_report_error(0, "No files matching pattern [%s] were found", pattern.c_str());
+    }
+    return paths;
+}
+
+#endif // PORTION_PLANNER_H_
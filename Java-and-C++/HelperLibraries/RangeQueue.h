@@ -0,0 +1,160 @@
+/* Copyright (c) 2005 - 2016 Hewlett Packard Enterprise Development LP  -*- C++ -*-*/
+/****************************
+ * Vertica Analytic Database
+ *
+ * UDL helper; handing out byte ranges of files to sources as they ask
+ * for them, rather than fixing each source's share up front.
+ *
+ ****************************/
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "RecordBoundaries.h"
+
+#ifndef RANGE_QUEUE_H_
+#define RANGE_QUEUE_H_
+
+/** A range of bytes [start, end) of one file, made up of whole records */
+struct FileRange {
+    std::string filename;
+    uint64_t start;
+    uint64_t end;
+    bool endsFile;      // The range runs to the end of the file
+};
+
+/**
+ * RangeQueue
+ *
+ * A queue of file ranges shared by the sources on one node.  Each
+ * source takes the next range when it has finished the last one, so a
+ * source that is held up (by a slow disk, or records that are slow to
+ * parse) just ends up taking fewer ranges, rather than holding up the
+ * whole load while the others wait.
+ *
+ * Ranges are `rangeSize` bytes, until the amount left in the queue is
+ * down to about two ranges per source; from there, they shrink towards
+ * `minRangeSize`, so that the sources all run out of work at about the
+ * same time.
+ *
+ * Range ends are moved onto record boundaries (see RecordBoundaries),
+ * so that a source can send several ranges, one after another, to a
+ * parser that knows nothing about them.
+ *
+ * The queue is allocated with new, and each source that takes ranges
+ * from it holds a reference (see addRef() and release()); the last
+ * one to let go deletes it.
+ */
+class RangeQueue {
+public:
+    RangeQueue(size_t consumers, uint64_t rangeSize, uint64_t minRangeSize)
+        : consumers(std::max(consumers, (size_t)1)), rangeSize(rangeSize),
+          minRangeSize(std::min(minRangeSize, rangeSize)), queued(0), nextRange(0), refs(0) {
+        pthread_mutex_init(&lock, NULL);
+    }
+
+    ~RangeQueue() {
+        pthread_mutex_destroy(&lock);
+    }
+
+    /**
+     * Queue bytes [start, end) of a file; `boundaries` must have been
+     * opened on the file.  Call before any source takes a range.
+     */
+    void addFile(const std::string &filename, uint64_t start, uint64_t end, RecordBoundaries &boundaries) {
+        Share share = { filename, start, end, &boundaries };
+        shares.push_back(share);
+        queued += end - start;
+    }
+
+    /**
+     * Cut the queued files into ranges.  The cuts only depend on the
+     * arguments to the constructor and to addFile(), so (with the
+     * boundaries cached by RecordBoundaries) planning the same load
+     * again doesn't need to read the files.
+     */
+    void plan() {
+        uint64_t left = queued;
+        for (std::vector<Share>::const_iterator share = shares.begin(); share != shares.end(); ++share) {
+            const uint64_t fileSize = share->boundaries->getFileSize();
+            uint64_t start = recordStart(*share->boundaries, share->start);
+            const uint64_t end = recordStart(*share->boundaries, share->end);
+            uint64_t candidate = share->start;
+
+            while (start < end) {
+                // Aim for about two ranges per source in what's left
+                const uint64_t size = std::max(minRangeSize,
+                        std::min(rangeSize, left / (2 * consumers)));
+                candidate = std::min(candidate + size, share->end);
+                left -= std::min(left, size);
+
+                const uint64_t rangeEnd = std::min(end, recordStart(*share->boundaries, candidate));
+                if (rangeEnd > start) {
+                    FileRange range = { share->filename, start, rangeEnd, rangeEnd == fileSize };
+                    ranges.push_back(range);
+                    start = rangeEnd;
+                    // Don't probe again inside a long record
+                    candidate = std::max(candidate, rangeEnd);
+                }
+            }
+        }
+        shares.clear();
+    }
+
+    /** Take the next range; false if there are none left */
+    bool next(FileRange &range) {
+        pthread_mutex_lock(&lock);
+        const bool found = nextRange < ranges.size();
+        if (found) range = ranges[nextRange++];
+        pthread_mutex_unlock(&lock);
+        return found;
+    }
+
+    size_t getRangeCount() const { return ranges.size(); }
+
+    void addRef() {
+        pthread_mutex_lock(&lock);
+        refs++;
+        pthread_mutex_unlock(&lock);
+    }
+
+    /** Drop a reference taken with addRef(); deletes the queue after the last one */
+    static void release(RangeQueue *queue) {
+        pthread_mutex_lock(&queue->lock);
+        const bool last = --queue->refs == 0;
+        pthread_mutex_unlock(&queue->lock);
+        if (last) delete queue;
+    }
+
+private:
+    struct Share {
+        std::string filename;
+        uint64_t start;
+        uint64_t end;
+        RecordBoundaries *boundaries;
+    };
+
+    /** The start of the first record that starts at or after `offset` */
+    static uint64_t recordStart(RecordBoundaries &boundaries, uint64_t offset) {
+        if (offset == 0) return 0;
+        const uint64_t terminator = boundaries.snap(offset - 1);
+        return terminator >= boundaries.getFileSize() ? terminator : terminator + 1;
+    }
+
+    const size_t consumers;
+    const uint64_t rangeSize;
+    const uint64_t minRangeSize;
+
+    std::vector<Share> shares;
+    uint64_t queued;
+
+    pthread_mutex_t lock;
+    std::vector<FileRange> ranges;
+    size_t nextRange;
+    size_t refs;
+};
+
+#endif // RANGE_QUEUE_H_
@@ -0,0 +1,217 @@
+/* Copyright (c) 2005 - 2016 Hewlett Packard Enterprise Development LP  -*- C++ -*-*/
+/****************************
+ * Vertica Analytic Database
+ *
+ * UDL helper; moving portion cut points onto record boundaries, and
+ * remembering where they went.
+ *
+ ****************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+
+#include "Vertica.h"
+
+#ifndef RECORD_BOUNDARIES_H_
+#define RECORD_BOUNDARIES_H_
+
+/**
+ * RecordBoundaries
+ *
+ * Snaps candidate portion cut points in one file to the next record
+ * terminator, by reading forward from each one.
+ *
+ * A portion that isn't the first one is expected to start with the
+ * tail of a record, which its parser skips, up to and including the
+ * first terminator (see DelimFilePortionParser::alignPortion()).  So a
+ * cut is snapped onto the terminator itself: the portion after it
+ * skips just that one byte, and the portion before it reads just that
+ * one byte past its end to finish its last record.
+ *
+ * The snapped cuts are kept in a sidecar file next to the data file
+ * (<file>.rbidx), which records the size and mtime of the file, and
+ * the terminator, it was made for.  Later loads that ask for the same
+ * cut points don't have to read the file at all.
+ */
+class RecordBoundaries {
+public:
+    RecordBoundaries() : fileSize(0), fileMtime(0), terminator('\n'), changed(false) {}
+
+    static std::string sidecarPath(const std::string &path) {
+        return path + ".rbidx";
+    }
+
+    /** Is `path` a sidecar file (or one being written), rather than data? */
+    static bool isSidecarPath(const std::string &path) {
+        const std::string suffix = ".rbidx";
+        return (path.size() >= suffix.size()
+                && path.compare(path.size() - suffix.size(), suffix.size(), suffix) == 0)
+            || path.find(suffix + ".tmp.") != std::string::npos;
+    }
+
+    /**
+     * Start snapping cuts in `path`, with any cuts already in its
+     * sidecar file.
+     */
+    void open(const std::string &path, char terminator) {
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0) {
+            vt_report_error(0, "Error in stat() for file [%s]", path.c_str());
+        }
+        this->path = path;
+        this->terminator = terminator;
+        fileSize = st.st_size;
+        fileMtime = st.st_mtime;
+        cuts.clear();
+        changed = false;
+        readSidecar(cuts);
+    }
+
+    /**
+     * The offset of the first terminator at or after `offset`; or the
+     * end of the file, if there isn't one before the file's last byte.
+     */
+    uint64_t snap(uint64_t offset) {
+        if (offset >= fileSize) return fileSize;
+
+        std::map<uint64_t, uint64_t>::const_iterator known = cuts.find(offset);
+        if (known != cuts.end()) return known->second;
+
+        const uint64_t snapped = probe(offset);
+        cuts[offset] = snapped;
+        changed = true;
+        return snapped;
+    }
+
+    /**
+     * Write the sidecar file, if any new cuts have been snapped.
+     * Written to a temporary file and renamed, so that concurrent
+     * readers never see a partial file.  Cuts that another load saved
+     * since open() are read back in first, so they aren't lost.
+     */
+    bool save() {
+        if (!changed) return true;
+
+        readSidecar(cuts);
+
+        char tmpSuffix[64];
+        snprintf(tmpSuffix, sizeof(tmpSuffix), ".tmp.%d", (int)getpid());
+        const std::string tmpPath = sidecarPath(path) + tmpSuffix;
+
+        FILE *f = fopen(tmpPath.c_str(), "w");
+        if (f == NULL) return false;
+
+        std::vector<uint64_t> pairs;
+        for (std::map<uint64_t, uint64_t>::const_iterator cut = cuts.begin(); cut != cuts.end(); ++cut) {
+            pairs.push_back(cut->first);
+            pairs.push_back(cut->second);
+        }
+        uint64_t header[4] = { fileSize, fileMtime, (unsigned char)terminator, cuts.size() };
+        bool ok = fwrite(getMagic(), MAGIC_SIZE, 1, f) == 1
+            && fwrite(header, sizeof(header), 1, f) == 1
+            && (pairs.empty() || fwrite(&pairs[0], sizeof(uint64_t), pairs.size(), f) == pairs.size());
+        ok = (fclose(f) == 0) && ok;
+
+        if (!ok || rename(tmpPath.c_str(), sidecarPath(path).c_str()) != 0) {
+            unlink(tmpPath.c_str());
+            return false;
+        }
+        changed = false;
+        return true;
+    }
+
+    uint64_t getFileSize() const { return fileSize; }
+
+private:
+    static const size_t PROBE_SIZE = 64 * 1024;
+
+    // Sidecar file format version marker, including the '\0'
+    static const size_t MAGIC_SIZE = 8;
+    static const char *getMagic() { return "VRBIDX1"; }
+
+    /**
+     * Add the sidecar's cuts to `into`, if it was made for this version
+     * of the file and is as long as its header says
+     */
+    void readSidecar(std::map<uint64_t, uint64_t> &into) const {
+        FILE *f = fopen(sidecarPath(path).c_str(), "r");
+        if (f == NULL) return;
+
+        struct stat st;
+        char magic[MAGIC_SIZE];
+        uint64_t header[4];
+        const uint64_t headerSize = MAGIC_SIZE + sizeof(header);
+        bool ok = fstat(fileno(f), &st) == 0
+            && (uint64_t)st.st_size >= headerSize
+            && fread(magic, MAGIC_SIZE, 1, f) == 1
+            && memcmp(magic, getMagic(), MAGIC_SIZE) == 0
+            && fread(header, sizeof(header), 1, f) == 1
+            && header[0] == fileSize
+            && header[1] == fileMtime
+            && header[2] == (unsigned char)terminator
+            && header[3] == ((uint64_t)st.st_size - headerSize) / (2 * sizeof(uint64_t))
+            && ((uint64_t)st.st_size - headerSize) % (2 * sizeof(uint64_t)) == 0;
+        std::vector<uint64_t> pairs;
+        if (ok) {
+            pairs.resize(2 * header[3]);
+            ok = pairs.empty() || fread(&pairs[0], sizeof(uint64_t), pairs.size(), f) == pairs.size();
+        }
+        fclose(f);
+
+        if (ok) {
+            for (size_t i = 0; i < pairs.size(); i += 2) {
+                into.insert(std::make_pair(pairs[i], pairs[i + 1]));
+            }
+        }
+    }
+
+    /** Read forward from `offset` to the next terminator */
+    uint64_t probe(uint64_t offset) {
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            vt_report_error(0, "Error opening file [%s]", path.c_str());
+        }
+
+        std::vector<char> buf(PROBE_SIZE);
+        uint64_t pos = offset;
+        uint64_t found = fileSize;
+        while (pos < fileSize) {
+            const ssize_t got = pread(fd, &buf[0], buf.size(), pos);
+            if (got < 0 && errno == EINTR) continue;
+            if (got < 0) {
+                ::close(fd);
+                vt_report_error(0, "Error reading file [%s]: %s", path.c_str(), strerror(errno));
+            }
+            if (got == 0) break;  // The file shrank
+
+            const char *hit = (const char *)memchr(&buf[0], terminator, got);
+            if (hit != NULL) {
+                found = pos + (hit - &buf[0]);
+                break;
+            }
+            pos += got;
+        }
+        ::close(fd);
+
+        // A terminator that ends the file leaves nothing after it to load
+        return (found + 1 >= fileSize) ? fileSize : found;
+    }
+
+    std::string path;
+    uint64_t fileSize;
+    uint64_t fileMtime;
+    char terminator;
+
+    std::map<uint64_t, uint64_t> cuts;  // Candidate offset -> snapped offset
+    bool changed;                       // Cuts have been snapped since the last open()/save()
+};
+
+#endif // RECORD_BOUNDARIES_H_
@@ -0,0 +1,60 @@
+/* Copyright (c) 2005 - 2016 Hewlett Packard Enterprise Development LP  -*- C++ -*-*/
+/****************************
+ * Vertica Analytic Database
+ *
+ * UDL helper; fast search for one byte string in a buffer.
+ *
+ ****************************/
+
+#include <stddef.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#ifndef SUBSTRING_SEARCH_H_
+#define SUBSTRING_SEARCH_H_
+
+/**
+ * Find the first occurrence of needle[0, n) in hay[0, len).
+ * Returns a pointer to it, or NULL if there is none.
+ *
+ * With SSE2, 16 positions are tested at a time by comparing both the
+ * first and the last byte of the needle (W. Mula, "SIMD-friendly
+ * algorithms for substring searching"); only positions where both match
+ * are compared in full.  Testing two bytes rather than one rules out
+ * nearly all false candidates, even for needles starting with a common
+ * letter.
+ */
+inline const char *findSubstring(const char *hay, size_t len, const char *needle, size_t n) {
+    if (n == 0) return hay;
+    if (n > len) return NULL;
+    if (n == 1) return (const char *)memchr(hay, needle[0], len);
+
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[n - 1]);
+    for (; i + n - 1 + 16 <= len; i += 16) {
+        const __m128i a = _mm_loadu_si128((const __m128i *)(hay + i));
+        const __m128i b = _mm_loadu_si128((const __m128i *)(hay + i + n - 1));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+        while (mask) {
+            const unsigned bit = __builtin_ctz(mask);
+            if (memcmp(hay + i + bit + 1, needle + 1, n - 2) == 0) return hay + i + bit;
+            mask &= mask - 1;
+        }
+    }
+#endif
+    // The rest; memchr() for the first byte, then check the rest
+    while (i + n <= len) {
+        const char *candidate = (const char *)memchr(hay + i, needle[0], len - n + 1 - i);
+        if (candidate == NULL) return NULL;
+        if (memcmp(candidate + 1, needle + 1, n - 1) == 0) return candidate;
+        i = candidate - hay + 1;
+    }
+    return NULL;
+}
+
+#endif // SUBSTRING_SEARCH_H_
@@ -0,0 +1,262 @@
+/* Copyright (c) 2005 - 2016 Hewlett Packard Enterprise Development LP  -*- C++ -*-*/
+/****************************
+ * Vertica Analytic Database
+ *
+ * UDL helper; fast conversion to UTF-8 from the common input encodings
+ * (UTF-16 and ISO-8859-1), without going through iconv.
+ *
+ ****************************/
+
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <string>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#ifndef TRANSCODERS_H_
+#define TRANSCODERS_H_
+
+/**
+ * Utf8Transcoder
+ *
+ * Converts UTF-16 (little- or big-endian, or either one chosen by a
+ * byte order mark) or ISO-8859-1 to UTF-8.
+ *
+ * Runs of ASCII, which make up most of the data in most loads, are
+ * converted 16 or 32 input bytes at a time with SSE2 (or 8 at a time
+ * without it); everything else one character at a time.
+ */
+class Utf8Transcoder {
+public:
+    enum Encoding {
+        NONE,           // No fast path; use iconv
+        UTF16,          // Byte order from the BOM, little-endian if there is none
+        UTF16LE,
+        UTF16BE,
+        LATIN1
+    };
+
+    enum Result {
+        OK,             // All input converted
+        OUTPUT_FULL,    // The next character doesn't fit in the output
+        INCOMPLETE,     // The input ends partway through a character
+        INVALID         // Invalid input at inPos
+    };
+
+    Utf8Transcoder(Encoding encoding = NONE) : encoding(encoding), sawStart(false) {}
+
+    /**
+     * The fast path for converting `from` to `to`, if there is one.
+     * Encoding names are compared the way iconv does: case-insensitively,
+     * and ignoring '-' and '_'.
+     */
+    static Encoding lookup(const std::string &from, const std::string &to) {
+        if (normalize(to) != "UTF8") return NONE;
+        const std::string f = normalize(from);
+        if (f == "UTF16") return UTF16;
+        if (f == "UTF16LE") return UTF16LE;
+        if (f == "UTF16BE") return UTF16BE;
+        if (f == "ISO88591" || f == "LATIN1" || f == "L1") return LATIN1;
+        return NONE;
+    }
+
+    /**
+     * Convert in[inPos, inLen) into out[outPos, outLen), advancing inPos
+     * and outPos past what was converted.
+     */
+    Result transcode(const unsigned char *in, size_t inLen, size_t &inPos,
+                     unsigned char *out, size_t outLen, size_t &outPos) {
+        if (encoding == LATIN1) {
+            return latin1ToUtf8(in, inLen, inPos, out, outLen, outPos);
+        }
+
+        if (encoding == UTF16 && !sawStart) {
+            // A byte order mark picks the byte order, and is not output.
+            // No input at all is not an incomplete one
+            if (inPos == inLen) return OK;
+            if (inLen - inPos < 2) return INCOMPLETE;
+            if (in[inPos] == 0xFE && in[inPos + 1] == 0xFF) {
+                encoding = UTF16BE;
+                inPos += 2;
+            } else if (in[inPos] == 0xFF && in[inPos + 1] == 0xFE) {
+                encoding = UTF16LE;
+                inPos += 2;
+            } else {
+                encoding = UTF16LE;
+            }
+        }
+        sawStart = true;
+
+        return (encoding == UTF16BE) ?
+            utf16ToUtf8<true>(in, inLen, inPos, out, outLen, outPos) :
+            utf16ToUtf8<false>(in, inLen, inPos, out, outLen, outPos);
+    }
+
+private:
+    static std::string normalize(const std::string &name) {
+        std::string n;
+        for (size_t i = 0; i < name.size(); i++) {
+            if (name[i] != '-' && name[i] != '_') n += toupper((unsigned char)name[i]);
+        }
+        return n;
+    }
+
+    template <bool bigEndian>
+    static uint32_t unit(const unsigned char *p) {
+        return bigEndian ? ((uint32_t)p[0] << 8 | p[1]) : ((uint32_t)p[1] << 8 | p[0]);
+    }
+
+    template <bool bigEndian>
+    static Result utf16ToUtf8(const unsigned char *in, size_t inLen, size_t &inPos,
+                              unsigned char *out, size_t outLen, size_t &outPos) {
+        size_t i = inPos, o = outPos;
+        while (true) {
+            // ASCII runs, 16 characters at a time.  Stop at the first
+            // block holding anything else, and do that block one
+            // character at a time.
+            size_t blockEnd = i;
+#ifdef __SSE2__
+            const __m128i nonAscii = _mm_set1_epi16((short)0xFF80);
+            while (inLen - i >= 32 && outLen - o >= 16) {
+                __m128i a = _mm_loadu_si128((const __m128i*)(in + i));
+                __m128i b = _mm_loadu_si128((const __m128i*)(in + i + 16));
+                if (bigEndian) {
+                    a = _mm_or_si128(_mm_slli_epi16(a, 8), _mm_srli_epi16(a, 8));
+                    b = _mm_or_si128(_mm_slli_epi16(b, 8), _mm_srli_epi16(b, 8));
+                }
+                const __m128i high = _mm_and_si128(_mm_or_si128(a, b), nonAscii);
+                if (_mm_movemask_epi8(_mm_cmpeq_epi16(high, _mm_setzero_si128())) != 0xFFFF) {
+                    blockEnd = i + 32;
+                    break;
+                }
+                _mm_storeu_si128((__m128i*)(out + o), _mm_packus_epi16(a, b));
+                i += 32;
+                o += 16;
+            }
+#else
+            const uint64_t nonAscii = bigEndian ? 0x80FF80FF80FF80FFULL : 0xFF80FF80FF80FF80ULL;
+            while (inLen - i >= 8 && outLen - o >= 4) {
+                uint64_t w;
+                memcpy(&w, in + i, 8);
+                if (w & nonAscii) {
+                    blockEnd = i + 8;
+                    break;
+                }
+                for (size_t k = 0; k < 4; k++) out[o + k] = in[i + 2 * k + (bigEndian ? 1 : 0)];
+                i += 8;
+                o += 4;
+            }
+#endif
+            // Characters one at a time, to the end of the block, or to the
+            // end of the input if it's too short for a block
+            if (blockEnd == i) blockEnd = inLen;
+            while (i < blockEnd) {
+                if (inLen - i < 2) {
+                    inPos = i; outPos = o;
+                    return INCOMPLETE;
+                }
+                uint32_t c = unit<bigEndian>(in + i);
+                size_t used = 2;
+                if (c >= 0xD800 && c <= 0xDFFF) {
+                    // A surrogate pair: high (D800-DBFF) then low (DC00-DFFF)
+                    if (c >= 0xDC00) {
+                        inPos = i; outPos = o;
+                        return INVALID;
+                    }
+                    if (inLen - i < 4) {
+                        inPos = i; outPos = o;
+                        return INCOMPLETE;
+                    }
+                    const uint32_t low = unit<bigEndian>(in + i + 2);
+                    if (low < 0xDC00 || low > 0xDFFF) {
+                        inPos = i; outPos = o;
+                        return INVALID;
+                    }
+                    c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+                    used = 4;
+                }
+                if (!putUtf8(c, out, outLen, o)) {
+                    inPos = i; outPos = o;
+                    return OUTPUT_FULL;
+                }
+                i += used;
+            }
+            if (i >= inLen) break;
+        }
+        inPos = i; outPos = o;
+        return OK;
+    }
+
+    static Result latin1ToUtf8(const unsigned char *in, size_t inLen, size_t &inPos,
+                               unsigned char *out, size_t outLen, size_t &outPos) {
+        size_t i = inPos, o = outPos;
+        while (i < inLen) {
+            size_t blockEnd = i;
+#ifdef __SSE2__
+            while (inLen - i >= 16 && outLen - o >= 16) {
+                const __m128i v = _mm_loadu_si128((const __m128i*)(in + i));
+                if (_mm_movemask_epi8(v) != 0) {
+                    blockEnd = i + 16;
+                    break;
+                }
+                _mm_storeu_si128((__m128i*)(out + o), v);
+                i += 16;
+                o += 16;
+            }
+#else
+            while (inLen - i >= 8 && outLen - o >= 8) {
+                uint64_t w;
+                memcpy(&w, in + i, 8);
+                if (w & 0x8080808080808080ULL) {
+                    blockEnd = i + 8;
+                    break;
+                }
+                memcpy(out + o, &w, 8);
+                i += 8;
+                o += 8;
+            }
+#endif
+            if (blockEnd == i) blockEnd = inLen;
+            for (; i < blockEnd; i++) {
+                if (!putUtf8(in[i], out, outLen, o)) {
+                    inPos = i; outPos = o;
+                    return OUTPUT_FULL;
+                }
+            }
+        }
+        inPos = i; outPos = o;
+        return OK;
+    }
+
+    /** Append the UTF-8 encoding of `c`, if there's room for it */
+    static bool putUtf8(uint32_t c, unsigned char *out, size_t outLen, size_t &o) {
+        if (c < 0x80) {
+            if (outLen - o < 1) return false;
+            out[o++] = c;
+        } else if (c < 0x800) {
+            if (outLen - o < 2) return false;
+            out[o++] = 0xC0 | (c >> 6);
+            out[o++] = 0x80 | (c & 0x3F);
+        } else if (c < 0x10000) {
+            if (outLen - o < 3) return false;
+            out[o++] = 0xE0 | (c >> 12);
+            out[o++] = 0x80 | ((c >> 6) & 0x3F);
+            out[o++] = 0x80 | (c & 0x3F);
+        } else {
+            if (outLen - o < 4) return false;
+            out[o++] = 0xF0 | (c >> 18);
+            out[o++] = 0x80 | ((c >> 12) & 0x3F);
+            out[o++] = 0x80 | ((c >> 6) & 0x3F);
+            out[o++] = 0x80 | (c & 0x3F);
+        }
+        return true;
+    }
+
+    Encoding encoding;
+    bool sawStart;
+};
+
+#endif // TRANSCODERS_H_
@@ -0,0 +1,215 @@
+/* Copyright (c) 2005 - 2016 Hewlett Packard Enterprise Development LP  -*- C++ -*-*/
+/****************************
+ * Vertica Analytic Database
+ *
+ * UDL helper; checking that data is valid UTF-8.
+ *
+ * Long valid stretches are checked 16 bytes at a time with the
+ * lookup-table algorithm of Keiser and Lemire ("Validating UTF-8 In Less
+ * Than One Instruction Per Byte", 2021), on CPUs with SSSE3; or with an
+ * ASCII-only SSE2 fast path on CPUs without it.  Invalid sequences are
+ * then located exactly, one character at a time.
+ *
+ ****************************/
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#if defined(__GNUC__) && !defined(__clang__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#include <tmmintrin.h>
+#define UTF8_VALIDATION_HAVE_SSSE3 1
+#endif
+#endif
+
+#ifndef UTF8_VALIDATION_H_
+#define UTF8_VALIDATION_H_
+
+namespace Utf8Validation {
+
+/**
+ * Check the character starting at p[0].
+ *
+ * Returns its length if it is valid, or 0 if the data ends partway
+ * through it and !atEnd, so more data is needed to decide.
+ *
+ * If it is invalid, returns minus the number of bytes to treat as one
+ * invalid sequence: the longest prefix of a valid sequence, or 1
+ * (Unicode's "maximal subpart" rule, so that replacing each invalid
+ * sequence with U+FFFD gives the same result as other decoders).
+ */
+inline int checkCharacter(const unsigned char *p, size_t avail, bool atEnd) {
+    const unsigned char b0 = p[0];
+    if (b0 < 0x80) return 1;
+
+    // Length, and the range of the second byte; later bytes are 80-BF
+    int length;
+    unsigned char lo = 0x80, hi = 0xBF;
+    if (b0 < 0xC2) return -1;           // Continuation byte, or overlong C0/C1
+    else if (b0 < 0xE0) length = 2;
+    else if (b0 < 0xF0) {
+        length = 3;
+        if (b0 == 0xE0) lo = 0xA0;      // Overlong
+        if (b0 == 0xED) hi = 0x9F;      // Surrogates
+    }
+    else if (b0 < 0xF5) {
+        length = 4;
+        if (b0 == 0xF0) lo = 0x90;      // Overlong
+        if (b0 == 0xF4) hi = 0x8F;      // Above U+10FFFF
+    }
+    else return -1;
+
+    for (int i = 1; i < length; i++) {
+        if ((size_t)i >= avail) return atEnd ? -i : 0;
+        if (p[i] < lo || p[i] > hi) return -i;
+        lo = 0x80;
+        hi = 0xBF;
+    }
+    return length;
+}
+
+/**
+ * Move `end` back to the start of a character that doesn't fit before
+ * it, if the last 1-3 bytes before it are an incomplete character.
+ */
+inline size_t trimIncomplete(const unsigned char *p, size_t end) {
+    for (size_t k = 1; k <= 3 && k <= end; k++) {
+        const unsigned char b = p[end - k];
+        if (b < 0x80) break;                            // ASCII; complete
+        if (b >= 0xC0) {                                // Lead byte
+            const size_t length = (b >= 0xF0) ? 4 : (b >= 0xE0) ? 3 : 2;
+            if (length > k) end -= k;
+            break;
+        }
+    }
+    return end;
+}
+
+#ifdef UTF8_VALIDATION_HAVE_SSSE3
+
+/** Keiser-Lemire block validation; the error flags for each byte */
+__attribute__((target("ssse3")))
+inline __m128i checkBlock(__m128i input, __m128i prevInput) {
+    // Error classes, as in the paper
+    const unsigned char TOO_SHORT = 1 << 0, TOO_LONG = 1 << 1, OVERLONG_3 = 1 << 2,
+        TOO_LARGE = 1 << 3, SURROGATE = 1 << 4, OVERLONG_2 = 1 << 5,
+        TOO_LARGE_1000 = 1 << 6, OVERLONG_4 = 1 << 6, TWO_CONTS = 1 << 7,
+        CARRY = TOO_SHORT | TOO_LONG | TWO_CONTS;
+
+    const __m128i byte1HighTable = _mm_setr_epi8(
+        TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+        TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+        TOO_SHORT | OVERLONG_2,
+        TOO_SHORT,
+        TOO_SHORT | OVERLONG_3 | SURROGATE,
+        TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4);
+    const __m128i byte1LowTable = _mm_setr_epi8(
+        CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+        CARRY | OVERLONG_2,
+        CARRY, CARRY,
+        CARRY | TOO_LARGE,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+        CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000);
+    const __m128i byte2HighTable = _mm_setr_epi8(
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT);
+
+    const __m128i lowNibble = _mm_set1_epi8(0x0F);
+    const __m128i prev1 = _mm_alignr_epi8(input, prevInput, 15);
+    const __m128i byte1High = _mm_shuffle_epi8(byte1HighTable,
+            _mm_and_si128(_mm_srli_epi16(prev1, 4), lowNibble));
+    const __m128i byte1Low = _mm_shuffle_epi8(byte1LowTable, _mm_and_si128(prev1, lowNibble));
+    const __m128i byte2High = _mm_shuffle_epi8(byte2HighTable,
+            _mm_and_si128(_mm_srli_epi16(input, 4), lowNibble));
+    const __m128i specialCases = _mm_and_si128(_mm_and_si128(byte1High, byte1Low), byte2High);
+
+    // Third and fourth bytes of 3- and 4-byte characters must be continuations
+    const __m128i prev2 = _mm_alignr_epi8(input, prevInput, 14);
+    const __m128i prev3 = _mm_alignr_epi8(input, prevInput, 13);
+    const __m128i isThirdByte = _mm_subs_epu8(prev2, _mm_set1_epi8((char)(0xE0 - 1)));
+    const __m128i isFourthByte = _mm_subs_epu8(prev3, _mm_set1_epi8((char)(0xF0 - 1)));
+    const __m128i must23 = _mm_cmpgt_epi8(_mm_or_si128(isThirdByte, isFourthByte), _mm_setzero_si128());
+    const __m128i must23As80 = _mm_and_si128(must23, _mm_set1_epi8((char)0x80));
+    return _mm_xor_si128(must23As80, specialCases);
+}
+
+__attribute__((target("ssse3")))
+inline size_t validPrefixSsse3(const unsigned char *p, size_t len) {
+    size_t i = 0;
+    __m128i prev = _mm_setzero_si128();
+    while (len - i >= 16) {
+        const __m128i input = _mm_loadu_si128((const __m128i*)(p + i));
+        // All ASCII, and nothing incomplete before it?
+        if (_mm_movemask_epi8(input) == 0 && _mm_movemask_epi8(prev) == 0) {
+            prev = input;
+            i += 16;
+            continue;
+        }
+        const __m128i error = checkBlock(input, prev);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())) != 0xFFFF) break;
+        prev = input;
+        i += 16;
+    }
+    // The characters before i are valid, but the last one may be
+    // incomplete.  (If checkBlock() found an error in the block at i, the
+    // bad character may also start in the previous block; back off to
+    // its start.)
+    return trimIncomplete(p, i);
+}
+
+inline bool haveSsse3() {
+    static const bool have = __builtin_cpu_supports("ssse3");
+    return have;
+}
+
+#endif // UTF8_VALIDATION_HAVE_SSSE3
+
+/** Length of a prefix of p[0, len) that is valid, checked in blocks */
+inline size_t validBlocks(const unsigned char *p, size_t len) {
+#ifdef UTF8_VALIDATION_HAVE_SSSE3
+    if (haveSsse3()) return validPrefixSsse3(p, len);
+#endif
+    size_t i = 0;
+#ifdef __SSE2__
+    // Runs of ASCII
+    while (len - i >= 16
+            && _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)(p + i))) == 0) {
+        i += 16;
+    }
+#endif
+    return i;
+}
+
+/**
+ * Length of a prefix of p[0, len) that is all whole valid characters.
+ * Stops at the first invalid or incomplete character; check it with
+ * checkCharacter().
+ */
+inline size_t validPrefix(const unsigned char *p, size_t len) {
+    size_t i = 0;
+    while (true) {
+        i += validBlocks(p + i, len - i);
+        // One character at a time past whatever stopped the block check,
+        // then back to blocks
+        for (int chars = 0; chars < 16; chars++) {
+            if (i == len) return i;
+            const int n = checkCharacter(p + i, len - i, false);
+            if (n <= 0) return i;
+            i += n;
+        }
+    }
+}
+
+} // namespace Utf8Validation
+
+#endif // UTF8_VALIDATION_H_
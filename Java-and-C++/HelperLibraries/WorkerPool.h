@@ -0,0 +1,163 @@
+/* Copyright (c) 2005 - 2016 Hewlett Packard Enterprise Development LP  -*- C++ -*-*/
+/****************************
+ * Vertica Analytic Database
+ *
+ * UDL helper; a fixed pool of worker threads for running batches of
+ * independent jobs in parallel, e.g. decompressing several blocks of
+ * a file at once.
+ *
+ ****************************/
+
+#include <pthread.h>
+#include <vector>
+
+#ifndef WORKER_POOL_H_
+#define WORKER_POOL_H_
+
+/**
+ * A unit of work for a WorkerPool.
+ * run() is called on some worker thread; it must not call back into the
+ * server (no ServerInterface, no vt_report_error()).  Record failures in
+ * the job and report them from the calling thread instead.
+ */
+class PoolJob {
+public:
+    virtual ~PoolJob() {}
+    virtual void run() = 0;
+};
+
+/**
+ * WorkerPool
+ *
+ * runAll() hands a batch of jobs to the pool and returns once every one
+ * of them has finished.  The calling thread works on the batch too, so a
+ * pool started with N threads runs up to N+1 jobs at once.
+ *
+ * Jobs are picked up in order, so put the jobs whose results are needed
+ * first at the front of the batch.
+ */
+class WorkerPool {
+public:
+    WorkerPool() : started(false), stopping(false), batch(NULL), nextJob(0),
+                   jobsLeft(0), generation(0) {
+        pthread_mutex_init(&lock, NULL);
+        pthread_cond_init(&workReady, NULL);
+        pthread_cond_init(&workDone, NULL);
+    }
+
+    ~WorkerPool() {
+        stop();
+        pthread_cond_destroy(&workDone);
+        pthread_cond_destroy(&workReady);
+        pthread_mutex_destroy(&lock);
+    }
+
+    /**
+     * Start `numThreads` worker threads.
+     * Returns false if not all of them could be started; the pool
+     * still works (on however many did start) in that case.
+     */
+    bool start(size_t numThreads) {
+        stop();
+        stopping = false;
+        started = true;
+        for (size_t i = 0; i < numThreads; i++) {
+            pthread_t t;
+            if (pthread_create(&t, NULL, workerMain, this) != 0) return false;
+            threads.push_back(t);
+        }
+        return true;
+    }
+
+    /** Stop and join all worker threads */
+    void stop() {
+        if (!started) return;
+        pthread_mutex_lock(&lock);
+        stopping = true;
+        pthread_cond_broadcast(&workReady);
+        pthread_mutex_unlock(&lock);
+        for (size_t i = 0; i < threads.size(); i++) {
+            pthread_join(threads[i], NULL);
+        }
+        threads.clear();
+        started = false;
+    }
+
+    size_t numThreads() const { return threads.size(); }
+
+    /** Run every job in `jobs`, and wait for all of them to finish */
+    void runAll(std::vector<PoolJob*> &jobs) {
+        if (jobs.empty()) return;
+
+        pthread_mutex_lock(&lock);
+        batch = &jobs;
+        nextJob = 0;
+        jobsLeft = jobs.size();
+        generation++;
+        pthread_cond_broadcast(&workReady);
+        pthread_mutex_unlock(&lock);
+
+        work();
+
+        pthread_mutex_lock(&lock);
+        while (jobsLeft > 0) {
+            pthread_cond_wait(&workDone, &lock);
+        }
+        batch = NULL;
+        pthread_mutex_unlock(&lock);
+    }
+
+private:
+    /** Run jobs from the current batch until there are none left to start */
+    void work() {
+        while (true) {
+            pthread_mutex_lock(&lock);
+            if (batch == NULL || nextJob >= batch->size()) {
+                pthread_mutex_unlock(&lock);
+                return;
+            }
+            PoolJob *job = (*batch)[nextJob++];
+            pthread_mutex_unlock(&lock);
+
+            job->run();
+
+            pthread_mutex_lock(&lock);
+            if (--jobsLeft == 0) pthread_cond_signal(&workDone);
+            pthread_mutex_unlock(&lock);
+        }
+    }
+
+    static void *workerMain(void *arg) {
+        WorkerPool *pool = (WorkerPool *)arg;
+        unsigned long seen = 0;
+        while (true) {
+            pthread_mutex_lock(&pool->lock);
+            while (!pool->stopping && pool->generation == seen) {
+                pthread_cond_wait(&pool->workReady, &pool->lock);
+            }
+            if (pool->stopping) {
+                pthread_mutex_unlock(&pool->lock);
+                return NULL;
+            }
+            seen = pool->generation;
+            pthread_mutex_unlock(&pool->lock);
+
+            pool->work();
+        }
+    }
+
+    std::vector<pthread_t> threads;
+    bool started;
+    bool stopping;
+
+    std::vector<PoolJob*> *batch;
+    size_t nextJob;
+    size_t jobsLeft;
+    unsigned long generation;
+
+    pthread_mutex_t lock;
+    pthread_cond_t workReady;
+    pthread_cond_t workDone;
+};
+
+#endif // WORKER_POOL_H_
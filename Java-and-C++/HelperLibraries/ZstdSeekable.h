@@ -0,0 +1,255 @@
+/* Copyright (c) 2005 - 2016 Hewlett Packard Enterprise Development LP  -*- C++ -*-*/
+/****************************
+ * Vertica Analytic Database
+ *
+ * UDL helper; random access into zstd files written in the seekable
+ * format (see contrib/seekable_format in the zstd sources), which end
+ * with a table of the compressed and decompressed size of every frame.
+ *
+ ****************************/
+
+#include <zstd.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "Vertica.h"
+
+#ifndef ZSTD_SEEKABLE_H_
+#define ZSTD_SEEKABLE_H_
+
+/**
+ * ZstdSeekTable
+ *
+ * The frame table of a seekable zstd file: where each frame starts, in
+ * both the compressed file and the decompressed data.
+ */
+class ZstdSeekTable {
+public:
+    ZstdSeekTable() : tableOffset(0) {}
+
+    /**
+     * Read the seek table at the end of `path`.
+     * Returns false if the file is not in the seekable format (it can
+     * still be decompressed, just not from the middle).
+     */
+    bool load(const std::string &path) {
+        compressedStarts.clear();
+        decompressedStarts.clear();
+
+        FILE *f = fopen(path.c_str(), "r");
+        if (f == NULL) {
+            vt_report_error(0, "Error opening file [%s]", path.c_str());
+        }
+
+        bool ok = readTable(f);
+        fclose(f);
+        if (!ok) {
+            compressedStarts.clear();
+            decompressedStarts.clear();
+        }
+        return ok;
+    }
+
+    /** Number of frames */
+    size_t numFrames() const {
+        return compressedStarts.empty() ? 0 : compressedStarts.size() - 1;
+    }
+
+    /** Index of the frame containing decompressed offset `out` */
+    size_t findFrame(uint64_t out) const {
+        if (decompressedStarts.empty()) return 0;
+        std::vector<uint64_t>::const_iterator it =
+            std::upper_bound(decompressedStarts.begin(), decompressedStarts.end() - 1, out);
+        return (it == decompressedStarts.begin()) ? 0 : (it - decompressedStarts.begin()) - 1;
+    }
+
+    /** Offset of frame `i` in the file; frame numFrames() is the seek table itself */
+    uint64_t compressedStart(size_t i) const { return compressedStarts[i]; }
+
+    /** Offset of frame `i` in the decompressed data */
+    uint64_t decompressedStart(size_t i) const { return decompressedStarts[i]; }
+
+    uint64_t getUncompressedSize() const {
+        return decompressedStarts.empty() ? 0 : decompressedStarts.back();
+    }
+
+    /** Decompressed offsets of all frame starts; the places the data can be cut */
+    std::vector<uint64_t> getFrameStarts() const {
+        if (decompressedStarts.empty()) return std::vector<uint64_t>();
+        return std::vector<uint64_t>(decompressedStarts.begin(), decompressedStarts.end() - 1);
+    }
+
+private:
+    static const uint32_t SKIPPABLE_MAGIC = 0x184D2A5E;
+    static const uint32_t SEEKABLE_MAGIC = 0x8F92EAB1;
+    static const size_t FOOTER_SIZE = 9;
+    static const size_t SKIPPABLE_HEADER_SIZE = 8;
+
+    static uint32_t readLE32(const unsigned char *p) {
+        return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+    }
+
+    bool readTable(FILE *f) {
+        // Footer: Number_Of_Frames (4), Seek_Table_Descriptor (1), Seekable_Magic_Number (4)
+        unsigned char footer[FOOTER_SIZE];
+        if (fseeko(f, 0, SEEK_END) != 0) return false;
+        const off_t fileSize = ftello(f);
+        if (fileSize < (off_t)(SKIPPABLE_HEADER_SIZE + FOOTER_SIZE)) return false;
+        if (fseeko(f, fileSize - FOOTER_SIZE, SEEK_SET) != 0
+                || fread(footer, FOOTER_SIZE, 1, f) != 1
+                || readLE32(footer + 5) != SEEKABLE_MAGIC) {
+            return false;
+        }
+        const uint32_t frames = readLE32(footer);
+        const bool hasChecksums = (footer[4] & 0x80) != 0;
+        const size_t entrySize = hasChecksums ? 12 : 8;
+
+        // The table is a skippable frame: magic, size, entries, footer
+        const uint64_t frameSize = (uint64_t)frames * entrySize + FOOTER_SIZE;
+        if ((uint64_t)fileSize < frameSize + SKIPPABLE_HEADER_SIZE) return false;
+        tableOffset = fileSize - frameSize - SKIPPABLE_HEADER_SIZE;
+
+        std::vector<unsigned char> table(SKIPPABLE_HEADER_SIZE + frameSize);
+        if (fseeko(f, tableOffset, SEEK_SET) != 0
+                || fread(&table[0], table.size(), 1, f) != 1
+                || readLE32(&table[0]) != SKIPPABLE_MAGIC
+                || readLE32(&table[4]) != frameSize) {
+            return false;
+        }
+
+        compressedStarts.resize(frames + 1);
+        decompressedStarts.resize(frames + 1);
+        compressedStarts[0] = decompressedStarts[0] = 0;
+        for (uint32_t i = 0; i < frames; i++) {
+            const unsigned char *entry = &table[SKIPPABLE_HEADER_SIZE + i * entrySize];
+            compressedStarts[i + 1] = compressedStarts[i] + readLE32(entry);
+            decompressedStarts[i + 1] = decompressedStarts[i] + readLE32(entry + 4);
+        }
+        // The frames must exactly fill the file up to the table
+        return compressedStarts.back() == tableOffset;
+    }
+
+    uint64_t tableOffset;
+    std::vector<uint64_t> compressedStarts;     // numFrames() + 1 entries
+    std::vector<uint64_t> decompressedStarts;   // numFrames() + 1 entries
+};
+
+/**
+ * ZstdSeekableReader
+ *
+ * Decompresses a zstd file starting at an arbitrary decompressed offset:
+ * from the start of the frame containing it, if the file has a seek
+ * table, or else from the start of the file.  Output before the offset
+ * is discarded.
+ */
+class ZstdSeekableReader {
+public:
+    ZstdSeekableReader() : in(NULL), dStream(NULL), inPos(0), inSize(0), skip(0),
+                           outputPending(false), inFrame(false), eof(false) {}
+
+    ~ZstdSeekableReader() { close(); }
+
+    /** Open `path` for reading from decompressed offset `start` */
+    void open(const std::string &path, const ZstdSeekTable &table, uint64_t start) {
+        close();
+        this->path = path;
+        in = fopen(path.c_str(), "r");
+        if (in == NULL) {
+            vt_report_error(0, "Error opening file [%s]", path.c_str());
+        }
+
+        dStream = ZSTD_createDStream();
+        size_t zReturn = dStream ? ZSTD_initDStream(dStream) : 0;
+        if (dStream == NULL || ZSTD_isError(zReturn)) {
+            vt_report_error(0, "Error occurred during ZSTD initialization");
+        }
+
+        input.resize(ZSTD_DStreamInSize());
+        inPos = inSize = 0;
+        outputPending = false;
+        inFrame = false;
+        eof = false;
+        skip = start;
+
+        if (table.numFrames() > 0) {
+            const size_t frame = table.findFrame(start);
+            skip = start - table.decompressedStart(frame);
+            if (fseeko(in, table.compressedStart(frame), SEEK_SET) != 0) {
+                vt_report_error(0, "disk seek failed for file %s at offset %llu", path.c_str(),
+                                (unsigned long long)table.compressedStart(frame));
+            }
+        }
+    }
+
+    /**
+     * Decompress up to `len` bytes into `buf`.
+     * Returns the number of bytes written; 0 only at end of file.
+     */
+    size_t read(char *buf, size_t len) {
+        size_t produced = 0;
+        while (produced < len && !eof) {
+            // Only read more once the decoder has flushed everything it holds
+            if (inPos == inSize && !outputPending) {
+                inSize = fread(&input[0], 1, input.size(), in);
+                inPos = 0;
+                if (inSize == 0) {
+                    if (inFrame) {
+                        vt_report_error(0, "Unexpected end of file in [%s]", path.c_str());
+                    }
+                    eof = true;
+                    break;
+                }
+            }
+
+            // Discard output preceding the requested start offset
+            char discard[16384];
+            const bool skipping = skip > 0;
+            ZSTD_inBuffer zin = { &input[0], inSize, inPos };
+            ZSTD_outBuffer zout = { skipping ? discard : buf + produced,
+                                    skipping ? std::min((uint64_t)sizeof(discard), skip) : len - produced, 0 };
+
+            size_t zReturn = ZSTD_decompressStream(dStream, &zout, &zin);
+            if (ZSTD_isError(zReturn)) {
+                vt_report_error(0, "Error decompressing [%s]: %s", path.c_str(), ZSTD_getErrorName(zReturn));
+            }
+            if (zin.pos > inPos || zout.pos > 0) {
+                inFrame = (zReturn != 0);
+            }
+            inPos = zin.pos;
+            outputPending = (zout.pos == zout.size);
+            if (skipping) {
+                skip -= zout.pos;
+            } else {
+                produced += zout.pos;
+            }
+        }
+        return produced;
+    }
+
+    bool isEof() const { return eof; }
+
+    void close() {
+        if (dStream) ZSTD_freeDStream(dStream);
+        dStream = NULL;
+        if (in) fclose(in);
+        in = NULL;
+    }
+
+private:
+    std::string path;
+    FILE *in;
+    ZSTD_DStream *dStream;
+    std::vector<char> input;
+    size_t inPos;
+    size_t inSize;
+    uint64_t skip;
+    bool outputPending;
+    bool inFrame;
+    bool eof;
+};
+
+#endif // ZSTD_SEEKABLE_H_
@@ -17,6 +17,9 @@ CREATE LIBRARY ContinuousIntegerParserLib AS :continuousintegerparser_libfile;
 \set ExampleDelimitedParser_libfile '\''`pwd`'/build/ExampleDelimitedParser.so\'';
 CREATE LIBRARY ExampleDelimitedParserLib AS :ExampleDelimitedParser_libfile;
 
+\set FusedDelimitedParser_libfile '\''`pwd`'/build/FusedDelimitedParser.so\'';
+CREATE LIBRARY FusedDelimitedParserLib AS :FusedDelimitedParser_libfile;
+
 \set libcsv_libfile '\''`pwd`'/build/Rfc4180CsvParser.so\'';
 CREATE LIBRARY Rfc4180CsvParserLib AS :libcsv_libfile;
 
@@ -33,6 +36,9 @@ LANGUAGE 'C++' NAME 'ContinuousIntegerParserFactory' LIBRARY ContinuousIntegerPa
 CREATE PARSER ExampleDelimitedParser AS 
 LANGUAGE 'C++' NAME 'DelimitedParserExampleFactory' LIBRARY ExampleDelimitedParserLib;
 
+CREATE PARSER FusedDelimitedParser AS 
+LANGUAGE 'C++' NAME 'FusedDelimitedParserExampleFactory' LIBRARY FusedDelimitedParserLib;
+
 CREATE PARSER LibCSVParser AS 
 LANGUAGE 'C++' NAME 'LibCSVParserFactory' LIBRARY Rfc4180CsvParserLib;
 
@@ -117,6 +123,44 @@ copy t from stdin with parser CsvParser();
 select * from t order by i;
 truncate table t;
 
+-- The Continuous* helpers can log a one-line summary of load counters
+-- (bytes, rows, reserve() calls, coroutine switches, cycles in/out of run())
+-- to the UDx log when the parser is torn down
+copy t from stdin with parser ExampleDelimitedParser(load_counters=true);
+0
+1
+2
+\.
+truncate table t;
+
+-- They can also record a per-thread event timeline (coroutine switches,
+-- blocked reads, chunk boundaries, rejects) and write it to trace_dir as
+-- a Chrome trace_event JSON file; open it in chrome://tracing or Perfetto
+\! mkdir -p /tmp/udx_traces
+copy t from stdin with parser ExampleDelimitedParser(trace_dir='/tmp/udx_traces');
+0
+1
+2
+\.
+truncate table t;
+
+-- Give up on a file as soon as more than 10% of its rows (after the
+-- first 1000) are rejected, rather than rejecting it row by row; a fifth
+-- of these rows are bad, so the load aborts at about row 1000
+\! seq 1 2000 | sed 's/[05]$/x/' > /tmp/vertica_udparser_bad_rows.txt
+copy t from '/tmp/vertica_udparser_bad_rows.txt' with parser ExampleDelimitedParser(reject_max_rate=0.1, reject_min_rows=1000);
+truncate table t;
+\! rm /tmp/vertica_udparser_bad_rows.txt
+
+-- Gunzip, convert from UTF-16 and parse in one step; the same as
+--     FILTER GZip() FILTER Iconverter(from_encoding='UTF-16') PARSER ExampleDelimitedParser()
+-- but without passing the data through two intermediate buffers
+\! seq 1 100000 | iconv -f UTF-8 -t UTF-16 | gzip > /tmp/vertica_udparser_utf16.txt.gz
+copy t from '/tmp/vertica_udparser_utf16.txt.gz' with parser FusedDelimitedParser(compression='gzip', from_encoding='UTF-16');
+select count(*) from t;
+truncate table t;
+\! rm /tmp/vertica_udparser_utf16.txt.gz
+
 -- Can even use as an external table
 \! seq 1 100000 > /tmp/vertica_udparser_external_table_example.txt
 \set tmpfile '''/tmp/vertica_udparser_external_table_example.txt'''
@@ -131,5 +175,6 @@ DROP TABLE ext_t;
 DROP LIBRARY BasicIntegerParserLib CASCADE;
 DROP LIBRARY ContinuousIntegerParserLib CASCADE;
 DROP LIBRARY ExampleDelimitedParserLib CASCADE;
+DROP LIBRARY FusedDelimitedParserLib CASCADE;
 DROP LIBRARY Rfc4180CsvParserLib CASCADE;
 DROP LIBRARY TraditionalCsvParserLib CASCADE;
@@ -45,7 +45,7 @@ public:
 
             std::string st(ptr(), pos);
             writer->setInt(0, strToInt(st));
-            writer->next();
+            emitRow();
 
             while (reserved == pos + 1 && !isdigit(*ptr(pos))) {
                 pos++;
@@ -80,5 +80,11 @@ public:
             SizedColumnTypes &returnType) {
         returnType.addInt(argTypes.getColumnName(0));
     }
+
+    virtual void getParameterType(ServerInterface &srvInterface,
+                                  SizedColumnTypes &parameterTypes) {
+        LoadCounters::addParameterType(parameterTypes);
+        CoroutineTracer::addParameterType(parameterTypes);
+    }
 };
 RegisterFactory(ContinuousIntegerParserFactory);
@@ -12,6 +12,12 @@ ExampleDelimitedUDChunker::ExampleDelimitedUDChunker(char recordTerminator) :
 void ExampleDelimitedUDChunker::setup(ServerInterface &srvInterface, SizedColumnTypes &colTypes)
 {
     pastPortion = false;
+    tracer.start(srvInterface, "ExampleDelimitedUDChunker");
+}
+
+void ExampleDelimitedUDChunker::destroy(ServerInterface &srvInterface, SizedColumnTypes &colTypes)
+{
+    tracer.finish(srvInterface);
 }
 
 /**
@@ -111,6 +117,7 @@ StreamState ExampleDelimitedUDChunker::process(ServerInterface &srvInterface,
     // if we were able to find some rows, move the offset to point at the start of the next (potential) row, or end of block
     if (ret > input.offset) {
         input.offset = ret;
+        tracer.record(TRACE_CHUNK_ALIGNED);
         return CHUNK_ALIGNED;
     }
 
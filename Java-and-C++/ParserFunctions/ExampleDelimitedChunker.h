@@ -1,6 +1,7 @@
 /* Copyright (c) 2005 - 2016 Hewlett Packard Enterprise Development LP  -*- C++ -*-*/
 
 #include "Vertica.h"
+#include "CoroutineHelpers.h"
 
 #ifndef EXAMPLEDELIMCHUNKER_H_
 #define EXAMPLEDELIMCHUNKER_H_
@@ -22,11 +23,16 @@ private:
     // Apportioned load state
     bool pastPortion;
 
+    // Optional timeline tracing; see CoroutineTracer
+    CoroutineTracer tracer;
+
 public:
     ExampleDelimitedUDChunker(char recordTerminator = '\n');
 
     void setup(ServerInterface &srvInterface, SizedColumnTypes &colTypes);
 
+    void destroy(ServerInterface &srvInterface, SizedColumnTypes &colTypes);
+
     StreamState alignPortion(ServerInterface &srvInterface, DataBuffer &input, InputState state);
 
     StreamState process(ServerInterface &srvInterface,
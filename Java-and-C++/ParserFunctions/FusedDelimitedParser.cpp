@@ -0,0 +1,154 @@
+/* Copyright (c) 2005 - 2016 Hewlett Packard Enterprise Development LP  -*- C++ -*-*/
+
+
+#include "Vertica.h"
+#include "DelimitedParserFramework.h"
+#include "InputDecoder.h"
+
+using namespace Vertica;
+
+#include <string>
+#include <vector>
+
+
+/**
+ * FusedDelimitedParser
+ *
+ * The delimited parser from ExampleDelimitedParser.cpp, with gunzipping
+ * and conversion to UTF-8 built in.  It does the work of
+ *     ... FILTER GZip() FILTER Iconverter(...) PARSER DelimitedParserExample()
+ * in one pipeline stage.
+ *
+ * The chained version copies each byte through two intermediate server
+ * buffers, each big enough to fall out of cache before the next stage
+ * reads it.  Here, the input is decoded a small window at a time, and
+ * each window is parsed straight away while it is still in cache.
+ */
+template <class StringParserImpl>
+class FusedDelimitedParser : public DelimitedParserFramework<StringParserImpl> {
+public:
+    FusedDelimitedParser(char delimiter, char recordTerminator,
+            const SizedColumnTypes &colInfo, StringParserImpl parseImpl,
+            bool enforceNotNulls, bool gzip, Utf8Transcoder::Encoding encoding) :
+        DelimitedParserFramework<StringParserImpl>(delimiter, recordTerminator, colInfo,
+                                                   parseImpl, enforceNotNulls),
+        gzip(gzip), encoding(encoding), needDecodedInput(true) {}
+
+    // Small enough to stay in L2 cache; grows if a record doesn't fit
+    static const size_t WINDOW_SIZE = 256 * 1024;
+
+    virtual void initialize(ServerInterface &srvInterface, SizedColumnTypes &colTypes) {
+        decoder.init(gzip, encoding);
+        window.init(WINDOW_SIZE);
+        needDecodedInput = true;
+    }
+
+    virtual void deinitialize(ServerInterface &srvInterface, SizedColumnTypes &colTypes) {
+        decoder.close();
+    }
+
+    /**
+     * Decode the input into the window, and run the parser on the
+     * window rather than on the input.
+     */
+    virtual StreamState process(ServerInterface &srvInterface, DataBuffer &input, InputState input_state) {
+        while (true) {
+            if (needDecodedInput) {
+                if (!window.fill(decoder, input, input_state == END_OF_FILE)) {
+                    return INPUT_NEEDED;
+                }
+                needDecodedInput = false;
+            }
+
+            InputState windowState = window.getState();
+            StreamState result = DelimitedParserFramework<StringParserImpl>::process(
+                    srvInterface, window.getBuffer(), windowState);
+            if (result != INPUT_NEEDED) return result;
+            needDecodedInput = true;
+        }
+    }
+
+private:
+    const bool gzip;
+    const Utf8Transcoder::Encoding encoding;
+
+    InputDecoder decoder;
+    DecodedWindow window;
+    bool needDecodedInput;  // The parser has used up the window
+};
+
+template <class StringParserImpl>
+class FusedDelimitedParserFactory : public DelimitedParserFrameworkFactory<StringParserImpl> {
+public:
+    virtual bool isChunkerApportionable(ServerInterface &srvInterface) {
+        // Records can't be found in compressed input
+        return false;
+    }
+
+    virtual void plan(ServerInterface &srvInterface,
+            PerColumnParamReader &perColumnParamReader,
+            PlanContext &planCtxt) {
+        DelimitedParserFrameworkFactory<StringParserImpl>::plan(srvInterface, perColumnParamReader, planCtxt);
+        isGzip(srvInterface);
+        getEncoding(srvInterface);
+    }
+
+    virtual UDChunker* prepareChunker(ServerInterface &srvInterface,
+                                      PerColumnParamReader &perColumnParamReader,
+                                      PlanContext &planCtxt,
+                                      const SizedColumnTypes &colTypes)
+    {
+        return NULL;
+    }
+
+    virtual UDParser* createParser(ServerInterface &srvInterface,
+            char delimiter, char recordTerminator,
+            const SizedColumnTypes &colTypes,
+            StringParserImpl sp, bool enforceNotNulls)
+    {
+        return vt_createFuncObject<FusedDelimitedParser<StringParserImpl> >
+               (srvInterface.allocator,
+                delimiter,
+                recordTerminator,
+                colTypes,
+                sp,
+                enforceNotNulls,
+                isGzip(srvInterface),
+                getEncoding(srvInterface)
+            );
+    }
+
+    virtual void getParameterType(ServerInterface &srvInterface,
+                                  SizedColumnTypes &parameterTypes) {
+        DelimitedParserFrameworkFactory<StringParserImpl>::getParameterType(srvInterface, parameterTypes);
+        parameterTypes.addVarchar(16, "compression");
+        parameterTypes.addVarchar(32, "from_encoding");
+    }
+
+private:
+    static bool isGzip(ServerInterface &srvInterface) {
+        ParamReader args(srvInterface.getParamReader());
+        if (!args.containsParameter("compression")) return false;
+        const std::string compression = args.getStringRef("compression").str();
+        if (compression == "gzip") return true;
+        if (compression != "none") {
+            vt_report_error(0, "Invalid compression \"%s\": must be 'gzip' or 'none'", compression.c_str());
+        }
+        return false;
+    }
+
+    static Utf8Transcoder::Encoding getEncoding(ServerInterface &srvInterface) {
+        ParamReader args(srvInterface.getParamReader());
+        if (!args.containsParameter("from_encoding")) return Utf8Transcoder::NONE;
+        const std::string from = args.getStringRef("from_encoding").str();
+        const Utf8Transcoder::Encoding encoding = Utf8Transcoder::lookup(from, "UTF-8");
+        if (encoding == Utf8Transcoder::NONE) {
+            vt_report_error(0, "Unsupported from_encoding \"%s\": must be UTF-16, UTF-16LE, UTF-16BE or ISO-8859-1; "
+                            "use the Iconverter filter for other encodings", from.c_str());
+        }
+        return encoding;
+    }
+};
+
+typedef FusedDelimitedParserFactory<StringParsers> FusedDelimitedParserExampleFactory;
+RegisterFactory(FusedDelimitedParserExampleFactory);
@@ -66,7 +66,7 @@ public:
         while (!cr.isEof()) {
             Line line = readLine();
             if (writeRecord(line)) {
-                writer->next();
+                emitRow();
                 recordsAcceptedInBatch++;    // number of rows.
             }
 
@@ -468,6 +468,8 @@ struct CsvParserFactory : public ParserFactory {
         parameterTypes.addBool("trailing_nullcols");
         parameterTypes.addVarchar(65000,"null");
         parameterTypes.addVarchar(65000,"format");
+        LoadCounters::addParameterType(parameterTypes);
+        CoroutineTracer::addParameterType(parameterTypes);
     }
 };
 RegisterFactory(CsvParserFactory);
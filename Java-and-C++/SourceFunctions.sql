@@ -11,6 +11,9 @@
 \set file_libfile '\''`pwd`'/build/filelib.so\'';
 CREATE LIBRARY filelib AS :file_libfile;
 
+\set coalescing_libfile '\''`pwd`'/build/CoalescingFileSource.so\'';
+CREATE LIBRARY coalescinglib AS :coalescing_libfile;
+
 \set curl_libfile '\''`pwd`'/build/cURLLib.so\'';
 CREATE LIBRARY curllib AS :curl_libfile;
 
@@ -21,6 +24,9 @@ CREATE LIBRARY multicurllib AS :multicurl_libfile;
 CREATE SOURCE file AS 
 LANGUAGE 'C++' NAME 'FileSourceFactory' LIBRARY filelib;
 
+CREATE SOURCE coalesced_file AS
+LANGUAGE 'C++' NAME 'CoalescingFileSourceFactory' LIBRARY coalescinglib;
+
 CREATE SOURCE curl AS 
 LANGUAGE 'C++' NAME 'CurlSourceFactory' LIBRARY curllib;
 
@@ -44,6 +50,49 @@ create table t (i integer);
 copy t source file(file='/tmp/vertica_udsource_example/data.txt');
 select * from t order by i;
 truncate table t;
+-- Read with O_DIRECT in 8MB blocks, bypassing the page cache; good for
+-- big files on fast local disks that will only be read once.
+-- read_mode='buffered' reads through the page cache in big blocks,
+-- with read-ahead hints.
+copy t source file(file='/tmp/vertica_udsource_example/data.txt', read_mode='direct', block_size=8388608);
+select * from t order by i;
+truncate table t;
+-- Keep 8 reads of 1MB in flight ahead of the load (with io_uring, or
+-- a thread pool where that isn't available), to keep a fast SSD busy
+copy t source file(file='/tmp/vertica_udsource_example/data.txt', read_mode='async', block_size=1048576, queue_depth=8);
+select * from t order by i;
+truncate table t;
+-- Copy straight out of the page cache, for files that are already there
+-- (e.g. ones that are loaded over and over)
+copy t source file(file='/tmp/vertica_udsource_example/data.txt', read_mode='mmap');
+select * from t order by i;
+truncate table t;
+-- Remember what's in each directory in /tmp/vertica_udsource_manifests, so
+-- later loads don't list it again unless it has changed; and only load
+-- files that aren't recorded there as loaded already.
+-- The files a load reads are only pending until it is known to have
+-- committed: once it has, pending_files='commit' records them as loaded.
+-- If it failed or was rolled back, pending_files='discard' forgets them,
+-- so that the next load reads them again.  An incremental load fails
+-- while an earlier one is still pending.  Neither step loads anything;
+-- give it the same file, nodes and manifest_dir as the load.
+-- The second load finds nothing new.
+\! mkdir -p /tmp/vertica_udsource_manifests/
+copy t source file(file='/tmp/vertica_udsource_example/data*.txt', manifest_dir='/tmp/vertica_udsource_manifests', incremental=true);
+commit;
+copy t source file(file='/tmp/vertica_udsource_example/data*.txt', manifest_dir='/tmp/vertica_udsource_manifests', pending_files='commit');
+copy t source file(file='/tmp/vertica_udsource_example/data*.txt', manifest_dir='/tmp/vertica_udsource_manifests', incremental=true);
+commit;
+copy t source file(file='/tmp/vertica_udsource_example/data*.txt', manifest_dir='/tmp/vertica_udsource_manifests', pending_files='commit');
+select * from t order by i;
+truncate table t;
+
+-- Read all the matching files back to back, as one stream per thread,
+-- rather than setting up a source (and a parser) for each one; adds a
+-- newline after any file that doesn't end with one
+copy t source coalesced_file(file='/tmp/vertica_udsource_example/data*.txt');
+select * from t order by i;
+truncate table t;
 
 copy t source curl(url=:url);
 select * from t order by i;
@@ -52,16 +101,26 @@ truncate table t;
 copy t source multicurl(url=:url2);
 select * from t order by i;
 truncate table t;
+-- Download on a background thread, up to 4 blocks ahead of the load
+copy t source multicurl(url=:url2, prefetch_blocks=4);
+select * from t order by i;
+truncate table t;
+-- Give the biggest files out first, each to the node with the fewest bytes so far
+copy t source multicurl(url=:url2, assign_by_size=true);
+select * from t order by i;
+truncate table t;
 
 -- Step 4: Cleanup
 DROP TABLE t;
 
 DROP LIBRARY filelib CASCADE;
+DROP LIBRARY coalescinglib CASCADE;
 DROP LIBRARY curllib CASCADE;
 DROP LIBRARY multicurllib CASCADE;
 
 \! kill `cat /tmp/vertica_udsource_example/SimpleHTTPServer.pid`
 \! rm -r /tmp/vertica_udsource_example/
+\! rm -r /tmp/vertica_udsource_manifests/
 
 
 
@@ -0,0 +1,264 @@
+/* Copyright (c) 2005 - 2016 Hewlett Packard Enterprise Development LP  -*- C++ -*-*/
+
+#include "Vertica.h"
+#include "LoadArgParsers.h"
+#include "FileEnumerator.h"
+#include "FileAssignment.h"
+#include <stdio.h>
+#include <errno.h>
+
+using namespace Vertica;
+
+/**
+ * CoalescingFileSource
+ *
+ * Reads a group of files back to back, as one stream.  Loading lots of
+ * small files one source per file spends most of its time setting up
+ * and tearing down sources (and the parsers behind them); this way
+ * there is one source per thread, however many files there are.
+ *
+ * Each file is read straight into the output buffer, with no buffering
+ * of its own; so a file that fits in what's left of the buffer costs an
+ * open(), a read() and a close().  If a file doesn't end with the record
+ * terminator, one is added after it, so that its last record doesn't
+ * run into the next file's first one.
+ *
+ * getUri() is the file being read at the time; so rejections are
+ * reported against that file, give or take the records still on their
+ * way through the parser at a file boundary.
+ */
+class CoalescingFileSource : public UDSource {
+public:
+    CoalescingFileSource(const std::vector<FileEntry> &files, char terminator,
+                         const std::string &loadedManifestDir = "", const std::string &loadId = "")
+        : files(files), terminator(terminator), loadedManifestDir(loadedManifestDir), loadId(loadId),
+          current(0), fd(-1), fileRead(0), lastByte(terminator), pendingTerminator(false) {}
+
+    virtual ~CoalescingFileSource() {
+        if (fd >= 0) ::close(fd);
+    }
+
+    virtual void setup(ServerInterface &srvInterface) {
+        srvInterface.log("CoalescingFileSource: reading %zu files (%llu bytes) as one stream",
+                         files.size(), (unsigned long long)getTotalSize());
+    }
+
+    virtual StreamState process(ServerInterface &srvInterface, DataBuffer &output) {
+        while (output.offset < output.size) {
+            if (pendingTerminator) {
+                output.buf[output.offset++] = terminator;
+                pendingTerminator = false;
+                continue;
+            }
+
+            if (fd < 0) {
+                if (current == files.size()) return DONE;
+                fd = ::open(files[current].path.c_str(), O_RDONLY);
+                if (fd < 0) {
+                    vt_report_error(0, "Error opening file [%s]: %s",
+                                    files[current].path.c_str(), strerror(errno));
+                }
+                lastByte = terminator;  // So that an empty file adds nothing
+                fileRead = 0;
+            }
+
+            const size_t wanted = output.size - output.offset;
+            const ssize_t got = read(fd, output.buf + output.offset, wanted);
+            if (got < 0 && errno == EINTR) continue;
+            if (got < 0) {
+                vt_report_error(0, "Error reading file [%s]: %s",
+                                files[current].path.c_str(), strerror(errno));
+            }
+            if (got > 0) {
+                output.offset += got;
+                fileRead += got;
+                lastByte = output.buf[output.offset - 1];
+            }
+
+            // Once the size the file was found with has been read, it's done;
+            // so most small files don't need another read() to find the end.
+            // A short read alone doesn't mean that: on FUSE and direct I/O
+            // mounts, read() can come up short in the middle of a file
+            if (got == 0 || fileRead >= files[current].size) {
+                ::close(fd);
+                fd = -1;
+                if (!loadedManifestDir.empty()) loaded.push_back(files[current]);
+                current++;
+                pendingTerminator = (lastByte != terminator);
+            }
+        }
+        return OUTPUT_NEEDED;
+    }
+
+    virtual void destroy(ServerInterface &srvInterface) {
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+
+        // Everything read all the way through, in one go; pending until
+        // the load is known to have committed
+        if (!loaded.empty()) {
+            LoadedFiles record(loadedManifestDir);
+            if (!record.addPending(loadId, loaded)) {
+                srvInterface.log("CoalescingFileSource: could not record %zu files as loaded in [%s]: %s",
+                                 loaded.size(), record.getPath().c_str(), strerror(errno));
+            }
+            loaded.clear();
+        }
+    }
+
+    virtual std::string getUri() {
+        if (files.empty()) return "";
+        return files[std::min(current, files.size() - 1)].path;
+    }
+
+    virtual vint getSize() {
+        return getTotalSize();
+    }
+
+private:
+    uint64_t getTotalSize() const {
+        uint64_t total = 0;
+        for (size_t i = 0; i < files.size(); i++) total += files[i].size;
+        return total;
+    }
+
+    const std::vector<FileEntry> files;
+    const char terminator;
+    const std::string loadedManifestDir;    // Record files as loaded here, if set
+    const std::string loadId;               // Under this load's pending record
+
+    size_t current;                 // The file being read
+    int fd;                         // Open on the current file; -1 between files
+    uint64_t fileRead;              // Bytes read from the current file
+    char lastByte;                  // The last byte read from the current file
+    bool pendingTerminator;         // A terminator is owed after the file just read
+    std::vector<FileEntry> loaded;  // Read all the way through
+};
+
+/**
+ * CoalescingFileSourceFactory
+ *
+ * Takes the same "file" pattern and "nodes" list as FileSource, and
+ * optionally
+ * - "record_terminator" -- The terminator to add after a file that
+ *            doesn't end with one (default '\n').
+ * - "manifest_dir" -- Cache directory listings here (see FileEnumerator).
+ * - "incremental" -- If true, skip files recorded as loaded in
+ *            manifest_dir, and record the ones that this load reads as
+ *            pending (see LoadedFiles).
+ * - "pending_files" -- 'commit' to record the files that earlier
+ *            incremental loads read as loaded, once those loads have
+ *            committed; 'discard' to forget them, after the loads
+ *            failed.  Nothing is loaded.
+ *
+ * Each node shares its files out between as many sources as the load
+ * gets threads, so that each gets about the same number of bytes.
+ */
+class CoalescingFileSourceFactory : public SourceFactory {
+public:
+    virtual void plan(ServerInterface &srvInterface,
+            NodeSpecifyingPlanContext &planCtxt) {
+        std::vector<ArgEntry> argSpec;
+        argSpec.push_back((ArgEntry){"file", true, VerticaType(VarcharOID, -1)});
+        argSpec.push_back((ArgEntry){"nodes", false, VerticaType(VarcharOID, -1)});
+        argSpec.push_back((ArgEntry){"record_terminator", false, VerticaType(VarcharOID, -1)});
+        argSpec.push_back((ArgEntry){"manifest_dir", false, VerticaType(VarcharOID, -1)});
+        argSpec.push_back((ArgEntry){"incremental", false, VerticaType(BoolOID, -1)});
+        argSpec.push_back((ArgEntry){"pending_files", false, VerticaType(VarcharOID, -1)});
+        validateArgs("CoalescingFileSource", argSpec, srvInterface.getParamReader());
+        if (srvInterface.getParamReader().containsParameter("record_terminator")
+                && srvInterface.getParamReader().getStringRef("record_terminator").length() != 1) {
+            vt_report_error(0, "parameter \"record_terminator\" must be a single character");
+        }
+        LoadedFiles::plan(srvInterface, planCtxt);
+
+        findExecutionNodes(srvInterface.getParamReader(), planCtxt, srvInterface.getCurrentNodeName());
+    }
+
+    /* one thread per group of files; as many groups as we're allowed threads */
+    virtual ssize_t getDesiredThreads(ServerInterface &srvInterface,
+            ExecutorPlanContext &planCtxt) {
+        const std::string filename = srvInterface.getParamReader().getStringRef("file").str();
+        const std::string manifestDir = LoadedFiles::getManifestDir(srvInterface);
+        const bool incremental = LoadedFiles::isIncremental(srvInterface);
+
+        std::vector<FileEntry> *files =
+            vt_createFuncObject<std::vector<FileEntry> >(srvInterface.allocator);
+        planCtxt.getWriter().setPointer("files", files);
+
+        // Settle earlier incremental loads, rather than load anything
+        if (!LoadedFiles::getPendingFiles(srvInterface).empty()) {
+            LoadedFiles::settlePending(srvInterface, "CoalescingFileSource");
+            return 1;
+        }
+        if (incremental) LoadedFiles::checkNothingPending(manifestDir, LoadedFiles::getLoadId(planCtxt));
+
+        // Runs on each executor node, so this finds the node's local files
+        FileEnumerator enumerator(manifestDir);
+        std::vector<FileEntry> found;
+        const FileEnumerator::Result ret = enumerator.expand(filename, true, found);
+        if (ret == FileEnumerator::READ_ERROR) {
+            vt_report_error(0, "Read error when expanding glob: %s (reading [%s]: %s)", filename.c_str(),
+                            enumerator.getErrorPath().c_str(), strerror(enumerator.getErrorCode()));
+        } else if (ret == FileEnumerator::NO_MATCH) {
+            vt_report_error(0, "No files matching pattern [%s] were found", filename.c_str());
+        }
+
+        LoadedFiles loaded(manifestDir);
+        if (incremental) loaded.load();
+        for (size_t i = 0; i < found.size(); i++) {
+            if (!incremental || !loaded.contains(found[i])) files->push_back(found[i]);
+        }
+
+        srvInterface.log("CoalescingFileSource: %zu files matching [%s]%s",
+                         files->size(), filename.c_str(), incremental ? " not already loaded" : "");
+        return std::max((size_t)1, std::min(planCtxt.getMaxAllowedThreads(), files->size()));
+    }
+
+    virtual std::vector<UDSource*> prepareUDSourcesExecutor(ServerInterface &srvInterface,
+            ExecutorPlanContext &planCtxt) {
+        const std::vector<FileEntry> *files =
+            planCtxt.getWriter().getPointer<std::vector<FileEntry> >("files");
+        if (files == NULL) {
+            vt_report_error(0, "Expanded glob not found in context");
+        }
+
+        const size_t numSources = std::min(files->size(),
+                (size_t)std::max(planCtxt.getLoadConcurrency(), (ssize_t)1));
+        std::vector<uint64_t> sizes;
+        for (size_t i = 0; i < files->size(); i++) sizes.push_back((*files)[i].size);
+        const std::vector<FileAssignment> assignments = assignFilesBySize(sizes, numSources, false);
+
+        std::vector<std::vector<FileEntry> > groups(numSources);
+        for (size_t i = 0; i < assignments.size(); i++) {
+            groups[assignments[i].node].push_back((*files)[assignments[i].file]);
+        }
+
+        const bool incremental = LoadedFiles::isIncremental(srvInterface);
+        const std::string loadedManifestDir = incremental ? LoadedFiles::getManifestDir(srvInterface) : "";
+        const std::string loadId = incremental ? LoadedFiles::getLoadId(planCtxt) : "";
+        std::vector<UDSource *> sources;
+        for (size_t i = 0; i < groups.size(); i++) {
+            if (groups[i].empty()) continue;
+            sources.push_back(vt_createFuncObject<CoalescingFileSource>(srvInterface.allocator,
+                    groups[i], getTerminator(srvInterface), loadedManifestDir, loadId));
+        }
+        return sources;
+    }
+
+    virtual void getParameterType(ServerInterface &srvInterface,
+                                  SizedColumnTypes &parameterTypes) {
+        parameterTypes.addVarchar(65000, "file");
+        parameterTypes.addVarchar(65000, "nodes");
+        parameterTypes.addVarchar(1, "record_terminator");
+        LoadedFiles::addParameterType(parameterTypes);
+    }
+
+private:
+    static char getTerminator(ServerInterface &srvInterface) {
+        ParamReader args(srvInterface.getParamReader());
+        return args.containsParameter("record_terminator") ?
+            args.getStringRef("record_terminator").str()[0] : '\n';
+    }
+};
+RegisterFactory(CoalescingFileSourceFactory);
@@ -3,6 +3,7 @@
 #include <set>
 #include "Vertica.h"
 #include "ContinuousUDSource.h"
+#include "FileAssignment.h"
 
 #include "curl_support/VDistLib.h"
 
@@ -17,6 +18,14 @@ VDistStreamProducer* openURL(const std::string &url, Vertica::ServerInterface &s
  * The cURLSource Source takes one argument at the SQL command line
  * - "url" -- The URL of a plain-text file containing a list of
  *            other URLs (one per line) of files to download.
+ * and optionally
+ * - "prefetch_blocks" -- If set, download on a background thread,
+ *            up to this many 1MB blocks (at most 1024) ahead of the load,
+ *            so that network stalls don't hold up parsing.
+ * - "assign_by_size" -- If true, find the size of each file (with a
+ *            HEAD request), and give the biggest files out first, each
+ *            to the node with the fewest bytes so far, rather than
+ *            handing the files out to the nodes in turn.
  *
  * This source will download that list of files, then distribute the files
  * among the nodes in the cluster; each node will then download the files
@@ -26,15 +35,44 @@ VDistStreamProducer* openURL(const std::string &url, Vertica::ServerInterface &s
  */
 class cURLSource : public ContinuousUDSource {
 public:
-    cURLSource(std::string url, std::string filename)
-        : url(url), filename(filename) {}
+    cURLSource(std::string url, std::string filename, Vertica::vint prefetchBlocks = 0)
+        : url(url), filename(filename), prefetchBlocks(prefetchBlocks), prefetchOut(NULL) {}
+
+    static const size_t PREFETCH_BLOCK_SIZE = 1024 * 1024;
+    static const size_t MAX_PREFETCH_BLOCKS = 1024;
 
     void initialize(Vertica::ServerInterface &srvInterface) {
+        _errorCode = CURLE_OK;
+        _errorMessage[0] = '\0';
         stream = openURL(filename, getServerInterface());
+        if (prefetchBlocks > 0) {
+            enablePrefetch(prefetchBlocks, PREFETCH_BLOCK_SIZE);
+        }
     }
 
     void run() {
         stream->produce(*this, WriteMemoryCallback);
+        checkTransfer();
+    }
+
+    void runInBackground(BlockQueueWriter &out) {
+        prefetchOut = &out;
+        stream->produce(*this, PrefetchCallback, PrefetchCancelled);
+        prefetchOut = NULL;
+        checkTransfer();
+    }
+
+    /**
+     * Fail the load if the transfer failed; otherwise the part of the
+     * file that did arrive would be loaded as if it were all of it.
+     * On the I/O thread, this reaches the load through the block queue.
+     */
+    void checkTransfer() {
+        if (_errorCode != CURLE_OK) {
+            throw udf_exception(0, "Error downloading [" + filename + "]: " +
+                                (_errorMessage[0] ? _errorMessage : curl_easy_strerror((CURLcode)_errorCode)),
+                                __FILE__, __LINE__);
+        }
     }
 
     void deinitialize(Vertica::ServerInterface &srvInterface) {
@@ -48,6 +86,23 @@ public:
         return src->cw.write(contents, size*nmemb);
     }
 
+    // Returning a short count makes curl abort the transfer; that's
+    // what we want once the load has been canceled
+    static size_t
+    PrefetchCallback(void *contents, size_t size, size_t nmemb, void *userp)
+    {
+        cURLSource *src = (cURLSource *)userp;
+        return src->prefetchOut->write(contents, size*nmemb);
+    }
+
+    // A stalled transfer doesn't call PrefetchCallback; this stops it
+    // once the load has been canceled, so that the I/O thread can be joined
+    static bool PrefetchCancelled(void *userp)
+    {
+        cURLSource *src = (cURLSource *)userp;
+        return src->prefetchOut->isCancelled();
+    }
+
     // Needed by some of the curl infrastructure
     int                   _errorCode;
     char                  _errorMessage[1024];
@@ -55,8 +110,10 @@ public:
 private:
     std::string url;
     std::string filename;
+    Vertica::vint prefetchBlocks;
 
     VDistStreamProducer* stream;
+    BlockQueueWriter *prefetchOut;
 };
 
 class cURLSourceFactory : public Vertica::SourceFactory
@@ -68,6 +125,10 @@ public:
                                   Vertica::SizedColumnTypes &parameterTypes)
     {
         parameterTypes.addVarchar(65000, "url");
+        parameterTypes.addInt("prefetch_blocks");
+        parameterTypes.addBool("assign_by_size");
+        LoadCounters::addParameterType(parameterTypes);
+        CoroutineTracer::addParameterType(parameterTypes);
     }
 
     virtual void plan(Vertica::ServerInterface &srvInterface,
@@ -75,6 +136,14 @@ public:
     {
         Vertica::ParamWriter &pwriter = planCtx.getWriter();
 
+        Vertica::ParamReader &args = srvInterface.getParamReader();
+        if (args.containsParameter("prefetch_blocks")
+                && (args.getIntRef("prefetch_blocks") < 0
+                    || args.getIntRef("prefetch_blocks") > (Vertica::vint)cURLSource::MAX_PREFETCH_BLOCKS)) {
+            vt_report_error(0, "parameter \"prefetch_blocks\" must be between 0 and %d",
+                            (int)cURLSource::MAX_PREFETCH_BLOCKS);
+        }
+
         VDistLib vlib(getUrl(srvInterface));
         vlib.open();
 
@@ -87,21 +156,27 @@ public:
         // Get the files that the source has
         std::vector<std::string> files = vlib.getFiles("");
 
-        // Assign the files to the nodes in round robin fashion
-        size_t nodeIdx = 0;
+        // Assign the files to the nodes in round robin fashion, or by size
+        std::vector<size_t> fileNodes(files.size());
+        if (isAssignedBySize(srvInterface)) {
+            assignBySize(srvInterface, vlib, files, nodes.size(), fileNodes);
+        } else {
+            for (size_t i=0; i<files.size(); ++i) {
+                fileNodes[i] = i % nodes.size();
+            }
+        }
+
         std::stringstream ss;
         for (size_t i=0; i<files.size(); ++i) {
             // Param named nodename:i, value is file name
             ss.str("");
-            ss << nodes[nodeIdx] << ":" << i;
+            ss << nodes[fileNodes[i]] << ":" << i;
             const std::string fieldName = ss.str();
 
             // Set the appropriate field
             pwriter.getStringRef(fieldName).copy(files[i]);
 
-            // select next node, wrapping as necessary
-            usedNodes.insert(nodeIdx);
-            nodeIdx = (nodeIdx+1) % nodes.size();
+            usedNodes.insert(fileNodes[i]);
         }
 
         // Set which nodes should be used
@@ -123,6 +198,10 @@ public:
     {
         const std::string nodeName = srvInterface.getCurrentNodeName();
         const std::string url      = getUrl(srvInterface);
+        Vertica::vint prefetchBlocks = 0;
+        if (srvInterface.getParamReader().containsParameter("prefetch_blocks")) {
+            prefetchBlocks = srvInterface.getParamReader().getIntRef("prefetch_blocks");
+        }
 
         std::vector<Vertica::UDSource*> retVal;
 
@@ -140,7 +219,7 @@ public:
             if (pos == 0) {
                 std::string filename = preader.getStringRef(paramName).str();
                 retVal.push_back
-                  (Vertica::vt_createFuncObject<cURLSource>(srvInterface.allocator, url, filename));
+                  (Vertica::vt_createFuncObject<cURLSource>(srvInterface.allocator, url, filename, prefetchBlocks));
             }
         }
 
@@ -154,6 +233,40 @@ private:
        return si.getParamReader().getStringRef("url").str();
    }
 
+    bool isAssignedBySize(Vertica::ServerInterface &si) {
+        Vertica::ParamReader args(si.getParamReader());
+        return args.containsParameter("assign_by_size") && args.getBoolRef("assign_by_size");
+    }
+
+    // Largest files first, each to the node with the fewest bytes so far.
+    // Files are never split; a file whose size the server won't tell us
+    // is counted as the average of the others.
+    void assignBySize(Vertica::ServerInterface &si, VDistLib &vlib,
+                      const std::vector<std::string> &files, size_t numNodes,
+                      std::vector<size_t> &fileNodes) {
+        const std::vector<long long> lengths = vlib.getFileSizes(files);
+        long long known = 0, knownTotal = 0;
+        for (size_t i=0; i<lengths.size(); ++i) {
+            if (lengths[i] >= 0) {
+                known++;
+                knownTotal += lengths[i];
+            }
+        }
+        if (known < (long long)lengths.size()) {
+            si.log("cURLSource: sizes of %lld of %zu files are unknown",
+                   (long long)lengths.size() - known, lengths.size());
+        }
+
+        std::vector<uint64_t> sizes;
+        for (size_t i=0; i<lengths.size(); ++i) {
+            sizes.push_back(lengths[i] >= 0 ? lengths[i] : (known > 0 ? knownTotal / known : 0));
+        }
+        const std::vector<FileAssignment> assignments = assignFilesBySize(sizes, numNodes, false);
+        for (size_t i=0; i<assignments.size(); ++i) {
+            fileNodes[assignments[i].file] = assignments[i].node;
+        }
+    }
+
 };
 
 RegisterFactory(cURLSourceFactory);
@@ -15,8 +15,12 @@ private:
     std::string url;
 
     virtual StreamState process(ServerInterface &srvInterface, DataBuffer &output) {
-        output.offset = url_fread(output.buf, 1, output.size, handle);
-        return url_feof(handle) ? DONE : OUTPUT_NEEDED;
+        output.offset += url_fread(output.buf + output.offset, 1, output.size - output.offset, handle);
+        if (!url_feof(handle)) return OUTPUT_NEEDED;
+        if (url_ferror(handle)) {
+            vt_report_error(0, "Error reading URL [%s]: %s", url.c_str(), url_strerror(handle));
+        }
+        return DONE;
     }
 
 public:
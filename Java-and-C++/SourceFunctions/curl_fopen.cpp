@@ -2,132 +2,316 @@
 
 #include "curl_fopen.h"
 #include <unistd.h>
+#include <strings.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+
+/*
+ * Transfers are driven by an event loop: a curl multi handle, which says
+ * (through its socket and timer callbacks) which sockets it is waiting
+ * on and when it next wants to be called, and an epoll set watching
+ * those sockets.  A reader that needs data sleeps in epoll_wait() until
+ * a socket is ready or curl's timer is due, then hands just that to
+ * curl_multi_socket_action(); nothing polls.
+ *
+ * Each thread has one loop, shared by all the transfers opened on it, so
+ * driving the loop for one transfer receives data for the others too,
+ * each into its own ring buffer.  A transfer whose ring is full is
+ * paused until its reader makes room.  The loop's lock is held while it
+ * is driven or a ring is used, so a transfer can be read on a different
+ * thread from the one that opened it.  A loop is freed along with the
+ * last of its transfers.
+ */
+struct fcurl_loop
+{
+  pthread_mutex_t lock;
+  CURLM *multi;
+  int epoll_fd;
+  long timeout_at;            /* when curl's timer is due (ms); -1 if unset */
 
-CURLM *multi_handle;
+  pthread_t thread;           /* the thread it belongs to */
+  int refs;                   /* open transfers */
+  struct fcurl_loop *next;    /* in the list of loops */
+};
 
-/* curl calls this routine to get more data */
-static size_t write_callback(char *buffer,
-                             size_t size,
-                             size_t nitems,
-                             void *userp)
+/* the live loops, one per thread with open transfers */
+static pthread_mutex_t loops_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct fcurl_loop *loops = NULL;
+
+#define LOOP_EVENTS 64
+
+static long now_ms(void)
 {
-  char *newbuff;
-  size_t rembuff;
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
 
-  URL_FILE *url = (URL_FILE *)userp;
-  size *= nitems;
+/* curl calls this to say which sockets to watch, and for what */
+static int socket_callback(CURL *easy, curl_socket_t s, int what,
+                           void *userp, void *socketp)
+{
+  struct fcurl_loop *loop = (struct fcurl_loop *)userp;
+  struct epoll_event ev;
+  (void)easy;
+  (void)socketp;
+
+  if(what == CURL_POLL_REMOVE) {
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, s, NULL);
+    return 0;
+  }
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = ((what & CURL_POLL_IN) ? EPOLLIN : 0) |
+              ((what & CURL_POLL_OUT) ? EPOLLOUT : 0);
+  ev.data.fd = s;
+  if(epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, s, &ev) != 0 && errno == ENOENT)
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, s, &ev);
+  return 0;
+}
+
+/* curl calls this to say when it next wants to be called, regardless */
+static int timer_callback(CURLM *multi, long timeout_ms, void *userp)
+{
+  struct fcurl_loop *loop = (struct fcurl_loop *)userp;
+  (void)multi;
 
-  rembuff=url->buffer_len - url->buffer_pos; /* remaining space in buffer */
+  loop->timeout_at = (timeout_ms < 0) ? -1 : now_ms() + timeout_ms;
+  return 0;
+}
 
-  if(size > rembuff) {
-    /* not enough space in buffer */
-      newbuff=(char*)realloc(url->buffer,url->buffer_len + (size - rembuff));
-    if(newbuff==NULL) {
-      fprintf(stderr,"callback buffer grow failed\n");
-      size=rembuff;
+/* get this thread's loop, with a reference for the caller */
+static struct fcurl_loop *loop_acquire(void)
+{
+  struct fcurl_loop *loop;
+
+  pthread_mutex_lock(&loops_lock);
+  for(loop = loops; loop; loop = loop->next) {
+    if(pthread_equal(loop->thread, pthread_self()))
+      break;
+  }
+
+  if(!loop) {
+    loop = (struct fcurl_loop *)calloc(1, sizeof(struct fcurl_loop));
+    if(loop) {
+      loop->epoll_fd = epoll_create(LOOP_EVENTS);
+      loop->multi = curl_multi_init();
+      if(loop->epoll_fd < 0 || !loop->multi) {
+        if(loop->epoll_fd >= 0)
+          close(loop->epoll_fd);
+        if(loop->multi)
+          curl_multi_cleanup(loop->multi);
+        free(loop);
+        loop = NULL;
+      }
     }
-    else {
-      /* realloc suceeded increase buffer size*/
-      url->buffer_len+=size - rembuff;
-      url->buffer=newbuff;
+    if(loop) {
+      pthread_mutex_init(&loop->lock, NULL);
+      loop->timeout_at = -1;
+      loop->thread = pthread_self();
+      curl_multi_setopt(loop->multi, CURLMOPT_SOCKETFUNCTION, socket_callback);
+      curl_multi_setopt(loop->multi, CURLMOPT_SOCKETDATA, loop);
+      curl_multi_setopt(loop->multi, CURLMOPT_TIMERFUNCTION, timer_callback);
+      curl_multi_setopt(loop->multi, CURLMOPT_TIMERDATA, loop);
+      loop->next = loops;
+      loops = loop;
     }
   }
 
-  memcpy(&url->buffer[url->buffer_pos], buffer, size);
-  url->buffer_pos += size;
+  if(loop)
+    loop->refs++;
+  pthread_mutex_unlock(&loops_lock);
+  return loop;
+}
 
-  return size;
+/* drop a reference to a loop, and free it if that was the last one */
+static void loop_release(struct fcurl_loop *loop)
+{
+  struct fcurl_loop **prev;
+  int last;
+
+  pthread_mutex_lock(&loops_lock);
+  last = (--loop->refs == 0);
+  if(last) {
+    for(prev = &loops; *prev != loop; prev = &(*prev)->next)
+      ;
+    *prev = loop->next;
+  }
+  pthread_mutex_unlock(&loops_lock);
+
+  if(last) {
+    curl_multi_cleanup(loop->multi);
+    close(loop->epoll_fd);
+    pthread_mutex_destroy(&loop->lock);
+    free(loop);
+  }
 }
 
-/* use to attempt to fill the read buffer up to requested number of bytes */
-static int fill_buffer(URL_FILE *file, size_t want)
+/* wait for a socket or the timer, and let curl deal with it; loop is locked */
+static void loop_run(struct fcurl_loop *loop)
 {
-  fd_set fdread;
-  fd_set fdwrite;
-  fd_set fdexcep;
-  struct timeval timeout;
-  int recordcount = 0;
-
-  /* only attempt to fill buffer if transactions still running and buffer
-   * doesnt exceed required size already
-   */
-  if((!file->still_running) || (file->buffer_pos > want))
-    return 0;
+  struct epoll_event events[LOOP_EVENTS];
+  int running;
+  int timeout = -1;
+  int n;
+  int i;
+  CURLMsg *msg;
+
+  if(loop->timeout_at >= 0) {
+    long left = loop->timeout_at - now_ms();
+    timeout = (left > 0) ? (int)left : 0;
+  }
+
+  n = epoll_wait(loop->epoll_fd, events, LOOP_EVENTS, timeout);
+  for(i = 0; i < n; i++) {
+    int mask = 0;
+    if(events[i].events & EPOLLIN)
+      mask |= CURL_CSELECT_IN;
+    if(events[i].events & EPOLLOUT)
+      mask |= CURL_CSELECT_OUT;
+    if(events[i].events & (EPOLLERR | EPOLLHUP))
+      mask |= CURL_CSELECT_ERR;
+    curl_multi_socket_action(loop->multi, events[i].data.fd, mask, &running);
+  }
 
-  /* attempt to fill buffer */
-  do {
-    int maxfd = -1;
-    long curl_timeo = -1;
-
-    FD_ZERO(&fdread);
-    FD_ZERO(&fdwrite);
-    FD_ZERO(&fdexcep);
-
-    /* set a suitable timeout to fail on */
-    timeout.tv_sec = 60; /* 1 minute */
-    timeout.tv_usec = 0;
-
-    curl_multi_timeout(multi_handle, &curl_timeo);
-    if(curl_timeo >= 0) {
-      timeout.tv_sec = curl_timeo / 1000;
-      if(timeout.tv_sec > 1)
-        timeout.tv_sec = 1;
-      else
-        timeout.tv_usec = (curl_timeo % 1000) * 1000;
+  if(loop->timeout_at >= 0 && now_ms() >= loop->timeout_at) {
+    loop->timeout_at = -1;
+    curl_multi_socket_action(loop->multi, CURL_SOCKET_TIMEOUT, 0, &running);
+  }
+
+  /* note which transfers have finished */
+  while((msg = curl_multi_info_read(loop->multi, &running))) {
+    if(msg->msg == CURLMSG_DONE) {
+      URL_FILE *file = NULL;
+      curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&file);
+      if(file) {
+        file->still_running = 0;
+        file->result = msg->data.result;
+      }
     }
+  }
+}
+
+/* copy into the ring buffer, which must have room */
+static void ring_put(URL_FILE *file, const char *src, size_t n)
+{
+  size_t end = (file->buffer_start + file->buffer_used) % file->buffer_len;
+  size_t first = file->buffer_len - end;
+  if(first > n)
+    first = n;
+
+  memcpy(&file->buffer[end], src, first);
+  memcpy(file->buffer, src + first, n - first);
+  file->buffer_used += n;
+}
+
+/* take up to n bytes from the front of the ring buffer */
+static size_t ring_get(URL_FILE *file, char *dst, size_t n)
+{
+  size_t first;
+
+  if(n > file->buffer_used)
+    n = file->buffer_used;
+  first = file->buffer_len - file->buffer_start;
+  if(first > n)
+    first = n;
+
+  memcpy(dst, &file->buffer[file->buffer_start], first);
+  memcpy(dst + first, file->buffer, n - first);
+  file->buffer_start = (file->buffer_start + n) % file->buffer_len;
+  file->buffer_used -= n;
+  if(!file->buffer_used)
+    file->buffer_start = 0;
+  return n;
+}
+
+/* curl calls this routine to get more data */
+static size_t write_callback(char *buffer,
+                             size_t size,
+                             size_t nitems,
+                             void *userp)
+{
+  URL_FILE *url = (URL_FILE *)userp;
+  size *= nitems;
 
-    /* get file descriptors from the transfers */
-    curl_multi_fdset(multi_handle, &fdread, &fdwrite, &fdexcep, &maxfd);
+  if(size > url->buffer_len)
+    return 0; /* can never fit; fails the transfer */
 
-    /* In a real-world program you OF COURSE check the return code of the
-       function calls.  On success, the value of maxfd is guaranteed to be
-       greater or equal than -1.  We call select(maxfd + 1, ...), specially
-       in case of (maxfd == -1), we call select(0, ...), which is basically
-       equal to sleep. */
+  if(size > url->buffer_len - url->buffer_used) {
+    /* curl keeps the data, and offers it again once unpaused */
+    url->paused = 1;
+    return CURL_WRITEFUNC_PAUSE;
+  }
 
-    if (maxfd != -1)
-        recordcount = select(maxfd+1, &fdread, &fdwrite, &fdexcep, &timeout);
-    else
-        // man page for curl_multi_fdset recommends a 100ms sleep
-        usleep(100000);
+  ring_put(url, buffer, size);
+  return size;
+}
 
-    switch(recordcount) {
-    case -1:
-      /* select error */
-      break;
+/* use to attempt to fill the read buffer up to requested number of bytes;
+   the file's loop is locked */
+static int fill_buffer(URL_FILE *file, size_t want)
+{
+  if(want > file->buffer_len)
+    want = file->buffer_len;
 
-    case 0:
-    default:
-      /* timeout or readable/writable sockets */
-      curl_multi_perform(multi_handle, &file->still_running);
-      break;
+  while(file->still_running && (file->buffer_used < want)) {
+    if(file->paused) {
+      /* only carry on once there is room for what curl is holding */
+      if(file->buffer_len - file->buffer_used < CURL_MAX_WRITE_SIZE)
+        break;
+      file->paused = 0;
+      curl_easy_pause(file->handle.curl, CURLPAUSE_CONT);
+      continue;
     }
-  } while(file->still_running && (file->buffer_pos < want));
+    loop_run(file->loop);
+  }
   return 1;
 }
 
-/* use to remove want bytes from the front of a files buffer */
-static int use_buffer(URL_FILE *file,int want)
+/* start a transfer of url (of just the given byte range, if range is not
+   NULL) into file; returns 0 if it has failed already */
+static int open_curl(URL_FILE *file, const char *url, const char *range)
 {
-  /* sort out buffer */
-  if((file->buffer_pos - want) <=0) {
-    /* ditch buffer - write will recreate */
-    if(file->buffer)
-      free(file->buffer);
-
-    file->buffer=NULL;
-    file->buffer_pos=0;
-    file->buffer_len=0;
+  int failed;
+
+  file->loop = loop_acquire();
+  file->buffer = (char *)malloc(URL_BUFFER_SIZE);
+  if(!file->loop || !file->buffer) {
+    if(file->loop)
+      loop_release(file->loop);
+    file->loop = NULL;
+    return 0;
   }
-  else {
-    /* move rest down make it available for later */
-    memmove(file->buffer,
-            &file->buffer[want],
-            (file->buffer_pos - want));
-
-    file->buffer_pos -= want;
+  file->buffer_len = URL_BUFFER_SIZE;
+
+  file->type = CFTYPE_CURL; /* marked as URL */
+  file->handle.curl = curl_easy_init();
+
+  curl_easy_setopt(file->handle.curl, CURLOPT_URL, url);
+  curl_easy_setopt(file->handle.curl, CURLOPT_WRITEDATA, file);
+  curl_easy_setopt(file->handle.curl, CURLOPT_VERBOSE, 0L);
+  curl_easy_setopt(file->handle.curl, CURLOPT_WRITEFUNCTION, write_callback);
+  curl_easy_setopt(file->handle.curl, CURLOPT_PRIVATE, file);
+  curl_easy_setopt(file->handle.curl, CURLOPT_NOSIGNAL, 1L);
+  /* as url_range_size() does, so that the size is that of what is read */
+  curl_easy_setopt(file->handle.curl, CURLOPT_FOLLOWLOCATION, 1L);
+  if(range) {
+    /* an error page is not part of the range */
+    curl_easy_setopt(file->handle.curl, CURLOPT_RANGE, range);
+    curl_easy_setopt(file->handle.curl, CURLOPT_FAILONERROR, 1L);
   }
-  return 0;
+
+  pthread_mutex_lock(&file->loop->lock);
+  curl_multi_add_handle(file->loop->multi, file->handle.curl);
+  file->still_running = 1;
+
+  /* lets start the fetch, and wait for some data or the end */
+  fill_buffer(file, 1);
+  failed = (!file->still_running) && (file->result != CURLE_OK);
+  pthread_mutex_unlock(&file->loop->lock);
+
+  return !failed;
 }
 
 URL_FILE *url_fopen(const char *url,const char *operation)
@@ -147,38 +331,131 @@ URL_FILE *url_fopen(const char *url,const char *operation)
   if((file->handle.file=fopen(url,operation)))
     file->type = CFTYPE_FILE; /* marked as URL */
 
-  else {
-    file->type = CFTYPE_CURL; /* marked as URL */
-    file->handle.curl = curl_easy_init();
+  else if(!open_curl(file, url, NULL)) {
+    /* if the transfer failed already, we should return NULL */
+    url_fclose(file);
+    file = NULL;
+  }
+  return file;
+}
 
-    curl_easy_setopt(file->handle.curl, CURLOPT_URL, url);
-    curl_easy_setopt(file->handle.curl, CURLOPT_WRITEDATA, file);
-    curl_easy_setopt(file->handle.curl, CURLOPT_VERBOSE, 0L);
-    curl_easy_setopt(file->handle.curl, CURLOPT_WRITEFUNCTION, write_callback);
+URL_FILE *url_fopen_range(const char *url, curl_off_t start, curl_off_t end)
+{
+  URL_FILE *file;
+  char range[64];
+
+  if(end >= 0)
+    snprintf(range, sizeof(range), "%" CURL_FORMAT_CURL_OFF_T "-%" CURL_FORMAT_CURL_OFF_T,
+             start, end);
+  else
+    snprintf(range, sizeof(range), "%" CURL_FORMAT_CURL_OFF_T "-", start);
+
+  file = (URL_FILE*)malloc(sizeof(URL_FILE));
+  if(!file)
+    return NULL;
 
-    if(!multi_handle)
-      multi_handle = curl_multi_init();
+  memset(file, 0, sizeof(URL_FILE));
 
-    curl_multi_add_handle(multi_handle, file->handle.curl);
+  if(!open_curl(file, url, range)) {
+    url_fclose(file);
+    file = NULL;
+  }
+  return file;
+}
 
-    /* lets start the fetch */
-    curl_multi_perform(multi_handle, &file->still_running);
+long url_response_code(URL_FILE *file)
+{
+  long code = 0;
 
-    if((file->buffer_pos == 0) && (!file->still_running)) {
-      /* if still_running is 0 now, we should return NULL */
+  if(file->type == CFTYPE_CURL) {
+    pthread_mutex_lock(&file->loop->lock);
+    curl_easy_getinfo(file->handle.curl, CURLINFO_RESPONSE_CODE, &code);
+    pthread_mutex_unlock(&file->loop->lock);
+  }
+  return code;
+}
 
-      /* make sure the easy handle is not in the multi handle anymore */
-      curl_multi_remove_handle(multi_handle, file->handle.curl);
+/* what url_range_size() finds out, from the headers of its probe */
+struct range_probe
+{
+  curl_off_t size;            /* from Content-Range; -1 if none */
+};
 
-      /* cleanup */
-      curl_easy_cleanup(file->handle.curl);
+static size_t probe_header_callback(char *buffer, size_t size, size_t nitems,
+                                    void *userp)
+{
+  struct range_probe *probe = (struct range_probe *)userp;
+  static const char name[] = "content-range:";
+  size_t len = size * nitems;
+  const char *slash;
+  char value[128];
+
+  /* "Content-Range: bytes 0-0/<size>"; the size is an asterisk if unknown */
+  if(len > sizeof(name) - 1 && len - (sizeof(name) - 1) < sizeof(value) &&
+     !strncasecmp(buffer, name, sizeof(name) - 1)) {
+    memcpy(value, buffer + sizeof(name) - 1, len - (sizeof(name) - 1));
+    value[len - (sizeof(name) - 1)] = 0;
+    slash = strchr(value, '/');
+    if(slash && slash[1] >= '0' && slash[1] <= '9')
+      probe->size = (curl_off_t)strtoll(slash + 1, NULL, 10);
+  }
+  return len;
+}
 
-      free(file);
+static size_t probe_write_callback(char *buffer, size_t size, size_t nitems,
+                                   void *userp)
+{
+  (void)buffer;
+  (void)userp;
+  /* a whole object coming back means no ranges; no need to wait for it */
+  return (size * nitems > 1) ? 0 : size * nitems;
+}
 
-      file = NULL;
-    }
+int url_range_size(const char *url, curl_off_t *size)
+{
+  struct range_probe probe;
+  CURL *curl;
+  CURLcode res;
+  long code = 0;
+  curl_off_t length = -1;
+  int ret = -1;
+
+  probe.size = -1;
+  *size = -1;
+
+  curl = curl_easy_init();
+  if(!curl)
+    return -1;
+
+  curl_easy_setopt(curl, CURLOPT_URL, url);
+  curl_easy_setopt(curl, CURLOPT_RANGE, "0-0");
+  curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+  curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+  curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, probe_header_callback);
+  curl_easy_setopt(curl, CURLOPT_HEADERDATA, &probe);
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, probe_write_callback);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, NULL);
+
+  res = curl_easy_perform(curl);
+  curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+  curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length);
+
+  if(code == 206 && probe.size >= 0 && (res == CURLE_OK || res == CURLE_WRITE_ERROR)) {
+    *size = probe.size;
+    ret = 1;
   }
-  return file;
+  else if(code == 416 && probe.size == 0) {
+    /* an empty object; there's no byte 0 to ask for */
+    *size = 0;
+    ret = 1;
+  }
+  else if(code == 200 && (res == CURLE_OK || res == CURLE_WRITE_ERROR)) {
+    *size = length;
+    ret = 0;
+  }
+
+  curl_easy_cleanup(curl);
+  return ret;
 }
 
 int url_fclose(URL_FILE *file)
@@ -192,10 +469,13 @@ int url_fclose(URL_FILE *file)
 
   case CFTYPE_CURL:
     /* make sure the easy handle is not in the multi handle anymore */
-    curl_multi_remove_handle(multi_handle, file->handle.curl);
+    pthread_mutex_lock(&file->loop->lock);
+    curl_multi_remove_handle(file->loop->multi, file->handle.curl);
+    pthread_mutex_unlock(&file->loop->lock);
 
     /* cleanup */
     curl_easy_cleanup(file->handle.curl);
+    loop_release(file->loop);
     break;
 
   default: /* unknown or supported type - oh dear */
@@ -222,8 +502,33 @@ int url_feof(URL_FILE *file)
     break;
 
   case CFTYPE_CURL:
-    if((file->buffer_pos == 0) && (!file->still_running))
+    pthread_mutex_lock(&file->loop->lock);
+    if((file->buffer_used == 0) && (!file->still_running))
       ret = 1;
+    pthread_mutex_unlock(&file->loop->lock);
+    break;
+
+  default: /* unknown or supported type - oh dear */
+    ret=-1;
+    errno=EBADF;
+    break;
+  }
+  return ret;
+}
+
+int url_ferror(URL_FILE *file)
+{
+  int ret=0;
+
+  switch(file->type) {
+  case CFTYPE_FILE:
+    ret=ferror(file->handle.file);
+    break;
+
+  case CFTYPE_CURL:
+    pthread_mutex_lock(&file->loop->lock);
+    ret = (!file->still_running) && (file->result != CURLE_OK);
+    pthread_mutex_unlock(&file->loop->lock);
     break;
 
   default: /* unknown or supported type - oh dear */
@@ -234,6 +539,13 @@ int url_feof(URL_FILE *file)
   return ret;
 }
 
+const char *url_strerror(URL_FILE *file)
+{
+  if(file->type == CFTYPE_CURL)
+    return curl_easy_strerror(file->result);
+  return strerror(errno);
+}
+
 size_t url_fread(void *ptr, size_t size, size_t nmemb, URL_FILE *file)
 {
   size_t want;
@@ -246,21 +558,13 @@ size_t url_fread(void *ptr, size_t size, size_t nmemb, URL_FILE *file)
   case CFTYPE_CURL:
     want = nmemb * size;
 
+    pthread_mutex_lock(&file->loop->lock);
     fill_buffer(file,want);
 
-    /* check if theres data in the buffer - if not fill_buffer()
-     * either errored or EOF */
-    if(!file->buffer_pos)
-      return 0;
-
-    /* ensure only available data is considered */
-    if(file->buffer_pos < want)
-      want = file->buffer_pos;
-
-    /* xfer data to caller */
-    memcpy(ptr, file->buffer, want);
-
-    use_buffer(file,want);
+    /* xfer whatever data there is to caller; if there isn't any,
+     * fill_buffer() either errored or got to EOF */
+    want = ring_get(file, (char *)ptr, want);
+    pthread_mutex_unlock(&file->loop->lock);
 
     want = want / size;     /* number of items */
     break;
@@ -285,31 +589,33 @@ char *url_fgets(char *ptr, size_t size, URL_FILE *file)
     break;
 
   case CFTYPE_CURL:
+    pthread_mutex_lock(&file->loop->lock);
     fill_buffer(file,want);
 
     /* check if theres data in the buffer - if not fill either errored or
      * EOF */
-    if(!file->buffer_pos)
+    if(!file->buffer_used) {
+      pthread_mutex_unlock(&file->loop->lock);
       return NULL;
+    }
 
     /* ensure only available data is considered */
-    if(file->buffer_pos < want)
-      want = file->buffer_pos;
+    if(file->buffer_used < want)
+      want = file->buffer_used;
 
     /*buffer contains data */
     /* look for newline or eof */
     for(loop=0;loop < want;loop++) {
-      if(file->buffer[loop] == '\n') {
+      if(file->buffer[(file->buffer_start + loop) % file->buffer_len] == '\n') {
         want=loop+1;/* include newline */
         break;
       }
     }
 
     /* xfer data to caller */
-    memcpy(ptr, file->buffer, want);
+    ring_get(file, ptr, want);
     ptr[want]=0;/* allways null terminate */
-
-    use_buffer(file,want);
+    pthread_mutex_unlock(&file->loop->lock);
 
     break;
 
@@ -330,20 +636,23 @@ void url_rewind(URL_FILE *file)
     break;
 
   case CFTYPE_CURL:
-    /* halt transaction */
-    curl_multi_remove_handle(multi_handle, file->handle.curl);
+    pthread_mutex_lock(&file->loop->lock);
 
-    /* restart */
-    curl_multi_add_handle(multi_handle, file->handle.curl);
+    /* halt transaction */
+    curl_multi_remove_handle(file->loop->multi, file->handle.curl);
 
-    /* ditch buffer - write will recreate - resets stream pos*/
-    if(file->buffer)
-      free(file->buffer);
+    /* ditch buffer - resets stream pos */
+    file->buffer_start = 0;
+    file->buffer_used = 0;
+    file->paused = 0;
+    file->result = CURLE_OK;
 
-    file->buffer=NULL;
-    file->buffer_pos=0;
-    file->buffer_len=0;
+    /* restart */
+    curl_easy_pause(file->handle.curl, CURLPAUSE_CONT);
+    curl_multi_add_handle(file->loop->multi, file->handle.curl);
+    file->still_running = 1;
 
+    pthread_mutex_unlock(&file->loop->lock);
     break;
 
   default: /* unknown or supported type - oh dear */
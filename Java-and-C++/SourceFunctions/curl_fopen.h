@@ -65,6 +65,9 @@ enum fcurl_type_e {
   CFTYPE_CURL=2
 };
 
+/* The event loop that drives a thread's transfers; see curl_fopen.cpp */
+struct fcurl_loop;
+
 struct fcurl_data
 {
   enum fcurl_type_e type;     /* type of handle */
@@ -73,23 +76,41 @@ struct fcurl_data
     FILE *file;
   } handle;                   /* handle */
 
-  char *buffer;               /* buffer to store cached data*/
-  size_t buffer_len;          /* currently allocated buffers length */
-  size_t buffer_pos;          /* end of data in buffer*/
+  struct fcurl_loop *loop;    /* event loop driving the transfer */
+
+  char *buffer;               /* ring buffer of received data */
+  size_t buffer_len;          /* size of the ring buffer */
+  size_t buffer_start;        /* where the data in the ring starts */
+  size_t buffer_used;         /* how much data is in the ring */
+  int paused;                 /* transfer paused, for want of space in the ring */
   int still_running;          /* Is background url fetch still in progress */
+  CURLcode result;            /* how the transfer ended */
 };
 
 typedef struct fcurl_data URL_FILE;
 
+/* size of each transfer's ring buffer */
+#define URL_BUFFER_SIZE (1024 * 1024)
+
 /* exported functions */
 URL_FILE *url_fopen(const char *url,const char *operation);
 int url_fclose(URL_FILE *file);
 int url_feof(URL_FILE *file);
+int url_ferror(URL_FILE *file);
+const char *url_strerror(URL_FILE *file);
 size_t url_fread(void *ptr, size_t size, size_t nmemb, URL_FILE *file);
 char * url_fgets(char *ptr, size_t size, URL_FILE *file);
 void url_rewind(URL_FILE *file);
 
-/* we use a global one for convenience */
-extern CURLM *multi_handle;
+/* Fetch just bytes start..end (inclusive) of url, or from start on if end
+   is -1, with an HTTP range request; returns NULL if the request fails.
+   Servers that don't do ranges send the whole thing instead, which
+   url_response_code() tells apart: 206 rather than 200. */
+URL_FILE *url_fopen_range(const char *url, curl_off_t start, curl_off_t end);
+long url_response_code(URL_FILE *file);
+
+/* Find the size of url, and whether range requests work on it: returns 1
+   if they do, 0 if they don't (size is -1 if unknown), -1 on error. */
+int url_range_size(const char *url, curl_off_t *size);
 
 #endif // _CURL_FOPEN_H
@@ -65,6 +65,34 @@ std::vector<std::string> VDistLib::getFiles(std::string suffix)
     }
 }
 
+std::vector<long long> VDistLib::getFileSizes(const std::vector<std::string> &urls)
+{
+    // One handle for all the requests, so that connections get reused
+    CurlHandle curl_handle;
+    curl_easy_setopt(curl_handle, CURLOPT_NOBODY, 1L);
+    curl_easy_setopt(curl_handle, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl_handle, CURLOPT_FAILONERROR, 1L);
+    curl_easy_setopt(curl_handle, CURLOPT_USERAGENT, "libcurl-agent/1.0");
+
+    std::vector<long long> sizes;
+    for (size_t i = 0; i < urls.size(); ++i) {
+        curl_easy_setopt(curl_handle, CURLOPT_URL, urls[i].c_str());
+        long long size = -1;
+        if (curl_easy_perform(curl_handle) == CURLE_OK) {
+#if LIBCURL_VERSION_NUM >= 0x073700
+            curl_off_t length = -1;
+            curl_easy_getinfo(curl_handle, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length);
+#else
+            double length = -1;
+            curl_easy_getinfo(curl_handle, CURLINFO_CONTENT_LENGTH_DOWNLOAD, &length);
+#endif
+            size = length < 0 ? -1 : (long long)length;
+        }
+        sizes.push_back(size);
+    }
+    return sizes;
+}
+
 VDistStream* VDistLib::getFile(const std::string &filename)
 {
     std::stringstream ss;
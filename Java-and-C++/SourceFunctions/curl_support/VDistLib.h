@@ -27,6 +27,10 @@ struct VDistLib
     // List all files available on the server
     std::vector<std::string> getFiles(std::string suffix = "/list");
 
+    // Sizes of the files at the given URLs, from HEAD requests; -1 where
+    // the server doesn't say
+    std::vector<long long> getFileSizes(const std::vector<std::string> &urls);
+
     // Open a URL for reading. Callers responsibility to free the returned stream.
     VDistStream* getFile(const std::string &filename);
 
@@ -48,6 +52,8 @@ struct CurlHandle
 
 
 typedef size_t (*CurlCallbackFn)(void *contents, size_t size, size_t nmemb, void *userp);
+// Returns true to abort a transfer; called about once a second, even while it is stalled
+typedef bool (*CurlAbortFn)(void *userp);
 // Adapter that invokes curl and feeds data as necessary
 class VDistStreamProducer : public StreamProducer 
 {
@@ -56,7 +62,7 @@ public:
     virtual void produce(CoroutineStream &str);
 
     template <class StreamType>
-    void produce(StreamType &vp_str, CurlCallbackFn fn) {
+    void produce(StreamType &vp_str, CurlCallbackFn fn, CurlAbortFn abortFn = NULL) {
         /* init the curl session */
         CurlHandle curl_handle;
         
@@ -78,6 +84,19 @@ public:
         /* Set error bufferer */
         curl_easy_setopt(curl_handle, CURLOPT_ERRORBUFFER, vp_str._errorMessage);
 
+        /* let the caller stop a transfer that isn't getting any data */
+        AbortCheck check = { abortFn, (void *)&vp_str };
+        if (abortFn) {
+            curl_easy_setopt(curl_handle, CURLOPT_NOPROGRESS, 0L);
+#if LIBCURL_VERSION_NUM >= 0x072000
+            curl_easy_setopt(curl_handle, CURLOPT_XFERINFOFUNCTION, XferInfoCallback);
+            curl_easy_setopt(curl_handle, CURLOPT_XFERINFODATA, (void *)&check);
+#else
+            curl_easy_setopt(curl_handle, CURLOPT_PROGRESSFUNCTION, ProgressCallback);
+            curl_easy_setopt(curl_handle, CURLOPT_PROGRESSDATA, (void *)&check);
+#endif
+        }
+
         /* get it! */
         vp_str._errorCode = curl_easy_perform(curl_handle);
         
@@ -88,6 +107,23 @@ private:
     static size_t
     WriteMemoryCallback(void *contents, size_t size, size_t nmemb, void *userp);
 
+    struct AbortCheck {
+        CurlAbortFn fn;
+        void *userp;
+    };
+
+#if LIBCURL_VERSION_NUM >= 0x072000
+    static int XferInfoCallback(void *p, curl_off_t, curl_off_t, curl_off_t, curl_off_t) {
+        const AbortCheck *check = (const AbortCheck *)p;
+        return check->fn(check->userp) ? 1 : 0;
+    }
+#else
+    static int ProgressCallback(void *p, double, double, double, double) {
+        const AbortCheck *check = (const AbortCheck *)p;
+        return check->fn(check->userp) ? 1 : 0;
+    }
+#endif
+
     std::string _url;
 };
 
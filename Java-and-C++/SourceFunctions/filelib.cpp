@@ -2,35 +2,83 @@
 
 #include "Vertica.h"
 #include "LoadArgParsers.h"
+#include "FileReaders.h"
+#include "FileEnumerator.h"
 #include <stdio.h>
-#include <glob.h>
 
 using namespace Vertica;
 
 class FileSource : public UDSource {
 protected:
-    FILE *handle;
+    FileReader *reader;
     std::string filename;
+    const std::string readMode;
+    const size_t blockSize;
+    const size_t queueDepth;
+
+    /** Where in the file to start reading */
+    virtual off_t getStartOffset() { return 0; }
+
+    /** Where reading is expected to stop; -1 for the end of the file */
+    virtual off_t getEndHint() { return -1; }
 
     virtual StreamState process(ServerInterface &srvInterface, DataBuffer &output) {
-        output.offset += fread(output.buf + output.offset, 1, output.size - output.offset, handle);
-        return feof(handle) ? DONE : OUTPUT_NEEDED;
+        output.offset += reader->read(output.buf + output.offset, output.size - output.offset);
+        if (!reader->atEnd()) return OUTPUT_NEEDED;
+        finished = true;
+        return DONE;
     }
 
 public:
-    FileSource(const std::string &filename) : filename(filename) {}
+    FileSource(const std::string &filename, const std::string &readMode = "stdio",
+               size_t blockSize = FileReader::DEFAULT_BLOCK_SIZE,
+               size_t queueDepth = FileReader::DEFAULT_QUEUE_DEPTH)
+        : reader(NULL), filename(filename), readMode(readMode), blockSize(blockSize),
+          queueDepth(queueDepth), finished(false) {}
+
+    /**
+     * Once the whole file has been read, add it to the pending LoadedFiles
+     * record of load `loadId` in `manifestDir`; `entry` is the file as it
+     * was found.
+     */
+    void recordWhenRead(const std::string &manifestDir, const std::string &loadId,
+                        const FileEntry &entry) {
+        loadedManifestDir = manifestDir;
+        loadedLoadId = loadId;
+        loadedEntry = entry;
+    }
+
+    virtual ~FileSource() {
+        // In case setup() failed partway, and destroy() wasn't called
+        delete reader;
+    }
 
     virtual void setup(ServerInterface &srvInterface) {
-        handle = fopen(filename.c_str(),"r");
+        reader = FileReader::create(readMode, blockSize, queueDepth);
+        if (reader == NULL) {
+            vt_report_error(0, "Invalid read_mode '%s'", readMode.c_str());
+        }
+        reader->open(filename, getStartOffset(), getEndHint());
 
-        // Validate the file handle; make sure we can read from this file
-        if (handle == NULL) {
-            vt_report_error(0, "Error opening file [%s]", filename.c_str());
+        AsyncFileReader *asyncReader = dynamic_cast<AsyncFileReader *>(reader);
+        if (asyncReader) {
+            srvInterface.log("FileSource: reading [%s] with %s, %zu reads in flight",
+                             filename.c_str(), asyncReader->getEngineName(), queueDepth);
         }
     }
 
     virtual void destroy(ServerInterface &srvInterface) {
-        fclose(handle);
+        if (reader) reader->close();
+        delete reader;
+        reader = NULL;
+
+        if (finished && !loadedManifestDir.empty()) {
+            LoadedFiles loaded(loadedManifestDir);
+            if (!loaded.addPending(loadedLoadId, loadedEntry)) {
+                srvInterface.log("FileSource: could not record [%s] as loaded in [%s]: %s",
+                                 filename.c_str(), loaded.getPath().c_str(), strerror(errno));
+            }
+        }
     }
 
     virtual std::string getUri() {return filename;}
@@ -43,6 +91,12 @@ public:
             return file.st_size;
         }
     }
+
+private:
+    bool finished;                  // The reader got to the end of the file
+    std::string loadedManifestDir;  // Set by recordWhenRead()
+    std::string loadedLoadId;
+    FileEntry loadedEntry;
 };
 
 class FileSourceFactory : public SourceFactory {
@@ -55,10 +109,18 @@ public:
         std::vector<ArgEntry> argSpec;
         argSpec.push_back((ArgEntry){"file", true, VerticaType(VarcharOID, -1)});
         argSpec.push_back((ArgEntry){"nodes", false, VerticaType(VarcharOID, -1)});
+        argSpec.push_back((ArgEntry){"read_mode", false, VerticaType(VarcharOID, -1)});
+        argSpec.push_back((ArgEntry){"block_size", false, VerticaType(Int8OID, -1)});
+        argSpec.push_back((ArgEntry){"queue_depth", false, VerticaType(Int8OID, -1)});
+        argSpec.push_back((ArgEntry){"manifest_dir", false, VerticaType(VarcharOID, -1)});
+        argSpec.push_back((ArgEntry){"incremental", false, VerticaType(BoolOID, -1)});
+        argSpec.push_back((ArgEntry){"pending_files", false, VerticaType(VarcharOID, -1)});
         validateArgs("FileSource", argSpec, srvInterface.getParamReader());
+        FileReader::validateArgs(getReadMode(srvInterface), getBlockSize(srvInterface),
+                                 getQueueDepth(srvInterface));
 
         /* Populate planData */
-        // Nothing to do here
+        LoadedFiles::plan(srvInterface, planCtxt);
         
         /* Munge nodes list */
         findExecutionNodes(srvInterface.getParamReader(), planCtxt, srvInterface.getCurrentNodeName());
@@ -69,6 +131,9 @@ public:
             NodeSpecifyingPlanContext &planCtxt) {
         std::vector<UDSource*> retVal;
         std::string filename = srvInterface.getParamReader().getStringRef("file").str();
+        const std::string readMode = getReadMode(srvInterface);
+        const size_t blockSize = getBlockSize(srvInterface);
+        const size_t queueDepth = getQueueDepth(srvInterface);
 
         // Do glob expansion; if the path contains '*', find all matching files.
         // Note that this has to be done in the prepare() method:
@@ -80,27 +145,62 @@ public:
         // local filesystem, so a glob expansion won't work at all.
         // prepare(), on the other hand, runs on the execution node.  So it's
         // fine to access local files and resources.
-        glob_t globbuf;
-        globbuf.gl_offs = 0;
+        //
+        // Files are found with a FileEnumerator rather than glob(), to cope
+        // with directories of millions of files; with a manifest_dir, what
+        // was in each directory is remembered between loads.
+        const std::string manifestDir = LoadedFiles::getManifestDir(srvInterface);
+        const bool incremental = LoadedFiles::isIncremental(srvInterface);
+
+        // Settle earlier incremental loads, rather than load anything
+        if (!LoadedFiles::getPendingFiles(srvInterface).empty()) {
+            LoadedFiles::settlePending(srvInterface, "FileSource");
+            return retVal;
+        }
+        if (incremental) LoadedFiles::checkNothingPending(manifestDir, LoadedFiles::getLoadId(planCtxt));
 
-        int ret = glob(filename.c_str(), GLOB_ERR, NULL, &globbuf);
+        FileEnumerator enumerator(manifestDir);
+        std::vector<FileEntry> files;
+        FileEnumerator::Result ret = enumerator.expand(filename, incremental, files);
 
-        if (ret == GLOB_NOSPACE)
-          vt_report_error(0, "Out of memory when expanding glob: %s", filename.c_str());
-        else if (ret == GLOB_ABORTED)
-          vt_report_error(0, "Read error when expanding glob: %s", filename.c_str());
-        else if (ret == GLOB_NOMATCH)
+        if (ret == FileEnumerator::READ_ERROR)
+          vt_report_error(0, "Read error when expanding glob: %s (reading [%s]: %s)",
+                          filename.c_str(), enumerator.getErrorPath().c_str(), strerror(enumerator.getErrorCode()));
+        else if (ret == FileEnumerator::NO_MATCH)
         {
             retVal.push_back(vt_createFuncObject<FileSource>(srvInterface.allocator,
-                    filename));
+                    filename, readMode, blockSize, queueDepth));
         }
         else
         {
-            for (size_t count = 0; count < globbuf.gl_pathc; count++)
-                retVal.push_back(vt_createFuncObject<FileSource>(srvInterface.allocator,
-                        std::string(globbuf.gl_pathv[count])));
+            LoadedFiles loaded(manifestDir);
+            std::string loadId;
+            if (incremental) {
+                loaded.load();
+                loadId = LoadedFiles::getLoadId(planCtxt);
+            }
+
+            size_t skipped = 0;
+            for (size_t count = 0; count < files.size(); count++) {
+                if (incremental && loaded.contains(files[count])) {
+                    skipped++;
+                    continue;
+                }
+                FileSource *source = vt_createFuncObject<FileSource>(srvInterface.allocator,
+                        files[count].path, readMode, blockSize, queueDepth);
+                if (incremental) source->recordWhenRead(manifestDir, loadId, files[count]);
+                retVal.push_back(source);
+            }
+            if (incremental) {
+                srvInterface.log("FileSource: %zu of %zu files matching [%s] already loaded, per [%s]",
+                                 skipped, files.size(), filename.c_str(), loaded.getPath().c_str());
+            }
+        }
+        if (!manifestDir.empty()) {
+            srvInterface.log("FileSource: used %zu and saved %zu directory manifests in [%s]",
+                             enumerator.getManifestsUsed(), enumerator.getManifestsSaved(),
+                             manifestDir.c_str());
         }
-        globfree(&globbuf);
 
         return retVal;
     }
@@ -109,6 +209,27 @@ public:
                                   SizedColumnTypes &parameterTypes) {
         parameterTypes.addVarchar(65000, "file");
         parameterTypes.addVarchar(65000, "nodes");
+        parameterTypes.addVarchar(16, "read_mode");
+        parameterTypes.addInt("block_size");
+        parameterTypes.addInt("queue_depth");
+        LoadedFiles::addParameterType(parameterTypes);
+    }
+
+    static std::string getReadMode(ServerInterface &srvInterface) {
+        ParamReader args(srvInterface.getParamReader());
+        return args.containsParameter("read_mode") ? args.getStringRef("read_mode").str() : "stdio";
+    }
+
+    static vint getBlockSize(ServerInterface &srvInterface) {
+        ParamReader args(srvInterface.getParamReader());
+        return args.containsParameter("block_size") ?
+            args.getIntRef("block_size") : (vint)FileReader::DEFAULT_BLOCK_SIZE;
+    }
+
+    static vint getQueueDepth(ServerInterface &srvInterface) {
+        ParamReader args(srvInterface.getParamReader());
+        return args.containsParameter("queue_depth") ?
+            args.getIntRef("queue_depth") : (vint)FileReader::DEFAULT_QUEUE_DEPTH;
     }
 };
 RegisterFactory(FileSourceFactory);